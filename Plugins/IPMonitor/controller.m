@@ -22,6 +22,7 @@
  */
 
 #import "controller.h"
+#import <CommonCrypto/CommonDigest.h>
 #import <SystemConfiguration/SCPrivate.h>
 #import "ip_plugin.h"
 
@@ -60,6 +61,12 @@ typedef struct resolverList {
 @property (nonatomic) NSMutableDictionary	*	policyDB;
 @property (nonatomic) NEPolicySession		*	policySession;
 @property (nonatomic) NEPolicySession		*	controlPolicySession;
+@property (nonatomic) NSMutableDictionary	*	policySignatures;
+@property (nonatomic) NSMutableDictionary	*	pendingPolicyRemovals;
+@property (nonatomic) NSMutableSet		*	pendingPolicySessions;
+@property (nonatomic) NSUInteger			policiesAdded;
+@property (nonatomic) NSUInteger			policiesRemoved;
+@property (nonatomic) NSUInteger			policiesRetained;
 
 @end
 
@@ -152,6 +159,45 @@ typedef struct resolverList {
 			}
 		}
 
+		/*	A dictionary describing each installed policy. Policies are not removed
+		 *	(or added) until all of the agent changes have been processed. A policy
+		 *	for an agent that is destroyed and then re-spawned with the same policy
+		 *	(order, condition, and result) is retained.
+		 *		Key	:	<policy session>/<policy ID>
+		 *		Value	:	policy signature (see policySignature)
+		 */
+
+		if (self.policySignatures == nil) {
+			self.policySignatures = [NSMutableDictionary dictionary];
+			if (self.policySignatures == nil) {
+				errorMessage = "Failed to create a dictionary";
+				break;
+			}
+		}
+
+		/*	A dictionary of the policies to be removed
+		 *		Key	:	policy signature
+		 *		Value	:	An array of [<policy session>, <policy ID>]
+		 */
+
+		if (self.pendingPolicyRemovals == nil) {
+			self.pendingPolicyRemovals = [NSMutableDictionary dictionary];
+			if (self.pendingPolicyRemovals == nil) {
+				errorMessage = "Failed to create a dictionary";
+				break;
+			}
+		}
+
+		/*	The policy sessions with changes to be applied */
+
+		if (self.pendingPolicySessions == nil) {
+			self.pendingPolicySessions = [NSMutableSet set];
+			if (self.pendingPolicySessions == nil) {
+				errorMessage = "Failed to create a set";
+				break;
+			}
+		}
+
 		/*	The queue to run the all processing on */
 
 		if (self.controllerQueue == nil) {
@@ -185,6 +231,9 @@ typedef struct resolverList {
 		(self.floatingProxyAgentList != nil) &&
 		(self.floatingDNSAgentList != nil) &&
 		(self.policyDB != nil) &&
+		(self.policySignatures != nil) &&
+		(self.pendingPolicyRemovals != nil) &&
+		(self.pendingPolicySessions != nil) &&
 		(self.controllerQueue != nil));
 }
 
@@ -217,16 +266,22 @@ typedef struct resolverList {
 	return data;
 }
 
-- (NSData *)getProxyDataFromCurrentConfig:(CFDictionaryRef)proxies
-				   domain:(NSString *)domain
+/*
+ *	Index the supplemental proxy configurations by match domain
+ *		Key	:	match domain
+ *		Value	:	the (first) supplemental proxy dictionary for the domain
+ */
+
+- (NSDictionary *)getProxyConfigIndex:(CFDictionaryRef)proxies
 {
-	CFIndex		count;
-	CFIndex		idx;
-	CFArrayRef	supplemental;
+	CFIndex			count;
+	CFIndex			idx;
+	NSMutableDictionary	*	index;
+	CFArrayRef		supplemental;
 
-	if (proxies == NULL || domain == nil) {
-		SC_log(LOG_NOTICE, "Invalid proxies/domain");
-		return nil;
+	index = [NSMutableDictionary dictionary];
+	if (proxies == NULL) {
+		return index;
 	}
 
 	supplemental = CFDictionaryGetValue(proxies, kSCPropNetProxiesSupplemental);
@@ -238,12 +293,30 @@ typedef struct resolverList {
 
 		domain_proxy = CFArrayGetValueAtIndex(supplemental, idx);
 		match_domain = CFDictionaryGetValue(domain_proxy, kSCPropNetProxiesSupplementalMatchDomain);
-		if (match_domain != NULL && CFEqual(match_domain, (__bridge CFTypeRef)(domain))) {
-			return [self dataForProxyDictionary:domain_proxy];
+		if (match_domain != NULL && [index objectForKey:(__bridge NSString *)match_domain] == nil) {
+			[index setObject:(__bridge NSDictionary *)domain_proxy forKey:(__bridge NSString *)match_domain];
 		}
 	}
 
-	return nil;
+	return index;
+}
+
+- (NSData *)getProxyDataFromConfigIndex:(NSDictionary *)index
+				 domain:(NSString *)domain
+{
+	NSDictionary	*	domain_proxy;
+
+	if (index == nil || domain == nil) {
+		SC_log(LOG_NOTICE, "Invalid proxies/domain");
+		return nil;
+	}
+
+	domain_proxy = [index objectForKey:domain];
+	if (domain_proxy == nil) {
+		return nil;
+	}
+
+	return [self dataForProxyDictionary:(__bridge CFDictionaryRef)domain_proxy];
 }
 
 - (bool)getIntValue:(CFTypeRef)cf_value
@@ -282,11 +355,14 @@ typedef struct resolverList {
 
 - (void)processSupplementalProxyChanges:(CFDictionaryRef)proxies
 {
+	NSMutableDictionary	*	agent_index;
+	NSDictionary	*	config_index;
 	CFIndex			count;
 	NSMutableArray	*	deleteList;
 	NSCountedSet	*	duplicate_domain_list;
 	CFIndex			idx;
 	NSMutableArray	*	new_domain_list;
+	NSCountedSet	*	new_domain_set;
 	NSMutableArray	*	old_domain_list;
 	CFArrayRef		supplemental;
 	NSMutableArray	*	update_agent_list;
@@ -339,10 +415,13 @@ typedef struct resolverList {
 				    new_list:new_domain_list
 			     agentDictionary:self.floatingProxyAgentList];
 
+	/* The domains (and # of instances) not yet known to the controller */
+	new_domain_set = [[NSCountedSet alloc] initWithArray:new_domain_list];
+
 	for (NSString *key in old_domain_list) {
 		BOOL domain_present;
 
-		domain_present = [new_domain_list containsObject:key];
+		domain_present = ([new_domain_set countForObject:key] > 0);
 		if (domain_present == NO) {
 			id agent;
 
@@ -351,6 +430,8 @@ typedef struct resolverList {
 		}
 	}
 
+	config_index = [self getProxyConfigIndex:proxies];
+
 	/*	At this point, whatever is in the controller's floating agent list,
 	 *	is present in the current proxy config. The current proxy config
 	 *	might have even more configs, not known to the controller, YET
@@ -374,7 +455,7 @@ typedef struct resolverList {
 			 */
 			NSData	*	mapped_agent_data;
 
-			mapped_agent_data = [self getProxyDataFromCurrentConfig:proxies domain:[mapped_agent getAssociatedEntity]];
+			mapped_agent_data = [self getProxyDataFromConfigIndex:config_index domain:[mapped_agent getAssociatedEntity]];
 			if (mapped_agent_data == nil || ![[agent getAgentData] isEqual:mapped_agent_data]) {
 				/* Something changed for mapped agent */
 				[deleteList addObject:agent];
@@ -390,7 +471,7 @@ typedef struct resolverList {
 			 */
 			NSData	*	agent_data;
 
-			agent_data = [self getProxyDataFromCurrentConfig:proxies domain:[agent getAssociatedEntity]];
+			agent_data = [self getProxyDataFromConfigIndex:config_index domain:[agent getAssociatedEntity]];
 			if (![[agent getAgentData] isEqual:agent_data]) {
 				/* Something changed for agent */
 				[agent updateAgentData:agent_data];
@@ -402,7 +483,7 @@ typedef struct resolverList {
 				[update_agent_list addObject:agent];
 			}
 		}
-		[new_domain_list removeObject:domain];
+		[self removeAllInstancesOf:domain fromSet:new_domain_set];
 	}
 
 	for (id agent in deleteList) {
@@ -414,6 +495,8 @@ typedef struct resolverList {
 		[self publishToAgent:agent];
 	}
 
+	agent_index = [self getAgentDataIndex:self.floatingProxyAgentList subType:kAgentSubTypeSupplemental];
+
 	for (idx = 0; idx < count; idx++) {
 		CFDictionaryRef		domain_proxy;
 		CFStringRef		match_domain;
@@ -423,11 +506,9 @@ typedef struct resolverList {
 
 		if (match_domain != NULL) {
 			NSData		*	data;
-			NSUInteger		found;
 			id			mapped_agent;
 
-			found = [new_domain_list indexOfObject:(__bridge id _Nonnull)(match_domain)];
-			if (found == NSNotFound) {
+			if ([new_domain_set countForObject:(__bridge id _Nonnull)(match_domain)] == 0) {
 				continue;
 			}
 
@@ -452,10 +533,11 @@ typedef struct resolverList {
 				if (ok) {
 					id agent = [self.floatingProxyAgentList objectForKey:ns_domain_name_copy];
 					SC_log(LOG_INFO, "Duplicate Proxy agent %@", [agent getAgentName]);;
+					[self addAgent:agent toDataIndex:agent_index];
 				}
 			} else {
 				data = [self dataForProxyDictionary:domain_proxy];
-				mapped_agent = [self getAgentWithSameDataAndSubType:self.floatingProxyAgentList
+				mapped_agent = [self getAgentWithSameDataAndSubType:agent_index
 									       data:data
 									    subType:kAgentSubTypeSupplemental];
 				if (mapped_agent != nil) {
@@ -465,15 +547,19 @@ typedef struct resolverList {
 							addPolicyOfType:NEPolicyConditionTypeDomain
 							updateData:data];
 				} else {
-					[self spawnFloatingAgent:[ProxyAgent class]
+					BOOL ok = [self spawnFloatingAgent:[ProxyAgent class]
 							entity:(__bridge NSString *)(match_domain)
 							agentSubType:kAgentSubTypeSupplemental
 							addPolicyOfType:NEPolicyConditionTypeDomain
 							publishData:data];
+					if (ok) {
+						id agent = [self.floatingProxyAgentList objectForKey:(__bridge NSString *)(match_domain)];
+						[self addAgent:agent toDataIndex:agent_index];
+					}
 				}
 			}
 
-			[new_domain_list removeObjectAtIndex:found];
+			[new_domain_set removeObject:(__bridge id _Nonnull)(match_domain)];
 			[duplicate_domain_list addObject:(__bridge id _Nonnull)(match_domain)];
 		}
 	}
@@ -727,6 +813,7 @@ typedef struct resolverList {
 			[self destroyFloatingAgent:agent];
 		}
 
+		[self applyPolicyChanges:"proxy"];
 		return;
 	}
 
@@ -734,6 +821,7 @@ typedef struct resolverList {
 	[self processScopedProxyChanges:proxies];
 	[self processSupplementalProxyChanges:proxies];
 	[self processServiceSpecificProxyChanges:proxies];
+	[self applyPolicyChanges:"proxy"];
 
 	CFRelease(proxies);
 }
@@ -907,12 +995,19 @@ typedef struct resolverList {
 	return (NSData *)data;
 }
 
-- (NSData *)getDNSDataFromCurrentConfig:(dns_config_t *)dns_config
-				 domain:(NSString *)domain
+/*
+ *	Index the (non-multicast) resolvers by domain
+ *		Key	:	domain
+ *		Value	:	the (first) resolver for the domain
+ */
+
+- (NSDictionary *)getDNSConfigIndex:(dns_config_t *)dns_config
 {
-	if (dns_config == NULL || domain == nil) {
-		SC_log(LOG_NOTICE, "Invalid dns_config/domain");
-		return nil;
+	NSMutableDictionary	*	index;
+
+	index = [NSMutableDictionary dictionary];
+	if (dns_config == NULL) {
+		return index;
 	}
 
 	if ((dns_config->n_resolver > 0) && (dns_config->resolver != NULL)) {
@@ -925,16 +1020,32 @@ typedef struct resolverList {
 				NSString	*	ns_domain_name;
 
 				ns_domain_name = @(resolver->domain);
-				if ([ns_domain_name isEqualToString:domain]) {
-					return [self dataForResolver:resolver];
-				} else {
-					continue;
+				if ([index objectForKey:ns_domain_name] == nil) {
+					[index setObject:[NSValue valueWithPointer:resolver] forKey:ns_domain_name];
 				}
 			}
 		}
 	}
 
-	return nil;
+	return index;
+}
+
+- (NSData *)getDNSDataFromConfigIndex:(NSDictionary *)index
+			       domain:(NSString *)domain
+{
+	NSValue	*	resolver;
+
+	if (index == nil || domain == nil) {
+		SC_log(LOG_NOTICE, "Invalid dns_config/domain");
+		return nil;
+	}
+
+	resolver = [index objectForKey:domain];
+	if (resolver == nil) {
+		return nil;
+	}
+
+	return [self dataForResolver:(dns_resolver_t *)[resolver pointerValue]];
 }
 
 - (BOOL)isResolverMulticast:(dns_resolver_t *)resolver
@@ -965,8 +1076,11 @@ typedef struct resolverList {
 
 - (void)processSupplementalDNSResolvers:(dns_config_t *)dns_config
 {
+	NSMutableDictionary	*	agent_index;
+	NSDictionary	*	config_index;
 	NSMutableArray	*	deleteList;
 	NSMutableArray	*	new_domain_list;
+	NSCountedSet	*	new_domain_set;
 	NSCountedSet	*	duplicate_domain_list;
 	NSMutableArray	*	old_domain_list;
 	NSMutableArray	*	update_agent_list;
@@ -1003,11 +1117,14 @@ typedef struct resolverList {
 				    new_list:new_domain_list
 			     agentDictionary:self.floatingDNSAgentList];
 
+	/* The domains (and # of instances) not yet known to the controller */
+	new_domain_set = [[NSCountedSet alloc] initWithArray:new_domain_list];
+
 	/* Sync between controller and current config */
 	for (NSString *key in old_domain_list) {
 		BOOL domain_present = NO;
 
-		domain_present = [new_domain_list containsObject:key];
+		domain_present = ([new_domain_set countForObject:key] > 0);
 		if (domain_present == NO) {
 			id agent;
 
@@ -1016,6 +1133,8 @@ typedef struct resolverList {
 		}
 	}
 
+	config_index = [self getDNSConfigIndex:dns_config];
+
 	/*	At this point, whatever is in the controller's floating agent list,
 		is present in the current DNS config. The current DNS config
 		might have even more configs, not known to the controller, YET
@@ -1039,7 +1158,7 @@ typedef struct resolverList {
 			 */
 			NSData *mapped_agent_data;
 
-			mapped_agent_data = [self getDNSDataFromCurrentConfig:dns_config domain:[mapped_agent getAssociatedEntity]];
+			mapped_agent_data = [self getDNSDataFromConfigIndex:config_index domain:[mapped_agent getAssociatedEntity]];
 			if (mapped_agent_data == nil || ![[agent getAgentData] isEqual:mapped_agent_data]) {
 				/* Something changed for mapped agent */
 				[deleteList addObject:agent];
@@ -1055,7 +1174,7 @@ typedef struct resolverList {
 			 */
 			NSData *agent_data;
 
-			agent_data = [self getDNSDataFromCurrentConfig:dns_config domain:[agent getAssociatedEntity]];
+			agent_data = [self getDNSDataFromConfigIndex:config_index domain:[agent getAssociatedEntity]];
 			if (![[agent getAgentData] isEqual:agent_data]) {
 				/* Something changed for agent */
 				[agent updateAgentData:agent_data];
@@ -1068,7 +1187,7 @@ typedef struct resolverList {
 
 			}
 		}
-		[new_domain_list removeObject:domain];
+		[self removeAllInstancesOf:domain fromSet:new_domain_set];
 	}
 
 	for (id agent in deleteList) {
@@ -1080,6 +1199,8 @@ typedef struct resolverList {
 		[self publishToAgent:agent];
 	}
 
+	agent_index = [self getAgentDataIndex:self.floatingDNSAgentList subType:kAgentSubTypeSupplemental];
+
 	for (int idx = 0; idx < dns_config->n_resolver; idx++) {
 		dns_resolver_t	*	resolver;
 
@@ -1088,13 +1209,11 @@ typedef struct resolverList {
 		    ![self isResolverPrivate:resolver] &&
 		    ![self isResolverMulticast:resolver]) {
 			NSData		*	data;
-			NSUInteger		found;
 			id			mapped_agent;
 			NSString	*	ns_domain_name;
 
 			ns_domain_name = @(resolver->domain);
-			found = [new_domain_list indexOfObject:ns_domain_name];
-			if (found == NSNotFound) {
+			if ([new_domain_set countForObject:ns_domain_name] == 0) {
 				/* Nothing changed for this agent */
 				continue;
 			}
@@ -1119,10 +1238,11 @@ typedef struct resolverList {
 				 if (ok) {
 					 id agent = [self.floatingDNSAgentList objectForKey:ns_domain_name_copy];
 					 SC_log(LOG_INFO, "Duplicate DNS agent %@", [agent getAgentName]);;
+					 [self addAgent:agent toDataIndex:agent_index];
 				 }
 			 } else {
 				data = [self dataForResolver:resolver];
-				mapped_agent = [self getAgentWithSameDataAndSubType:self.floatingDNSAgentList
+				mapped_agent = [self getAgentWithSameDataAndSubType:agent_index
 										   data:data
 										subType:kAgentSubTypeSupplemental];
 				if (mapped_agent != nil) {
@@ -1132,15 +1252,19 @@ typedef struct resolverList {
 							addPolicyOfType:NEPolicyConditionTypeDomain
 							updateData:data];
 				} else {
-					[self spawnFloatingAgent:[DNSAgent class]
+					BOOL ok = [self spawnFloatingAgent:[DNSAgent class]
 							entity:ns_domain_name
 							agentSubType:kAgentSubTypeSupplemental
 							addPolicyOfType:NEPolicyConditionTypeDomain
 							publishData:data];
+					if (ok) {
+						id agent = [self.floatingDNSAgentList objectForKey:ns_domain_name];
+						[self addAgent:agent toDataIndex:agent_index];
+					}
 				}
 			 }
 
-			[new_domain_list removeObjectAtIndex:found];
+			[new_domain_set removeObject:ns_domain_name];
 			[duplicate_domain_list addObject:ns_domain_name];
 		}
 	}
@@ -1490,6 +1614,7 @@ remove_policy:
 done:
 
 	[self processOnionResolver:dns_config];
+	[self applyPolicyChanges:"DNS"];
 	if (dns_config != NULL) {
 		dns_configuration_free(dns_config);
 	}
@@ -1708,37 +1833,240 @@ done:
 	}
 }
 
+/*
+ *	Remove a domain (and all of its instances) from a set
+ */
+
+- (void)removeAllInstancesOf:(NSString *)domain
+		     fromSet:(NSCountedSet *)set
+{
+	for (NSUInteger n = [set countForObject:domain]; n > 0; n--) {
+		[set removeObject:domain];
+	}
+}
+
 /*
  *	In order to not duplicate agents with same content,
  *	we map an agent X to agent Y, when their content is the same.
  *
- *	This function tries to find that agent Y
+ *	To find that agent Y, we maintain an index of the registered
+ *	agents (of a sub-type) keyed by a digest of the sub-type and
+ *	the agent data.
+ *		Key	:	SHA-256(<sub-type> + <agent data>)
+ *		Value	:	agent object
  */
 
-- (id)getAgentWithSameDataAndSubType:(NSMutableDictionary *)agentList
-				data:(NSData *)data
-			     subType:(AgentSubType)subtype
+- (NSData *)getAgentDataIndexKey:(NSData *)data
+			 subType:(AgentSubType)subtype
+{
+	CC_SHA256_CTX		ctx;
+	unsigned char		digest[CC_SHA256_DIGEST_LENGTH];
+
+	CC_SHA256_Init(&ctx);
+	CC_SHA256_Update(&ctx, &subtype, sizeof(subtype));
+	CC_SHA256_Update(&ctx, [data bytes], (CC_LONG)[data length]);
+	CC_SHA256_Final(digest, &ctx);
+
+	return [NSData dataWithBytes:digest length:sizeof(digest)];
+}
+
+- (void)addAgent:(id)agent
+     toDataIndex:(NSMutableDictionary *)agentIndex
+{
+	NSData	*	data;
+	NSData	*	key;
+
+	data = [agent getAgentData];
+	if (data == nil) {
+		return;
+	}
+
+	/* Index only registered agents */
+	if ([agent getRegistrationObject] == nil) {
+		return;
+	}
+
+	key = [self getAgentDataIndexKey:data subType:[agent getAgentSubType]];
+	if ([agentIndex objectForKey:key] == nil) {
+		[agentIndex setObject:agent forKey:key];
+	}
+}
+
+- (NSMutableDictionary *)getAgentDataIndex:(NSMutableDictionary *)agentList
+				   subType:(AgentSubType)subtype
 {
+	NSMutableDictionary *agentIndex = [NSMutableDictionary dictionary];
+
 	for (NSString *key in agentList) {
 		id agent = [agentList objectForKey:key];
-		if ([[agent getAgentData] isEqual:data]) {
-			/* Do not map to default agents */
-			if ([agent getAgentSubType] != subtype) {
-				continue;
-			}
 
-			/* Return only registered agents */
-			if ([agent getRegistrationObject] != nil) {
-				return agent;
-			}
+		/* Do not map to default agents */
+		if ([agent getAgentSubType] != subtype) {
+			continue;
 		}
+
+		[self addAgent:agent toDataIndex:agentIndex];
 	}
 
-	return nil;
+	return agentIndex;
+}
+
+- (id)getAgentWithSameDataAndSubType:(NSMutableDictionary *)agentIndex
+				data:(NSData *)data
+			     subType:(AgentSubType)subtype
+{
+	id	agent;
+
+	if (data == nil) {
+		return nil;
+	}
+
+	agent = [agentIndex objectForKey:[self getAgentDataIndexKey:data subType:subtype]];
+	if ((agent != nil) && ![[agent getAgentData] isEqual:data]) {
+		/* if the agent data changed since it was indexed */
+		agent = nil;
+	}
+
+	return agent;
 }
 
 #pragma mark Policy installation function
 
+/*
+ *	Policy changes are batched. Policies for destroyed agents are queued
+ *	for removal and all of the changes are applied (with one commit per
+ *	policy session) after the DNS or proxy configuration has been processed.
+ *	If, in the meantime, an identical policy is needed for a new agent then
+ *	the queued policy is retained instead of being removed and re-added.
+ */
+
+- (NSString *)policyKey:(NEPolicySession *)session
+	       policyID:(NSUInteger)policyID
+{
+	return [NSString stringWithFormat:@"%p/%lu", session, (unsigned long)policyID];
+}
+
+- (NSString *)policySignature:(NEPolicySession *)session
+			order:(uint32_t)order
+		   policyType:(NEPolicyConditionType)policyType
+		       entity:(NSString *)entity
+		       result:(NSString *)result
+{
+	return [NSString stringWithFormat:@"%p/%u/%ld/%@/%@", session, order, (long)policyType, entity, result];
+}
+
+- (NSUInteger)addPolicy:(NEPolicy *)policy
+	      toSession:(NEPolicySession *)session
+	      signature:(NSString *)signature
+{
+	NSMutableArray	*	pending;
+	NSUInteger		policyID;
+
+	pending = [self.pendingPolicyRemovals objectForKey:signature];
+	if ([pending count] > 0) {
+		/* An identical policy is queued for removal, keep it */
+		policyID = [[[pending lastObject] objectAtIndex:1] unsignedIntegerValue];
+		[pending removeLastObject];
+		if ([pending count] == 0) {
+			[self.pendingPolicyRemovals removeObjectForKey:signature];
+		}
+		self.policiesRetained++;
+		return policyID;
+	}
+
+	policyID = [session addPolicy:policy];
+	if (policyID != 0) {
+		[self.policySignatures setObject:signature forKey:[self policyKey:session policyID:policyID]];
+		[self.pendingPolicySessions addObject:session];
+		self.policiesAdded++;
+	}
+
+	return policyID;
+}
+
+- (void)removePolicyWithID:(NSUInteger)policyID
+	       fromSession:(NEPolicySession *)session
+{
+	NSMutableArray	*	pending;
+	NSString	*	signature;
+
+	signature = [self.policySignatures objectForKey:[self policyKey:session policyID:policyID]];
+	if (signature == nil) {
+		if (![session removePolicyWithID:policyID]) {
+			SC_log(LOG_NOTICE, "Could not remove policy %@", [session policyWithID:policyID]);
+		}
+		[self.pendingPolicySessions addObject:session];
+		self.policiesRemoved++;
+		return;
+	}
+
+	pending = [self.pendingPolicyRemovals objectForKey:signature];
+	if (pending == nil) {
+		pending = [NSMutableArray array];
+		[self.pendingPolicyRemovals setObject:pending forKey:signature];
+	}
+	[pending addObject:@[session, numberToNSNumber(policyID)]];
+}
+
+- (void)forgetPoliciesForSession:(NEPolicySession *)session
+{
+	NSString	*	prefix;
+
+	prefix = [NSString stringWithFormat:@"%p/", session];
+
+	for (NSString *key in [self.policySignatures allKeys]) {
+		if ([key hasPrefix:prefix]) {
+			[self.policySignatures removeObjectForKey:key];
+		}
+	}
+
+	for (NSString *signature in [self.pendingPolicyRemovals allKeys]) {
+		if ([signature hasPrefix:prefix]) {
+			[self.pendingPolicyRemovals removeObjectForKey:signature];
+		}
+	}
+
+	[self.pendingPolicySessions removeObject:session];
+}
+
+- (void)applyPolicyChanges:(const char *)reason
+{
+	for (NSString *signature in self.pendingPolicyRemovals) {
+		NSArray *pending = [self.pendingPolicyRemovals objectForKey:signature];
+
+		for (NSArray *policy in pending) {
+			NEPolicySession *	session		= [policy objectAtIndex:0];
+			NSUInteger		policyID	= [[policy objectAtIndex:1] unsignedIntegerValue];
+
+			if (![session removePolicyWithID:policyID]) {
+				SC_log(LOG_NOTICE, "Could not remove policy %@", [session policyWithID:policyID]);
+			}
+			[self.policySignatures removeObjectForKey:[self policyKey:session policyID:policyID]];
+			[self.pendingPolicySessions addObject:session];
+			self.policiesRemoved++;
+		}
+	}
+	[self.pendingPolicyRemovals removeAllObjects];
+
+	for (NEPolicySession *session in self.pendingPolicySessions) {
+		if (![session apply]) {
+			SC_log(LOG_NOTICE, "Could not apply %s policy changes", reason);
+		}
+	}
+	[self.pendingPolicySessions removeAllObjects];
+
+	if ((self.policiesAdded > 0) || (self.policiesRemoved > 0)) {
+		SC_log(LOG_INFO, "%s policy changes: %lu added, %lu removed, %lu retained",
+		       reason,
+		       (unsigned long)self.policiesAdded,
+		       (unsigned long)self.policiesRemoved,
+		       (unsigned long)self.policiesRetained);
+	}
+	self.policiesAdded = 0;
+	self.policiesRemoved = 0;
+	self.policiesRetained = 0;
+}
+
 /*
  *	Add NECP policies for an agent
  */
@@ -1759,6 +2087,7 @@ done:
 	NSUInteger			policyID1;
 	NSUInteger			policyID2;
 	NEPolicyResult		*	result;
+	NSString		*	signature;
 	uint32_t			skipOrder;
 	AgentType			type;
 	uint32_t			typeOffset;
@@ -1827,7 +2156,12 @@ done:
 
 	session = ((ConfigAgent *)agent).preferredPolicySession;
 
-	policyID1 = [session addPolicy:newPolicy];
+	signature = [self policySignature:session
+				    order:order
+			       policyType:policyType
+				   entity:domain
+				   result:[NSString stringWithFormat:@"agent %@", [uuid UUIDString]]];
+	policyID1 = [self addPolicy:newPolicy toSession:session signature:signature];
 	if (policyID1 == 0) {
 		SC_log(LOG_NOTICE, "Could not add a netagent policy for agent %@", [agent getAgentName]);
 		return NO;
@@ -1843,17 +2177,19 @@ done:
 		return NO;
 	}
 
-	policyID2 = [session addPolicy:newPolicy];
+	signature = [self policySignature:session
+				    order:orderForSkip
+			       policyType:policyType
+				   entity:domain
+				   result:[NSString stringWithFormat:@"skip %u", skipOrder]];
+	policyID2 = [self addPolicy:newPolicy toSession:session signature:signature];
 	if (policyID2 == 0) {
 		SC_log(LOG_NOTICE, "Could not add a skip policy for agent %@", [agent getAgentName]);
 		return NO;
 	}
 
-	ok = [session apply];
-	if (!ok) {
-		SC_log(LOG_NOTICE, "Could not apply policy for agent %@", [agent getAgentName]);
-		return NO;
-	}
+	/* Note: the policy changes will be applied once all agents have been processed */
+	ok = YES;
 
 	policyArray = [self.policyDB objectForKey:[agent getAgentName]];
 	if (policyArray == nil) {
@@ -2036,21 +2372,10 @@ done:
 		policyArray = [self.policyDB objectForKey:[agent getAgentName]];
 		if (policyArray != nil) {
 			NEPolicySession *	session = ((ConfigAgent *)agent).preferredPolicySession;
-			BOOL 			result = NO;
 
+			/* Note: the policies will be removed once all agents have been processed */
 			for (NSNumber *policyID in policyArray) {
-				NSUInteger idVal;
-
-				idVal = [policyID unsignedIntegerValue];
-				result = [session removePolicyWithID:idVal];
-				if (result == NO) {
-					SC_log(LOG_NOTICE, "Could not remove policy %@ for agent %@", [session policyWithID:idVal], [agent getAgentName]);
-				}
-			}
-
-			result = [session apply];
-			if (result == NO) {
-				SC_log(LOG_NOTICE, "Could not apply removed policies for agent %@", [agent getAgentName]);
+				[self removePolicyWithID:[policyID unsignedIntegerValue] fromSession:session];
 			}
 
 			[self.policyDB removeObjectForKey:[agent getAgentName]];
@@ -2087,6 +2412,7 @@ done:
 					SC_log(LOG_ERR, "Could not apply policy change for agent %@", [agent getAgentName]);
 				}
 
+				[self forgetPoliciesForSession:self.controlPolicySession];
 				self.controlPolicySession = nil;
 				SC_log(LOG_NOTICE, "Closed control policy session");
 			}
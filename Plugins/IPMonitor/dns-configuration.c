@@ -615,48 +615,56 @@ add_private_resolvers(CFMutableArrayRef resolvers, CFArrayRef privateResolvers)
 }
 
 
-static CFComparisonResult
-compareBySearchOrder(const void *val1, const void *val2, void *context)
+typedef struct {
+	CFDictionaryRef	dns;
+	uint32_t	searchOrder;
+	Boolean		hasConfigOrder;
+	uint32_t	configOrder;
+} searchOrderKey, *searchOrderKeyRef;
+
+
+static void
+searchOrderKeyInit(searchOrderKeyRef key, CFDictionaryRef dns)
 {
-#pragma unused(context)
-	CFDictionaryRef	dns1	= (CFDictionaryRef)val1;
-	CFDictionaryRef	dns2	= (CFDictionaryRef)val2;
-	CFNumberRef	num1;
-	CFNumberRef	num2;
-	uint32_t	order1	= DEFAULT_SEARCH_ORDER;
-	uint32_t	order2	= DEFAULT_SEARCH_ORDER;
+	CFNumberRef	num;
 
-	num1 = CFDictionaryGetValue(dns1, kSCPropNetDNSSearchOrder);
-	if (!isA_CFNumber(num1) ||
-	    !CFNumberGetValue(num1, kCFNumberSInt32Type, &order1)) {
-		order1 = DEFAULT_SEARCH_ORDER;
-	}
+	key->dns = dns;
 
-	num2 = CFDictionaryGetValue(dns2, kSCPropNetDNSSearchOrder);
-	if (!isA_CFNumber(num2) ||
-	    !CFNumberGetValue(num2, kCFNumberSInt32Type, &order2)) {
-		order2 = DEFAULT_SEARCH_ORDER;
+	num = CFDictionaryGetValue(dns, kSCPropNetDNSSearchOrder);
+	if (!isA_CFNumber(num) ||
+	    !CFNumberGetValue(num, kCFNumberSInt32Type, &key->searchOrder)) {
+		key->searchOrder = DEFAULT_SEARCH_ORDER;
 	}
 
-	if (order1 == order2) {
+	key->hasConfigOrder = (CFDictionaryGetValueIfPresent(dns, DNS_CONFIGURATION_ORDER_KEY, (const void **)&num) &&
+			       isA_CFNumber(num) &&
+			       CFNumberGetValue(num, kCFNumberSInt32Type, &key->configOrder));
+
+	return;
+}
+
+
+static CFComparisonResult
+compareBySearchOrder(const void *val1, const void *val2, void *context)
+{
+#pragma unused(context)
+	searchOrderKeyRef	key1	= (searchOrderKeyRef)val1;
+	searchOrderKeyRef	key2	= (searchOrderKeyRef)val2;
+
+	if (key1->searchOrder == key2->searchOrder) {
 		// if same "SearchOrder", retain original orderring for configurations
-		if (CFDictionaryGetValueIfPresent(dns1, DNS_CONFIGURATION_ORDER_KEY, (const void **)&num1) &&
-		    CFDictionaryGetValueIfPresent(dns2, DNS_CONFIGURATION_ORDER_KEY, (const void **)&num2) &&
-		    isA_CFNumber(num1) &&
-		    isA_CFNumber(num2) &&
-		    CFNumberGetValue(num1, kCFNumberSInt32Type, &order1) &&
-		    CFNumberGetValue(num2, kCFNumberSInt32Type, &order2)) {
-			if (order1 == order2) {
+		if (key1->hasConfigOrder && key2->hasConfigOrder) {
+			if (key1->configOrder == key2->configOrder) {
 				return kCFCompareEqualTo;
 			} else {
-				return (order1 < order2) ? kCFCompareLessThan : kCFCompareGreaterThan;
+				return (key1->configOrder < key2->configOrder) ? kCFCompareLessThan : kCFCompareGreaterThan;
 			}
 		}
 
 		return kCFCompareEqualTo;
 	}
 
-	return (order1 < order2) ? kCFCompareLessThan : kCFCompareGreaterThan;
+	return (key1->searchOrder < key2->searchOrder) ? kCFCompareLessThan : kCFCompareGreaterThan;
 }
 
 
@@ -668,7 +676,9 @@ extract_search_domains(CFMutableDictionaryRef defaultDomain, CFArrayRef suppleme
 	CFArrayRef		defaultSearchDomains	= NULL;
 	CFIndex			defaultSearchIndex	= 0;
 	CFMutableArrayRef	mySearchDomains;
+	CFMutableSetRef		mySearchDomainsSet;
 	CFMutableArrayRef	mySupplemental		= NULL;
+	searchOrderKey		*mySupplementalKeys	= NULL;
 	CFIndex			n_supplemental;
 	CFStringRef		trimmedDomainName;
 
@@ -768,23 +778,42 @@ extract_search_domains(CFMutableDictionaryRef defaultDomain, CFArrayRef suppleme
 	// add any supplemental "domain" names to the search list
 	n_supplemental = (supplemental != NULL) ? CFArrayGetCount(supplemental) : 0;
 	if (n_supplemental > 1) {
-		mySupplemental = CFArrayCreateMutableCopy(NULL, 0, supplemental);
+		// sort by the (precomputed) search order of each configuration
+		mySupplementalKeys = CFAllocatorAllocate(NULL, n_supplemental * sizeof(searchOrderKey), 0);
+		mySupplemental = CFArrayCreateMutable(NULL, n_supplemental, NULL);
+		for (int i = 0; i < n_supplemental; i++) {
+			searchOrderKeyInit(&mySupplementalKeys[i], CFArrayGetValueAtIndex(supplemental, i));
+			CFArrayAppendValue(mySupplemental, &mySupplementalKeys[i]);
+		}
 		CFArraySortValues(mySupplemental,
 				  CFRangeMake(0, n_supplemental),
 				  compareBySearchOrder,
 				  NULL);
-		supplemental = mySupplemental;
 	}
+
+	// track the search domains we already have
+	mySearchDomainsSet = CFSetCreateMutable(NULL, 0, &kCFTypeSetCallBacks);
+	for (int i = 0; i < CFArrayGetCount(mySearchDomains); i++) {
+		CFSetAddValue(mySearchDomainsSet, CFArrayGetValueAtIndex(mySearchDomains, i));
+	}
+
 	for (int i = 0; i < n_supplemental; i++) {
 		CFDictionaryRef dns;
-		CFIndex		domainIndex;
+		Boolean		known;
 		int		noSearch;
 		CFNumberRef	num;
 		CFStringRef	options;
 		CFStringRef	supplementalDomain;
 		uint32_t	supplementalOrder;
 
-		dns = CFArrayGetValueAtIndex(supplemental, i);
+		if (mySupplemental != NULL) {
+			searchOrderKeyRef	key;
+
+			key = (searchOrderKeyRef)CFArrayGetValueAtIndex(mySupplemental, i);
+			dns = key->dns;
+		} else {
+			dns = CFArrayGetValueAtIndex(supplemental, i);
+		}
 
 		options = CFDictionaryGetValue(dns, kSCPropNetDNSOptions);
 		if (isA_CFString(options)) {
@@ -822,19 +851,22 @@ extract_search_domains(CFMutableDictionaryRef defaultDomain, CFArrayRef suppleme
 			continue;
 		}
 
-		domainIndex = CFArrayGetFirstIndexOfValue(mySearchDomains,
-							  CFRangeMake(0, CFArrayGetCount(mySearchDomains)),
-							  supplementalDomain);
-
 		num = CFDictionaryGetValue(dns, kSCPropNetDNSSearchOrder);
 		if (!isA_CFNumber(num) ||
 		    !CFNumberGetValue(num, kCFNumberSInt32Type, &supplementalOrder)) {
 			supplementalOrder = DEFAULT_SEARCH_ORDER;
 		}
 
+		known = CFSetContainsValue(mySearchDomainsSet, supplementalDomain);
+
 		if (supplementalOrder < defaultOrder) {
-			if (domainIndex != kCFNotFound) {
+			if (known) {
+				CFIndex	domainIndex;
+
 				// if supplemental domain is already in the search list
+				domainIndex = CFArrayGetFirstIndexOfValue(mySearchDomains,
+									  CFRangeMake(0, CFArrayGetCount(mySearchDomains)),
+									  supplementalDomain);
 				CFArrayRemoveValueAtIndex(mySearchDomains, domainIndex);
 				if (domainIndex < defaultSearchIndex) {
 					defaultSearchIndex--;
@@ -843,17 +875,21 @@ extract_search_domains(CFMutableDictionaryRef defaultDomain, CFArrayRef suppleme
 			CFArrayInsertValueAtIndex(mySearchDomains,
 						  defaultSearchIndex,
 						  supplementalDomain);
+			CFSetAddValue(mySearchDomainsSet, supplementalDomain);
 			defaultSearchIndex++;
 		} else {
-			if (domainIndex == kCFNotFound) {
+			if (!known) {
 				// add to the (end of the) search list
 				CFArrayAppendValue(mySearchDomains, supplementalDomain);
+				CFSetAddValue(mySearchDomainsSet, supplementalDomain);
 			}
 		}
 
 		CFRelease(supplementalDomain);
 	}
+	CFRelease(mySearchDomainsSet);
 	if (mySupplemental != NULL) CFRelease(mySupplemental);
+	if (mySupplementalKeys != NULL) CFAllocatorDeallocate(NULL, mySupplementalKeys);
 
 	// update the "search" domains
 	if (CFArrayGetCount(mySearchDomains) == 0) {
@@ -190,6 +190,8 @@ __log_IPMonitor(void)
 #define ROUTELIST_DEBUG(flag, fmt, ...)
 
 static struct if_nameindex *	S_if_nameindex_cache;
+static const char * *		S_if_indexnames;	/* [if_index] = if_name */
+static IFIndex			S_if_indexnames_count;
 
 static dispatch_queue_t
 __my_if_nametoindex_queue()
@@ -241,6 +243,14 @@ my_if_indextoname(IFIndex idx, char if_name[IFNAMSIZ])
 	    name = if_indextoname(idx, if_name);
 	    return;
 	}
+	if (S_if_indexnames != NULL) {
+	    /* direct lookup */
+	    if (idx < S_if_indexnames_count && S_if_indexnames[idx] != NULL) {
+		name = if_name;
+		strlcpy(if_name, S_if_indexnames[idx], IFNAMSIZ);
+	    }
+	    return;
+	}
 	for (scan = S_if_nameindex_cache;
 	     scan->if_index != 0 && scan->if_name != NULL;
 	     scan++) {
@@ -259,6 +269,11 @@ static void
 my_if_freenameindex(void)
 {
     dispatch_sync(__my_if_nametoindex_queue(), ^{
+	if (S_if_indexnames != NULL) {
+	    free(S_if_indexnames);
+	    S_if_indexnames = NULL;
+	    S_if_indexnames_count = 0;
+	}
 	if (S_if_nameindex_cache != NULL) {
 	    if_freenameindex(S_if_nameindex_cache);
 	    S_if_nameindex_cache = NULL;
@@ -273,7 +288,36 @@ my_if_nameindex(void)
 {
     my_if_freenameindex();
     dispatch_sync(__my_if_nametoindex_queue(), ^{
+	IFIndex			max_index = 0;
+	struct if_nameindex *	scan;
+
 	S_if_nameindex_cache = if_nameindex();
+	if (S_if_nameindex_cache == NULL) {
+	    return;
+	}
+
+	/* index the names so that index -> name lookups are direct */
+	for (scan = S_if_nameindex_cache;
+	     scan->if_index != 0 && scan->if_name != NULL;
+	     scan++) {
+	    if (scan->if_index > max_index) {
+		max_index = scan->if_index;
+	    }
+	}
+	S_if_indexnames = (const char * *)calloc(max_index + 1,
+						 sizeof(*S_if_indexnames));
+	if (S_if_indexnames == NULL) {
+	    return;
+	}
+	S_if_indexnames_count = max_index + 1;
+	for (scan = S_if_nameindex_cache;
+	     scan->if_index != 0 && scan->if_name != NULL;
+	     scan++) {
+	    if (S_if_indexnames[scan->if_index] == NULL) {
+		/* keep the first match, like the scan */
+		S_if_indexnames[scan->if_index] = scan->if_name;
+	    }
+	}
     });
 
     return;
@@ -604,6 +648,9 @@ static CFMutableDictionaryRef	S_service_state_dict = NULL;
 static CFMutableDictionaryRef	S_ipv4_service_rank_dict = NULL;
 static CFMutableDictionaryRef	S_ipv6_service_rank_dict = NULL;
 
+/* local copy of the store keys that IPMonitor watches: key is the store key */
+static CFMutableDictionaryRef	S_services_info_mirror = NULL;
+
 /* dictionary to hold per-interface rank information */
 static CFDictionaryRef		S_if_rank_dict;
 
@@ -646,6 +693,8 @@ static Boolean			S_dnsinfo_synced = TRUE;
 // Note: access should be gated with __network_change_queue()
 static CFMutableSetRef		S_nat64_prefix_changes = NULL;
 static CFMutableSetRef		S_nat64_prefix_requests = NULL;
+static CFMutableDictionaryRef	S_nat64_prefix_signatures = NULL;
+static CFMutableDictionaryRef	S_nat64_prefix_dns_servers = NULL;
 #endif	/* !TARGET_OS_SIMULATOR */
 
 static nwi_state_t		S_nwi_state = NULL;
@@ -945,6 +994,70 @@ S_is_network_boot()
 
 static int	rtm_seq = 0;
 
+/*
+ * Routing socket message building
+ *
+ * Only the header and the sockaddrs actually added to a message are
+ * written (and zero-filled), the rest of the message buffer is not touched.
+ */
+static __inline__ void
+rtmsg_init(struct rt_msghdr * hdr, int cmd)
+{
+    memset(hdr, 0, sizeof(*hdr));
+    hdr->rtm_type = cmd;
+    hdr->rtm_version = RTM_VERSION;
+    hdr->rtm_seq = ++rtm_seq;
+    hdr->rtm_flags = RTF_UP | RTF_STATIC;
+    return;
+}
+
+static __inline__ void *
+rtmsg_add_link(void * ptr, IFIndex ifindex)
+{
+    struct sockaddr_dl *	dl_p = (struct sockaddr_dl *)ptr;
+
+    memset(dl_p, 0, sizeof(*dl_p));
+    dl_p->sdl_len = sizeof(*dl_p);
+    dl_p->sdl_family = AF_LINK;
+    dl_p->sdl_index = ifindex;
+    return (ptr + sizeof(*dl_p));
+}
+
+static __inline__ void *
+rtmsg_add_in(void * ptr, struct in_addr addr)
+{
+    struct sockaddr_in *	in_p = (struct sockaddr_in *)ptr;
+
+    memset(in_p, 0, sizeof(*in_p));
+    in_p->sin_len = sizeof(*in_p);
+    in_p->sin_family = AF_INET;
+    in_p->sin_addr = addr;
+    return (ptr + sizeof(*in_p));
+}
+
+static __inline__ struct sockaddr_in6 *
+rtmsg_add_in6(void * ptr)
+{
+    struct sockaddr_in6 *	in_p = (struct sockaddr_in6 *)ptr;
+
+    memset(in_p, 0, sizeof(*in_p));
+    in_p->sin6_len = sizeof(*in_p);
+    in_p->sin6_family = AF_INET6;
+    return (in_p);
+}
+
+static __inline__ int
+rtmsg_write(int sockfd, struct rt_msghdr * hdr, void * end)
+{
+    int		ret = 0;
+
+    hdr->rtm_msglen = (u_short)((void *)end - (void *)hdr);
+    if (write(sockfd, hdr, hdr->rtm_msglen) == -1) {
+	ret = errno;
+    }
+    return (ret);
+}
+
 #if	!TARGET_OS_SIMULATOR
 static int
 open_routing_socket(void)
@@ -1074,6 +1187,27 @@ my_CFSetAddValue_async(dispatch_queue_t queue, CFMutableSetRef *set, CFTypeRef v
 
     return;
 }
+
+static void
+my_CFDictionarySetValue_async(dispatch_queue_t queue,
+			      CFMutableDictionaryRef *dict,
+			      CFTypeRef key, CFTypeRef value)
+{
+    CFRetain(key);
+    CFRetain(value);
+    dispatch_async(queue, ^{
+	if (*dict == NULL) {
+	    *dict = CFDictionaryCreateMutable(NULL, 0,
+					      &kCFTypeDictionaryKeyCallBacks,
+					      &kCFTypeDictionaryValueCallBacks);
+	}
+	CFDictionarySetValue(*dict, key, value);
+	CFRelease(key);
+	CFRelease(value);
+    });
+
+    return;
+}
 #endif	/* !TARGET_OS_SIMULATOR */
 
 static boolean_t
@@ -2394,15 +2528,9 @@ typedef struct {
 static int
 IPv4RouteApply(RouteRef r_route, int cmd, int sockfd)
 {
-    size_t			len;
-    int				ret = 0;
+    void *			ptr;
     IPv4RouteRef		route = (IPv4RouteRef)r_route;
     route_msg			rtmsg;
-    union {
-	struct sockaddr_in *	in_p;
-	struct sockaddr_dl *	dl_p;
-	void *			ptr;
-    } rtaddr;
 
     if (S_netboot && route->dest.s_addr == 0) {
 	/* don't touch the default route */
@@ -2424,15 +2552,11 @@ IPv4RouteApply(RouteRef r_route, int cmd, int sockfd)
 	return (EBADF);
 #endif /* TEST_IPV4_ROUTELIST */
     }
-    memset(&rtmsg, 0, sizeof(rtmsg));
-    rtmsg.hdr.rtm_type = cmd;
-    rtmsg.hdr.rtm_version = RTM_VERSION;
-    rtmsg.hdr.rtm_seq = ++rtm_seq;
+    rtmsg_init(&rtmsg.hdr, cmd);
     rtmsg.hdr.rtm_addrs	= RTA_DST | RTA_GATEWAY | RTA_IFP;
     if (route->ifa.s_addr != 0) {
 	rtmsg.hdr.rtm_addrs |= RTA_IFA;
     }
-    rtmsg.hdr.rtm_flags = RTF_UP | RTF_STATIC;
     if ((route->flags & kRouteFlagsIsHost) != 0) {
 	rtmsg.hdr.rtm_flags |= RTF_HOST;
     }
@@ -2450,60 +2574,37 @@ IPv4RouteApply(RouteRef r_route, int cmd, int sockfd)
 	rtmsg.hdr.rtm_flags |= RTF_IFSCOPE;
     }
 
-    rtaddr.ptr = rtmsg.addrs;
+    ptr = rtmsg.addrs;
 
     /* dest */
-    rtaddr.in_p->sin_len = sizeof(*rtaddr.in_p);
-    rtaddr.in_p->sin_family = AF_INET;
-    rtaddr.in_p->sin_addr = route->dest;
-    rtaddr.ptr += sizeof(*rtaddr.in_p);
+    ptr = rtmsg_add_in(ptr, route->dest);
 
     /* gateway */
     if ((rtmsg.hdr.rtm_flags & RTF_GATEWAY) != 0) {
 	/* gateway is an IP address */
-	rtaddr.in_p->sin_len = sizeof(*rtaddr.in_p);
-	rtaddr.in_p->sin_family = AF_INET;
-	rtaddr.in_p->sin_addr = route->gateway;
-	rtaddr.ptr += sizeof(*rtaddr.in_p);
+	ptr = rtmsg_add_in(ptr, route->gateway);
     }
     else {
 	/* gateway is the interface itself */
-	rtaddr.dl_p->sdl_len = sizeof(*rtaddr.dl_p);
-	rtaddr.dl_p->sdl_family = AF_LINK;
-	rtaddr.dl_p->sdl_index = route->ifindex;
-	rtaddr.ptr += sizeof(*rtaddr.dl_p);
+	ptr = rtmsg_add_link(ptr, route->ifindex);
     }
 
     /* mask */
     if ((rtmsg.hdr.rtm_addrs & RTA_NETMASK) != 0) {
-	rtaddr.in_p->sin_len = sizeof(*rtaddr.in_p);
-	rtaddr.in_p->sin_family = AF_INET;
-	rtaddr.in_p->sin_addr = route->mask;
-	rtaddr.ptr += sizeof(*rtaddr.in_p);
+	ptr = rtmsg_add_in(ptr, route->mask);
     }
 
     /* interface */
     if ((rtmsg.hdr.rtm_addrs & RTA_IFP) != 0) {
-	rtaddr.dl_p->sdl_len = sizeof(*rtaddr.dl_p);
-	rtaddr.dl_p->sdl_family = AF_LINK;
-	rtaddr.dl_p->sdl_index = route->ifindex;
-	rtaddr.ptr += sizeof(*rtaddr.dl_p);
+	ptr = rtmsg_add_link(ptr, route->ifindex);
     }
     /* interface address */
     if ((rtmsg.hdr.rtm_addrs & RTA_IFA) != 0) {
-	rtaddr.in_p->sin_len = sizeof(*rtaddr.in_p);
-	rtaddr.in_p->sin_family = AF_INET;
-	rtaddr.in_p->sin_addr = route->ifa;
-	rtaddr.ptr += sizeof(*rtaddr.in_p);
+	ptr = rtmsg_add_in(ptr, route->ifa);
     }
 
     /* apply the route */
-    len = (int)(sizeof(rtmsg.hdr) + (rtaddr.ptr - (void *)rtmsg.addrs));
-    rtmsg.hdr.rtm_msglen = len;
-    if (write(sockfd, &rtmsg, len) == -1) {
-	ret = errno;
-    }
-    return (ret);
+    return (rtmsg_write(sockfd, &rtmsg.hdr, ptr));
 }
 
 static const RouteListInfo IPv4RouteListInfo = {
@@ -3550,15 +3651,10 @@ typedef struct {
 static int
 IPv6RouteApply(RouteRef r_route, int cmd, int sockfd)
 {
-    int				len;
-    int				ret = 0;
+    struct sockaddr_in6 *	in_p;
+    void *			ptr;
     IPv6RouteRef		route = (IPv6RouteRef)r_route;
     v6_route_msg		rtmsg;
-    union {
-	struct sockaddr_in6 *	in_p;
-	struct sockaddr_dl *	dl_p;
-	void *			ptr;
-    } rtaddr;
 
     if ((route->flags & kRouteFlagsKernelManaged) != 0) {
 	/* the kernel manages this route, don't touch it */
@@ -3579,15 +3675,11 @@ IPv6RouteApply(RouteRef r_route, int cmd, int sockfd)
 	return (EBADF);
 #endif /* TEST_IPV6_ROUTELIST */
     }
-    memset(&rtmsg, 0, sizeof(rtmsg));
-    rtmsg.hdr.rtm_type = cmd;
-    rtmsg.hdr.rtm_version = RTM_VERSION;
-    rtmsg.hdr.rtm_seq = ++rtm_seq;
+    rtmsg_init(&rtmsg.hdr, cmd);
     rtmsg.hdr.rtm_addrs	= RTA_DST | RTA_GATEWAY | RTA_IFP;
     if (!IN6_IS_ADDR_UNSPECIFIED(&route->ifa)) {
 	rtmsg.hdr.rtm_addrs |= RTA_IFA;
     }
-    rtmsg.hdr.rtm_flags = RTF_UP | RTF_STATIC;
     if ((route->flags & kRouteFlagsIsHost) != 0) {
 	rtmsg.hdr.rtm_flags |= RTF_HOST;
     }
@@ -3605,62 +3697,47 @@ IPv6RouteApply(RouteRef r_route, int cmd, int sockfd)
 	rtmsg.hdr.rtm_flags |= RTF_IFSCOPE;
     }
 
-    rtaddr.ptr = rtmsg.addrs;
+    ptr = rtmsg.addrs;
 
     /* dest */
-    rtaddr.in_p->sin6_len = sizeof(*rtaddr.in_p);
-    rtaddr.in_p->sin6_family = AF_INET6;
-    rtaddr.in_p->sin6_addr = route->dest;
-    in6_addr_scope_linklocal(&rtaddr.in_p->sin6_addr, route->ifindex);
-    rtaddr.ptr += sizeof(*rtaddr.in_p);
+    in_p = rtmsg_add_in6(ptr);
+    in_p->sin6_addr = route->dest;
+    in6_addr_scope_linklocal(&in_p->sin6_addr, route->ifindex);
+    ptr += sizeof(*in_p);
 
     /* gateway */
     if ((rtmsg.hdr.rtm_flags & RTF_GATEWAY) != 0) {
 	/* gateway is an IP address */
-	rtaddr.in_p->sin6_len = sizeof(*rtaddr.in_p);
-	rtaddr.in_p->sin6_family = AF_INET6;
-	rtaddr.in_p->sin6_addr = route->gateway;
-	in6_addr_scope_linklocal(&rtaddr.in_p->sin6_addr, route->ifindex);
-	rtaddr.ptr += sizeof(*rtaddr.in_p);
+	in_p = rtmsg_add_in6(ptr);
+	in_p->sin6_addr = route->gateway;
+	in6_addr_scope_linklocal(&in_p->sin6_addr, route->ifindex);
+	ptr += sizeof(*in_p);
     }
     else {
 	/* gateway is the interface itself */
-	rtaddr.dl_p->sdl_len = sizeof(*rtaddr.dl_p);
-	rtaddr.dl_p->sdl_family = AF_LINK;
-	rtaddr.dl_p->sdl_index = route->ifindex;
-	rtaddr.ptr += sizeof(*rtaddr.dl_p);
+	ptr = rtmsg_add_link(ptr, route->ifindex);
     }
 
     /* mask */
     if ((rtmsg.hdr.rtm_addrs & RTA_NETMASK) != 0) {
-	rtaddr.in_p->sin6_len = sizeof(*rtaddr.in_p);
-	rtaddr.in_p->sin6_family = AF_INET6;
-	in6_len2mask(&rtaddr.in_p->sin6_addr, route->prefix_length);
-	rtaddr.ptr += sizeof(*rtaddr.in_p);
+	in_p = rtmsg_add_in6(ptr);
+	in6_len2mask(&in_p->sin6_addr, route->prefix_length);
+	ptr += sizeof(*in_p);
     }
 
     /* interface */
     if ((rtmsg.hdr.rtm_addrs & RTA_IFP) != 0) {
-	rtaddr.dl_p->sdl_len = sizeof(*rtaddr.dl_p);
-	rtaddr.dl_p->sdl_family = AF_LINK;
-	rtaddr.dl_p->sdl_index = route->ifindex;
-	rtaddr.ptr += sizeof(*rtaddr.dl_p);
+	ptr = rtmsg_add_link(ptr, route->ifindex);
     }
     /* interface address */
     if ((rtmsg.hdr.rtm_addrs & RTA_IFA) != 0) {
-	rtaddr.in_p->sin6_len = sizeof(*rtaddr.in_p);
-	rtaddr.in_p->sin6_family = AF_INET6;
-	rtaddr.in_p->sin6_addr = route->ifa;
-	rtaddr.ptr += sizeof(*rtaddr.in_p);
+	in_p = rtmsg_add_in6(ptr);
+	in_p->sin6_addr = route->ifa;
+	ptr += sizeof(*in_p);
     }
 
     /* apply the route */
-    len = (int)(sizeof(rtmsg.hdr) + (rtaddr.ptr - (void *)rtmsg.addrs));
-    rtmsg.hdr.rtm_msglen = len;
-    if (write(sockfd, &rtmsg, len) == -1) {
-	ret = errno;
-    }
-    return (ret);
+    return (rtmsg_write(sockfd, &rtmsg.hdr, ptr));
 }
 
 static const RouteListInfo IPv6RouteListInfo = {
@@ -4213,9 +4290,18 @@ merge_array_prop(CFMutableDictionaryRef	dict,
     }
     if (state_prop != NULL
 	&& (setup_prop == NULL || S_append_state)) {
-	CFIndex	i;
-	CFIndex	n;
-	CFRange	setup_range	= CFRangeMake(0, CFArrayGetCount(merge_prop));
+	CFIndex		i;
+	CFIndex		n;
+	CFMutableSetRef	setup_vals	= NULL;
+
+	if (!append && (CFArrayGetCount(merge_prop) > 0)) {
+	    /* hash the setup values (to skip duplicate state values) */
+	    setup_vals = CFSetCreateMutable(NULL, 0, &kCFTypeSetCallBacks);
+	    n = CFArrayGetCount(merge_prop);
+	    for (i = 0; i < n; i++) {
+		CFSetAddValue(setup_vals, CFArrayGetValueAtIndex(merge_prop, i));
+	    }
+	}
 
 	n = CFArrayGetCount(state_prop);
 	for (i = 0; i < n; i++) {
@@ -4224,12 +4310,13 @@ merge_array_prop(CFMutableDictionaryRef	dict,
 	    val = CFArrayGetValueAtIndex(state_prop, i);
 	    val = sanitize_prop(val, flags);
 	    if (val != NULL) {
-		if (append || !CFArrayContainsValue(merge_prop, setup_range, val)) {
+		if ((setup_vals == NULL) || !CFSetContainsValue(setup_vals, val)) {
 		    CFArrayAppendValue(merge_prop, val);
 		}
 		CFRelease(val);
 	    }
 	}
+	my_CFRelease(&setup_vals);
     }
     if (CFArrayGetCount(merge_prop) > 0) {
 	CFDictionarySetValue(dict, key, merge_prop);
@@ -4504,6 +4591,19 @@ get_ipv6_changes(CFStringRef serviceID, CFDictionaryRef state_dict,
     if (interface != NULL) {
 	if (changed) {
 	    CFBooleanRef	needs_plat	= NULL;
+	    CFStringRef		signature	= NULL;
+
+	    // track the network this interface is attached to
+	    if (dict != NULL) {
+		signature = isA_CFString(CFDictionaryGetValue(state_dict,
+							      kStoreKeyNetworkSignature));
+	    }
+	    my_CFDictionarySetValue_async(__network_change_queue(),
+					  &S_nat64_prefix_signatures,
+					  interface,
+					  (signature != NULL)
+					  ? (CFTypeRef)signature
+					  : (CFTypeRef)kCFNull);
 
 	    if ((state_dict != NULL) &&
 		CFDictionaryGetValueIfPresent(state_dict,
@@ -4619,8 +4719,10 @@ static CF_RETURNS_RETAINED CFArrayRef
 order_dns_servers(CFArrayRef servers, ProtocolFlags active_protos)
 {
     Boolean		favor_v4	= FALSE;
+    CFIndex		n;
     CFMutableArrayRef	ordered_servers;
     ProtocolFlags	proto_last	= kProtocolFlagsIPv4;
+    CFIndex		proto_switch	= 0;
     struct sockaddr_in	v4_dns1		= { .sin_family = AF_INET,
 					    .sin_len = sizeof(struct sockaddr_in) };
     CFIndex		v4_n		= 0;
@@ -4638,8 +4740,8 @@ order_dns_servers(CFArrayRef servers, ProtocolFlags active_protos)
 	return CFRetain(servers);
     }
 
-    ordered_servers = CFArrayCreateMutable(NULL, 0, &kCFTypeArrayCallBacks);
-    for (CFIndex i = 0, n = CFArrayGetCount(servers); i < n; i++) {
+    n = CFArrayGetCount(servers);
+    for (CFIndex i = 0; i < n; i++) {
 	struct in_addr	ia;
 	struct in6_addr	ia6;
 	ProtocolFlags	proto;
@@ -4657,7 +4759,6 @@ order_dns_servers(CFArrayRef servers, ProtocolFlags active_protos)
 		bcopy(&ia6, &v6_dns1.sin6_addr, sizeof(ia6));
 	    }
 	} else {
-	    CFRelease(ordered_servers);
 	    return CFRetain(servers);
 	}
 
@@ -4681,24 +4782,29 @@ order_dns_servers(CFArrayRef servers, ProtocolFlags active_protos)
 		       inet_ntop(v6_dns1.sin6_family, &v6_dns1.sin6_addr, v6_buf, sizeof(v6_buf)),
 		       favor_v4 ? "v4" : "v6");
 #endif	// TEST_DNS_ORDER
+		proto_switch = i;
 	    } else {
 		/* if the server addresses array is randomly mixed */
 #ifdef	TEST_DNS_ORDER
 		printf("v4/v6 not ordered\n");
 #endif	// TEST_DNS_ORDER
-		CFRelease(ordered_servers);
 		return CFRetain(servers);
 	    }
 	}
 	proto_last = proto;
+    }
 
-	if ((proto == kProtocolFlagsIPv4) && favor_v4) {
-	    CFArrayInsertValueAtIndex(ordered_servers, v4_n - 1, server);
-	} else if ((proto == kProtocolFlagsIPv6) && !favor_v4) {
-	    CFArrayInsertValueAtIndex(ordered_servers, v6_n - 1, server);
-	} else {
-	    CFArrayAppendValue(ordered_servers, server);
-	}
+    /*
+     * The servers are in two blocks (one per protocol), move the block
+     * of the favored protocol to the front.
+     */
+    ordered_servers = CFArrayCreateMutable(NULL, 0, &kCFTypeArrayCallBacks);
+    if ((proto_switch > 0) && ((proto_last == kProtocolFlagsIPv4) == favor_v4)) {
+	/* if the 2nd block is favored */
+	CFArrayAppendArray(ordered_servers, servers, CFRangeMake(proto_switch, n - proto_switch));
+	CFArrayAppendArray(ordered_servers, servers, CFRangeMake(0, proto_switch));
+    } else {
+	CFArrayAppendArray(ordered_servers, servers, CFRangeMake(0, n));
     }
 
     return ordered_servers;
@@ -4981,6 +5087,20 @@ get_dns_changes(CFStringRef serviceID, CFDictionaryRef state_dict,
 #if	!TARGET_OS_SIMULATOR
     if (interface != NULL) {
 	if (changed) {
+	    CFArrayRef	servers	= NULL;
+
+	    // track the DNS (DNS64) servers used on this interface
+	    if (new_dict != NULL) {
+		servers = isA_CFArray(CFDictionaryGetValue(new_dict,
+							   kSCPropNetDNSServerAddresses));
+	    }
+	    my_CFDictionarySetValue_async(__network_change_queue(),
+					  &S_nat64_prefix_dns_servers,
+					  interface,
+					  (servers != NULL)
+					  ? (CFTypeRef)servers
+					  : (CFTypeRef)kCFNull);
+
 	    // DNS configuration changed for this interface, poke NAT64
 	    my_CFSetAddValue_async(__network_change_queue(), &S_nat64_prefix_changes, interface);
 	}
@@ -5743,38 +5863,189 @@ add_interface_link_pattern(CFMutableArrayRef patterns)
     CFRelease(pattern);
 }
 
-static CFDictionaryRef
-services_info_copy(SCDynamicStoreRef session, CFArrayRef service_list)
+/*
+ * services_info
+ *
+ * The Setup: and State: service keys (and the global keys) that IPMonitor
+ * watches are mirrored locally.  The mirror is primed with a single fetch
+ * of all of the watched keys and is then kept up to date by fetching only
+ * the keys reported as changed.  The interface Link keys are not watched
+ * so those continue to be fetched with each change.
+ */
+static Boolean
+services_info_key_is_mirrored(CFStringRef key)
 {
-    CFIndex		count;
+    return (CFStringHasPrefix(key, S_setup_service_prefix)
+	    || CFStringHasPrefix(key, S_state_service_prefix)
+	    || CFEqual(key, S_setup_global_ipv4)
+	    || CFEqual(key, S_multicast_resolvers)
+	    || CFEqual(key, S_private_resolvers));
+}
+
+static void
+services_info_mirror_add(const void * key, const void * value, void * context)
+{
+    CFMutableDictionaryRef	info	= (CFMutableDictionaryRef)context;
+
+    if (services_info_key_is_mirrored(key)) {
+	CFDictionarySetValue(S_services_info_mirror, key, value);
+    }
+    else {
+	/* not watched, only valid for this change */
+	CFDictionarySetValue(info, key, value);
+    }
+    return;
+}
+
+static void
+services_info_mirror_update(SCDynamicStoreRef session, CFArrayRef changed_keys,
+			    CFMutableDictionaryRef info)
+{
+    CFIndex		count	= 0;
+    CFDictionaryRef	fetched;
     CFMutableArrayRef	get_keys;
     CFMutableArrayRef	get_patterns;
-    CFDictionaryRef	info;
 
-    count = CFArrayGetCount(service_list);
     get_keys = CFArrayCreateMutable(NULL, 0, &kCFTypeArrayCallBacks);
     get_patterns = CFArrayCreateMutable(NULL, 0, &kCFTypeArrayCallBacks);
 
-    CFArrayAppendValue(get_keys, S_setup_global_ipv4);
-    CFArrayAppendValue(get_keys, S_multicast_resolvers);
-    CFArrayAppendValue(get_keys, S_private_resolvers);
-
-    for (CFIndex s = 0; s < count; s++) {
-	CFStringRef	serviceID = CFArrayGetValueAtIndex(service_list, s);
+    if (S_services_info_mirror == NULL) {
+	/* prime the mirror with all of the keys we watch */
+	S_services_info_mirror
+	    = CFDictionaryCreateMutable(NULL, 0,
+					&kCFTypeDictionaryKeyCallBacks,
+					&kCFTypeDictionaryValueCallBacks);
+	CFArrayAppendValue(get_keys, S_setup_global_ipv4);
+	CFArrayAppendValue(get_keys, S_multicast_resolvers);
+	CFArrayAppendValue(get_keys, S_private_resolvers);
+	add_service_keys(kSCCompAnyRegex, get_keys, get_patterns);
+	add_transient_status_keys(kSCCompAnyRegex, get_patterns);
+	add_reachability_patterns(get_patterns);
+	add_vpn_pattern(get_patterns);
+    }
+    else if (changed_keys != NULL) {
+	count = CFArrayGetCount(changed_keys);
+	for (CFIndex i = 0; i < count; i++) {
+	    CFStringRef	key	= CFArrayGetValueAtIndex(changed_keys, i);
 
-	add_service_keys(serviceID, get_keys, get_patterns);
-	add_transient_status_keys(serviceID, get_keys);
+	    if (services_info_key_is_mirrored(key)) {
+		CFArrayAppendValue(get_keys, key);
+	    }
+	}
     }
 
-    add_reachability_patterns(get_patterns);
+    add_interface_link_pattern(get_patterns);
 
-    add_vpn_pattern(get_patterns);
+    fetched = SCDynamicStoreCopyMultiple(session, get_keys, get_patterns);
 
-    add_interface_link_pattern(get_patterns);
+    /* keys that were changed but not returned have been removed */
+    count = CFArrayGetCount(get_keys);
+    for (CFIndex i = 0; i < count; i++) {
+	CFStringRef	key	= CFArrayGetValueAtIndex(get_keys, i);
+
+	if (fetched == NULL || !CFDictionaryContainsKey(fetched, key)) {
+	    CFDictionaryRemoveValue(S_services_info_mirror, key);
+	}
+    }
+    if (fetched != NULL) {
+	CFDictionaryApplyFunction(fetched, services_info_mirror_add, info);
+	CFRelease(fetched);
+    }
 
-    info = SCDynamicStoreCopyMultiple(session, get_keys, get_patterns);
     my_CFRelease(&get_keys);
     my_CFRelease(&get_patterns);
+    return;
+}
+
+static void
+services_info_copy_keys(CFMutableDictionaryRef info, CFArrayRef keys)
+{
+    CFIndex		count;
+
+    count = CFArrayGetCount(keys);
+    for (CFIndex i = 0; i < count; i++) {
+	CFStringRef	key	= CFArrayGetValueAtIndex(keys, i);
+	CFTypeRef	value;
+
+	value = CFDictionaryGetValue(S_services_info_mirror, key);
+	if (value != NULL) {
+	    CFDictionarySetValue(info, key, value);
+	}
+    }
+    return;
+}
+
+static void
+services_info_copy_any_service(const void * key, const void * value,
+			       void * context)
+{
+    CFMutableDictionaryRef	info	= (CFMutableDictionaryRef)context;
+    CFStringRef			entity;
+    CFIndex			len;
+    CFRange			range;
+
+    /* Setup:/Network/Service/<anything>/<entity> */
+    if (!CFStringHasPrefix(key, S_setup_service_prefix)) {
+	return;
+    }
+    len = CFStringGetLength(key);
+    range = CFStringFind(key, CFSTR("/"), kCFCompareBackwards);
+    if (range.location == kCFNotFound
+	|| range.location < CFStringGetLength(S_setup_service_prefix)) {
+	return;
+    }
+    entity = CFStringCreateWithSubstring(NULL, key,
+					 CFRangeMake(range.location + 1,
+						     len - range.location - 1));
+    if (CFEqual(entity, kSCEntNetVPN)) {
+	CFDictionarySetValue(info, key, value);
+    }
+    else {
+	for (size_t i = 0; i < countof(reachabilitySetupKeys); i++) {
+	    if (CFEqual(entity, *reachabilitySetupKeys[i])) {
+		CFDictionarySetValue(info, key, value);
+		break;
+	    }
+	}
+    }
+    CFRelease(entity);
+    return;
+}
+
+static CFDictionaryRef
+services_info_copy(SCDynamicStoreRef session, CFArrayRef changed_keys,
+		   CFArrayRef service_list)
+{
+    CFIndex			count;
+    CFMutableDictionaryRef	info;
+    CFMutableArrayRef		keys;
+
+    info = CFDictionaryCreateMutable(NULL, 0,
+				     &kCFTypeDictionaryKeyCallBacks,
+				     &kCFTypeDictionaryValueCallBacks);
+    services_info_mirror_update(session, changed_keys, info);
+
+    keys = CFArrayCreateMutable(NULL, 0, &kCFTypeArrayCallBacks);
+    CFArrayAppendValue(keys, S_setup_global_ipv4);
+    CFArrayAppendValue(keys, S_multicast_resolvers);
+    CFArrayAppendValue(keys, S_private_resolvers);
+
+    count = CFArrayGetCount(service_list);
+    for (CFIndex s = 0; s < count; s++) {
+	CFStringRef	serviceID = CFArrayGetValueAtIndex(service_list, s);
+
+	/* the per-service patterns match exactly one key */
+	add_service_keys(serviceID, keys, keys);
+	add_transient_status_keys(serviceID, keys);
+    }
+    services_info_copy_keys(info, keys);
+    my_CFRelease(&keys);
+
+    /* the reachability and VPN setup entities of all services */
+    CFDictionaryApplyFunction(S_services_info_mirror,
+			      services_info_copy_any_service,
+			      info);
+
     return (info);
 }
 
@@ -7978,10 +8249,17 @@ post_network_change_when_ready()
     if ((S_network_change_needed & NETWORK_CHANGE_NAT64) != 0) {
 #if	!TARGET_OS_SIMULATOR
 	// process any NAT64 prefix update requests (and refresh existing prefixes on change)
-	if ((S_nat64_prefix_requests != NULL) || (S_nat64_prefix_changes != NULL)) {
-	    nat64_configuration_update(S_nat64_prefix_requests, S_nat64_prefix_changes);
+	if ((S_nat64_prefix_requests != NULL) || (S_nat64_prefix_changes != NULL)
+	    || (S_nat64_prefix_signatures != NULL)
+	    || (S_nat64_prefix_dns_servers != NULL)) {
+	    nat64_configuration_update(S_nat64_prefix_requests,
+				       S_nat64_prefix_changes,
+				       S_nat64_prefix_signatures,
+				       S_nat64_prefix_dns_servers);
 	    my_CFRelease(&S_nat64_prefix_requests);
 	    my_CFRelease(&S_nat64_prefix_changes);
+	    my_CFRelease(&S_nat64_prefix_signatures);
+	    my_CFRelease(&S_nat64_prefix_dns_servers);
 	}
 #endif	/* !TARGET_OS_SIMULATOR */
 
@@ -8206,7 +8484,7 @@ IPMonitorProcessChanges(SCDynamicStoreRef session, CFArrayRef changed_keys,
     }
 
     /* grab a snapshot of everything we need */
-    services_info = services_info_copy(session, service_changes);
+    services_info = services_info_copy(session, changed_keys, service_changes);
     assert(services_info != NULL);
 
     /* grab the service order */
@@ -51,7 +51,36 @@
 #endif // __has_include(<nw/private.h>)
 
 
-static CFMutableSetRef	nat64_prefix_requests	= NULL;
+/*
+ * Note: the following state is only accessed from the nat64_dispatch_queue()
+ *
+ * nat64_prefix_requests
+ *   interfaces with active nat64 prefixes (refreshed on change)
+ * nat64_prefix_inflight
+ *   interfaces with an outstanding nw_nat64_copy_prefixes_async() request
+ *   (and the network at the time that request was started)
+ * nat64_prefix_restart
+ *   interfaces that need to be re-queried once the outstanding request
+ *   completes
+ * nat64_prefix_signatures
+ *   the current network signature for each interface
+ * nat64_prefix_dns_servers
+ *   the current DNS (DNS64) servers for each interface
+ * nat64_prefix_cache
+ *   the last successful prefix discovery result, keyed by interface
+ *   (and only valid for the same network signature and DNS servers)
+ */
+static CFMutableSetRef		nat64_prefix_requests	= NULL;
+static CFMutableDictionaryRef	nat64_prefix_inflight	= NULL;
+static CFMutableSetRef		nat64_prefix_restart	= NULL;
+static CFMutableDictionaryRef	nat64_prefix_signatures	= NULL;
+static CFMutableDictionaryRef	nat64_prefix_dns_servers	= NULL;
+static CFMutableDictionaryRef	nat64_prefix_cache	= NULL;
+
+#define	kNAT64CacheNetwork	CFSTR("Network")
+#define	kNAT64CachePrefixes	CFSTR("Prefixes")
+#define	kNAT64NetworkSignature	CFSTR("Signature")
+#define	kNAT64NetworkDNSServers	CFSTR("DNSServers")
 
 
 static dispatch_queue_t
@@ -183,23 +212,163 @@ _nat64_prefix_post(CFStringRef		interface,
 }
 
 
+static CFStringRef
+_nat64_prefix_signature(CFStringRef interface)
+{
+	CFStringRef	signature;
+
+	signature = CFDictionaryGetValue(nat64_prefix_signatures, interface);
+	return isA_CFString(signature);
+}
+
+
+/*
+ * _nat64_prefix_copy_network
+ *   returns the network signature and DNS servers currently associated
+ *   with the interface (or NULL if not attached to a known network)
+ */
+static CFDictionaryRef
+_nat64_prefix_copy_network(CFStringRef interface)
+{
+	CFMutableDictionaryRef	network;
+	CFArrayRef		servers;
+	CFStringRef		signature;
+
+	signature = _nat64_prefix_signature(interface);
+	if (signature == NULL) {
+		return NULL;
+	}
+
+	network = CFDictionaryCreateMutable(NULL,
+					    0,
+					    &kCFTypeDictionaryKeyCallBacks,
+					    &kCFTypeDictionaryValueCallBacks);
+	CFDictionarySetValue(network, kNAT64NetworkSignature, signature);
+	servers = isA_CFArray(CFDictionaryGetValue(nat64_prefix_dns_servers, interface));
+	if (servers != NULL) {
+		CFDictionarySetValue(network, kNAT64NetworkDNSServers, servers);
+	}
+	return network;
+}
+
+
+static void
+_nat64_prefix_cache_flush(CFStringRef interface)
+{
+	CFDictionaryRemoveValue(nat64_prefix_cache, interface);
+	return;
+}
+
+
+static void
+_nat64_prefix_cache_save(CFStringRef		interface,
+			 CFDictionaryRef	network,
+			 int32_t		num_prefixes,
+			 nw_nat64_prefix_t	*prefixes)
+{
+	CFMutableDictionaryRef	cached;
+	CFDataRef		data;
+
+	if ((network == NULL) || (num_prefixes <= 0)) {
+		// only cache successful discovery on a known network
+		_nat64_prefix_cache_flush(interface);
+		return;
+	}
+
+	cached = CFDictionaryCreateMutable(NULL,
+					   0,
+					   &kCFTypeDictionaryKeyCallBacks,
+					   &kCFTypeDictionaryValueCallBacks);
+	CFDictionarySetValue(cached, kNAT64CacheNetwork, network);
+	data = CFDataCreate(NULL,
+			    (const UInt8 *)prefixes,
+			    num_prefixes * sizeof(nw_nat64_prefix_t));
+	CFDictionarySetValue(cached, kNAT64CachePrefixes, data);
+	CFRelease(data);
+	CFDictionarySetValue(nat64_prefix_cache, interface, cached);
+	CFRelease(cached);
+	return;
+}
+
+
+static Boolean
+_nat64_prefix_cache_apply(CFStringRef interface, const char *if_name)
+{
+	CFDictionaryRef		cached;
+	CFDataRef		data;
+	CFDictionaryRef		network;
+	int32_t			num_prefixes;
+	nw_nat64_prefix_t	*prefixes;
+	CFAbsoluteTime		start_time;
+
+	cached = CFDictionaryGetValue(nat64_prefix_cache, interface);
+	if (cached == NULL) {
+		return FALSE;
+	}
+
+	network = _nat64_prefix_copy_network(interface);
+	if ((network == NULL) ||
+	    !CFEqual(network, CFDictionaryGetValue(cached, kNAT64CacheNetwork))) {
+		// if the network (or its DNS servers) changed
+		_nat64_prefix_cache_flush(interface);
+		if (network != NULL) CFRelease(network);
+		return FALSE;
+	}
+
+	// same network attachment, re-use the earlier discovery result
+	start_time = CFAbsoluteTimeGetCurrent();
+	data = CFDictionaryGetValue(cached, kNAT64CachePrefixes);
+	num_prefixes = (int32_t)(CFDataGetLength(data) / sizeof(nw_nat64_prefix_t));
+	prefixes = (nw_nat64_prefix_t *)(void *)CFDataGetBytePtr(data);
+	if (!_nat64_prefix_set(if_name, num_prefixes, prefixes)) {
+		_nat64_prefix_cache_flush(interface);
+		CFRelease(network);
+		return FALSE;
+	}
+
+	SC_log(LOG_INFO, "%@: nat64 prefix%s re-used for network %@",
+	       interface,
+	       (num_prefixes != 1) ? "es" : "",
+	       network);
+	CFRelease(network);
+	CFSetAddValue(nat64_prefix_requests, interface);
+
+	// ... and publish, just as if the query had completed
+	_nat64_prefix_post(interface, num_prefixes, prefixes, start_time);
+	return TRUE;
+}
+
+
 static void
 _nat64_prefix_request_start(const void *value)
 {
 	unsigned int	if_index;
 	char		*if_name;
 	CFStringRef	interface	= (CFStringRef)value;
+	CFDictionaryRef	network;
 	bool		ok;
 	CFAbsoluteTime	start_time;
 
 	SC_log(LOG_DEBUG, "%@: _nat64_prefix_request_start", interface);
 
+	if (CFDictionaryContainsKey(nat64_prefix_inflight, interface)) {
+		// a request is already outstanding, query again when it completes
+		SC_log(LOG_DEBUG, "%@: nat64 prefix request coalesced", interface);
+		CFSetAddValue(nat64_prefix_restart, interface);
+		return;
+	}
+
 	if_name = _SC_cfstring_to_cstring(interface, NULL, 0, kCFStringEncodingASCII);
 	if (if_name == NULL) {
 		SC_log(LOG_NOTICE, "%@: could not convert interface name", interface);
 		return;
 	}
 
+	if (_nat64_prefix_cache_apply(interface, if_name)) {
+		CFAllocatorDeallocate(NULL, if_name);
+		return;
+	}
+
 	if_index = my_if_nametoindex(if_name);
 	if (if_index == 0) {
 		SC_log(LOG_NOTICE, "%s: no interface index", if_name);
@@ -210,11 +379,21 @@ _nat64_prefix_request_start(const void *value)
 	// keep track of interfaces with active nat64 prefix requests
 	CFSetAddValue(nat64_prefix_requests, interface);
 
+	// ... and of the network the outstanding request was started on
+	network = _nat64_prefix_copy_network(interface);
+	CFDictionarySetValue(nat64_prefix_inflight,
+			     interface,
+			     (network != NULL) ? (CFTypeRef)network : (CFTypeRef)kCFNull);
+	if (network != NULL) CFRelease(network);
+
 	CFRetain(interface);
 	start_time = CFAbsoluteTimeGetCurrent();
 	ok = nw_nat64_copy_prefixes_async(&if_index,
 					  nat64_dispatch_queue(),
 					  ^(int32_t num_prefixes, nw_nat64_prefix_t *prefixes) {
+						  CFDictionaryRef	current;
+						  CFDictionaryRef	started_on;
+
 						  if (num_prefixes >= 0) {
 							  // update interface
 							  if (!_nat64_prefix_set(if_name, num_prefixes, prefixes)) {
@@ -232,8 +411,26 @@ _nat64_prefix_request_start(const void *value)
 							  CFSetRemoveValue(nat64_prefix_requests, interface);
 						  }
 
+						  // remember the result for this network
+						  started_on = isA_CFDictionary(CFDictionaryGetValue(nat64_prefix_inflight, interface));
+						  current = _nat64_prefix_copy_network(interface);
+						  if ((started_on != NULL) &&
+						      _SC_CFEqual(started_on, current)) {
+							  _nat64_prefix_cache_save(interface, started_on, num_prefixes, prefixes);
+						  } else {
+							  _nat64_prefix_cache_flush(interface);
+						  }
+						  if (current != NULL) CFRelease(current);
+						  CFDictionaryRemoveValue(nat64_prefix_inflight, interface);
+
 						  _nat64_prefix_post(interface, num_prefixes, prefixes, start_time);
 
+						  if (CFSetContainsValue(nat64_prefix_restart, interface)) {
+							  // if another request arrived while this one was outstanding
+							  CFSetRemoveValue(nat64_prefix_restart, interface);
+							  _nat64_prefix_request_start(interface);
+						  }
+
 						  // cleanup
 						  CFRelease(interface);
 						  CFAllocatorDeallocate(NULL, if_name);
@@ -243,6 +440,8 @@ _nat64_prefix_request_start(const void *value)
 
 		// remove from active list
 		CFSetRemoveValue(nat64_prefix_requests, interface);
+		CFDictionaryRemoveValue(nat64_prefix_inflight, interface);
+		CFSetRemoveValue(nat64_prefix_restart, interface);
 
 		CFRelease(interface);
 		CFAllocatorDeallocate(NULL, if_name);
@@ -272,9 +471,14 @@ _nat64_prefix_request(const void *value, void *context)
 static void
 _nat64_prefix_update(const void *value, void *context)
 {
-#pragma unused(context)
+	CFSetRef	requests	= (CFSetRef)context;
 	CFStringRef	interface	= (CFStringRef)value;
 
+	if ((requests != NULL) && CFSetContainsValue(requests, interface)) {
+		// the refresh will be handled with the request
+		return;
+	}
+
 	if (CFSetContainsValue(nat64_prefix_requests, interface)) {
 		_nat64_prefix_request_start(interface);
 	}
@@ -283,6 +487,43 @@ _nat64_prefix_update(const void *value, void *context)
 }
 
 
+static void
+_nat64_prefix_signature_update(const void *key, const void *value, void *context)
+{
+#pragma unused(context)
+	CFStringRef	interface	= (CFStringRef)key;
+	CFStringRef	signature	= isA_CFString((CFTypeRef)value);
+
+	if (signature == NULL) {
+		// if no longer attached to a (known) network
+		CFDictionaryRemoveValue(nat64_prefix_signatures, interface);
+		_nat64_prefix_cache_flush(interface);
+		return;
+	}
+
+	CFDictionarySetValue(nat64_prefix_signatures, interface, signature);
+	return;
+}
+
+
+static void
+_nat64_prefix_dns_servers_update(const void *key, const void *value, void *context)
+{
+#pragma unused(context)
+	CFStringRef	interface	= (CFStringRef)key;
+	CFArrayRef	servers		= isA_CFArray((CFTypeRef)value);
+
+	// note: a cached result for other DNS servers will not be re-used
+	if (servers == NULL) {
+		CFDictionaryRemoveValue(nat64_prefix_dns_servers, interface);
+		return;
+	}
+
+	CFDictionarySetValue(nat64_prefix_dns_servers, interface, servers);
+	return;
+}
+
+
 #pragma mark -
 #pragma mark NAT64 prefix functions (for IPMonitor)
 
@@ -339,23 +580,75 @@ nat64_configuration_init(CFBundleRef bundle)
 {
 #pragma unused(bundle)
 	nat64_prefix_requests = CFSetCreateMutable(NULL, 0, &kCFTypeSetCallBacks);
+	nat64_prefix_inflight = CFDictionaryCreateMutable(NULL,
+							  0,
+							  &kCFTypeDictionaryKeyCallBacks,
+							  &kCFTypeDictionaryValueCallBacks);
+	nat64_prefix_restart = CFSetCreateMutable(NULL, 0, &kCFTypeSetCallBacks);
+	nat64_prefix_signatures = CFDictionaryCreateMutable(NULL,
+							    0,
+							    &kCFTypeDictionaryKeyCallBacks,
+							    &kCFTypeDictionaryValueCallBacks);
+	nat64_prefix_dns_servers = CFDictionaryCreateMutable(NULL,
+							     0,
+							     &kCFTypeDictionaryKeyCallBacks,
+							     &kCFTypeDictionaryValueCallBacks);
+	nat64_prefix_cache = CFDictionaryCreateMutable(NULL,
+						       0,
+						       &kCFTypeDictionaryKeyCallBacks,
+						       &kCFTypeDictionaryValueCallBacks);
 	return;
 }
 
 
 __private_extern__
 void
-nat64_configuration_update(CFSetRef requests, CFSetRef changes)
+nat64_configuration_update(CFSetRef		requests,
+			   CFSetRef		changes,
+			   CFDictionaryRef	signatures,
+			   CFDictionaryRef	dns_servers)
 {
-	// for any interface that changed, refresh the nat64 prefix
+	if (requests != NULL) {
+		CFRetain(requests);
+	}
 	if (changes != NULL) {
-		CFSetApplyFunction(changes, _nat64_prefix_update, NULL);
+		CFRetain(changes);
 	}
-
-	// for any requested interface, query the nat64 prefix
-	if (requests != NULL) {
-		CFSetApplyFunction(requests, _nat64_prefix_request, (void *)changes);
+	if (signatures != NULL) {
+		CFRetain(signatures);
+	}
+	if (dns_servers != NULL) {
+		CFRetain(dns_servers);
 	}
 
+	dispatch_async(nat64_dispatch_queue(), ^{
+		// track the network each interface is attached to
+		if (signatures != NULL) {
+			CFDictionaryApplyFunction(signatures, _nat64_prefix_signature_update, NULL);
+			CFRelease(signatures);
+		}
+
+		// ... and the DNS servers in use on each interface
+		if (dns_servers != NULL) {
+			CFDictionaryApplyFunction(dns_servers, _nat64_prefix_dns_servers_update, NULL);
+			CFRelease(dns_servers);
+		}
+
+		// for any interface that changed, refresh the nat64 prefix
+		if (changes != NULL) {
+			CFSetApplyFunction(changes, _nat64_prefix_update, (void *)requests);
+		}
+
+		// for any requested interface, query the nat64 prefix
+		if (requests != NULL) {
+			CFSetApplyFunction(requests, _nat64_prefix_request, (void *)changes);
+			CFRelease(requests);
+		}
+
+		if (changes != NULL) {
+			CFRelease(changes);
+		}
+	});
+
 	return;
 }
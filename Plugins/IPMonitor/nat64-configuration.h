@@ -1,5 +1,5 @@
 /*
- * Copyright (c) 2017 Apple Inc. All rights reserved.
+ * Copyright (c) 2017, 2018 Apple Inc. All rights reserved.
  *
  * @APPLE_LICENSE_HEADER_START@
  *
@@ -42,8 +42,10 @@ void
 nat64_configuration_init		(CFBundleRef		bundle);
 
 void
-nat64_configuration_update		(CFSetRef		interface_changes,
-					 CFSetRef		interface_requests);
+nat64_configuration_update		(CFSetRef		interface_requests,
+					 CFSetRef		interface_changes,
+					 CFDictionaryRef	interface_signatures,
+					 CFDictionaryRef	interface_dns_servers);
 
 __END_DECLS
 
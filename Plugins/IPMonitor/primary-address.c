@@ -0,0 +1,566 @@
+/*
+ * Copyright (c) 2018 Apple Inc. All rights reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+
+/*
+ * primary-address.c
+ * - track the primary (IPv4) service and address
+ * - issue (and cache) reverse DNS queries for the primary address
+ *
+ * Both the hostname and the SMB (NetBIOS name) configuration code want the
+ * primary address and the name(s) associated with it.  This code keeps a
+ * single copy of that information so that a network change results in one
+ * set of store reads and one PTR query rather than one per consumer.
+ */
+
+#include "primary-address.h"
+
+#include <notify.h>
+#include <sys/queue.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+
+#include <CoreFoundation/CoreFoundation.h>
+#include <SystemConfiguration/SystemConfiguration.h>
+#include <SystemConfiguration/SCValidation.h>
+#include <SystemConfiguration/SCPrivate.h>
+#include "ip_plugin.h"
+
+
+/*
+ * PTR_CACHE_LIFETIME
+ *   the number of seconds that a reverse DNS answer will be reused.  The
+ *   cache is also flushed whenever the network configuration changes.
+ */
+#define	PTR_CACHE_LIFETIME	300.0
+
+#define	PTR_CACHE_HOSTS_KEY	CFSTR("hosts")
+#define	PTR_CACHE_EXPIRES_KEY	CFSTR("expires")
+
+
+#pragma mark -
+#pragma mark Primary service / address
+
+
+static int			S_network_change_token	= -1;
+
+static Boolean			S_primary_valid		= FALSE;
+static CFStringRef		S_primary_serviceID	= NULL;
+static Boolean			S_primary_address_valid	= FALSE;
+static CFStringRef		S_primary_address	= NULL;
+
+static CFMutableDictionaryRef	S_ptr_cache		= NULL;
+
+
+static void
+primary_flush(void)
+{
+	S_primary_valid = FALSE;
+	if (S_primary_serviceID != NULL) {
+		CFRelease(S_primary_serviceID);
+		S_primary_serviceID = NULL;
+	}
+
+	S_primary_address_valid = FALSE;
+	if (S_primary_address != NULL) {
+		CFRelease(S_primary_address);
+		S_primary_address = NULL;
+	}
+
+	if (S_ptr_cache != NULL) {
+		CFDictionaryRemoveAllValues(S_ptr_cache);
+	}
+
+	return;
+}
+
+
+/*
+ * primary_check
+ *   flush any cached information if the network configuration has
+ *   changed (i.e. "com.apple.system.config.network_change" has been
+ *   posted) since we last looked.
+ */
+static void
+primary_check(void)
+{
+	int		changed	= 1;
+	uint32_t	status;
+
+	if (S_network_change_token == -1) {
+		status = notify_register_check(_SC_NOTIFY_NETWORK_CHANGE, &S_network_change_token);
+		if (status != NOTIFY_STATUS_OK) {
+			my_log(LOG_ERR, "notify_register_check() failed: %u", status);
+			S_network_change_token = -1;
+		}
+	}
+
+	if (S_network_change_token != -1) {
+		status = notify_check(S_network_change_token, &changed);
+		if (status != NOTIFY_STATUS_OK) {
+			changed = 1;
+		}
+	}
+
+	if (changed) {
+		primary_flush();
+	}
+
+	return;
+}
+
+
+static CFStringRef
+copy_primary_service(SCDynamicStoreRef store)
+{
+	CFDictionaryRef	dict;
+	CFStringRef	key;
+	CFStringRef	serviceID	= NULL;
+
+	key = SCDynamicStoreKeyCreateNetworkGlobalEntity(NULL,
+							 kSCDynamicStoreDomainState,
+							 kSCEntNetIPv4);
+	dict = SCDynamicStoreCopyValue(store, key);
+	CFRelease(key);
+
+	if (dict != NULL) {
+		if (isA_CFDictionary(dict)) {
+			serviceID = CFDictionaryGetValue(dict, kSCDynamicStorePropNetPrimaryService);
+			if (isA_CFString(serviceID)) {
+				CFRetain(serviceID);
+			} else {
+				serviceID = NULL;
+			}
+		}
+		CFRelease(dict);
+	}
+
+	return serviceID;
+}
+
+
+static CFStringRef
+copy_primary_ip(SCDynamicStoreRef store, CFStringRef serviceID)
+{
+	CFStringRef	address	= NULL;
+	CFDictionaryRef	dict;
+	CFStringRef	key;
+
+	key = SCDynamicStoreKeyCreateNetworkServiceEntity(NULL,
+							  kSCDynamicStoreDomainState,
+							  serviceID,
+							  kSCEntNetIPv4);
+	dict = SCDynamicStoreCopyValue(store, key);
+	CFRelease(key);
+
+	if (dict != NULL) {
+		if (isA_CFDictionary(dict)) {
+			CFArrayRef	addresses;
+
+			addresses = CFDictionaryGetValue(dict, kSCPropNetIPv4Addresses);
+			if (isA_CFArray(addresses) && (CFArrayGetCount(addresses) > 0)) {
+				address = CFArrayGetValueAtIndex(addresses, 0);
+				if (isA_CFString(address)) {
+					CFRetain(address);
+				} else {
+					address = NULL;
+				}
+			}
+		}
+		CFRelease(dict);
+	}
+
+	return address;
+}
+
+
+__private_extern__
+CFStringRef
+primary_service_copy(SCDynamicStoreRef store)
+{
+	primary_check();
+
+	if (!S_primary_valid) {
+		S_primary_serviceID = copy_primary_service(store);
+		S_primary_valid = TRUE;
+	}
+
+	if (S_primary_serviceID != NULL) {
+		CFRetain(S_primary_serviceID);
+	}
+	return S_primary_serviceID;
+}
+
+
+__private_extern__
+CFStringRef
+primary_address_copy(SCDynamicStoreRef store, CFStringRef serviceID)
+{
+	CFStringRef	address;
+	Boolean		isPrimary;
+
+	primary_check();
+
+	isPrimary = S_primary_valid && _SC_CFEqual(serviceID, S_primary_serviceID);
+	if (isPrimary && S_primary_address_valid) {
+		// if we already know the primary address
+		if (S_primary_address != NULL) {
+			CFRetain(S_primary_address);
+		}
+		return S_primary_address;
+	}
+
+	address = copy_primary_ip(store, serviceID);
+	if (isPrimary) {
+		S_primary_address = (address != NULL) ? CFRetain(address) : NULL;
+		S_primary_address_valid = TRUE;
+	}
+
+	return address;
+}
+
+
+#pragma mark -
+#pragma mark Reverse DNS (PTR) queries
+
+
+typedef struct ptr_lookup	ptr_lookup, *ptr_lookupRef;
+
+struct __primary_ptr_query {
+	LIST_ENTRY(__primary_ptr_query)	link;
+	ptr_lookupRef			lookup;		// NULL if answered from the cache
+	primary_ptr_query_callback_t	callback;	// NULL if cancelled
+	void				*context;
+};
+
+struct ptr_lookup {
+	LIST_ENTRY(ptr_lookup)			link;
+	CFStringRef				address;
+	SCNetworkReachabilityRef		target;
+	CFRunLoopRef				rl;
+	struct timeval				start;
+	Boolean					completing;
+	LIST_HEAD(, __primary_ptr_query)	queries;
+};
+
+static LIST_HEAD(, ptr_lookup)	S_ptr_lookups	= LIST_HEAD_INITIALIZER(S_ptr_lookups);
+
+
+static CFArrayRef
+ptr_cache_copy(CFStringRef address, Boolean *found)
+{
+	CFDictionaryRef	entry;
+	CFNumberRef	expires;
+	CFAbsoluteTime	expiration	= 0;
+	CFArrayRef	hosts;
+
+	*found = FALSE;
+	if (S_ptr_cache == NULL) {
+		return NULL;
+	}
+
+	entry = CFDictionaryGetValue(S_ptr_cache, address);
+	if (entry == NULL) {
+		return NULL;
+	}
+
+	expires = CFDictionaryGetValue(entry, PTR_CACHE_EXPIRES_KEY);
+	if (!CFNumberGetValue(expires, kCFNumberDoubleType, &expiration) ||
+	    (expiration < CFAbsoluteTimeGetCurrent())) {
+		// if the cached answer has expired
+		CFDictionaryRemoveValue(S_ptr_cache, address);
+		return NULL;
+	}
+
+	*found = TRUE;
+	hosts = CFDictionaryGetValue(entry, PTR_CACHE_HOSTS_KEY);
+	if (!isA_CFArray(hosts)) {
+		// if the address did not resolve
+		return NULL;
+	}
+
+	CFRetain(hosts);
+	return hosts;
+}
+
+
+static void
+ptr_cache_set(CFStringRef address, CFArrayRef hosts)
+{
+	CFDictionaryRef	entry;
+	CFAbsoluteTime	expiration;
+	CFNumberRef	expires;
+	const void *	keys[2];
+	const void *	vals[2];
+
+	if (S_ptr_cache == NULL) {
+		S_ptr_cache = CFDictionaryCreateMutable(NULL,
+							0,
+							&kCFTypeDictionaryKeyCallBacks,
+							&kCFTypeDictionaryValueCallBacks);
+	}
+
+	expiration = CFAbsoluteTimeGetCurrent() + PTR_CACHE_LIFETIME;
+	expires = CFNumberCreate(NULL, kCFNumberDoubleType, &expiration);
+	keys[0] = PTR_CACHE_HOSTS_KEY;
+	vals[0] = (hosts != NULL) ? (CFTypeRef)hosts : (CFTypeRef)kCFNull;
+	keys[1] = PTR_CACHE_EXPIRES_KEY;
+	vals[1] = expires;
+	entry = CFDictionaryCreate(NULL,
+				   keys,
+				   vals,
+				   sizeof(keys) / sizeof(keys[0]),
+				   &kCFTypeDictionaryKeyCallBacks,
+				   &kCFTypeDictionaryValueCallBacks);
+	CFDictionarySetValue(S_ptr_cache, address, entry);
+	CFRelease(entry);
+	CFRelease(expires);
+
+	return;
+}
+
+
+static void
+ptr_lookup_free(ptr_lookupRef lookup)
+{
+	my_log(LOG_INFO, "ptr query stop (%@)", lookup->address);
+
+	LIST_REMOVE(lookup, link);
+	SCNetworkReachabilitySetCallback(lookup->target, NULL, NULL);
+	SCNetworkReachabilityUnscheduleFromRunLoop(lookup->target, lookup->rl, kCFRunLoopDefaultMode);
+	CFRelease(lookup->target);
+	CFRelease(lookup->address);
+	free(lookup);
+
+	return;
+}
+
+
+static void
+ptr_lookup_callback(SCNetworkReachabilityRef target, SCNetworkReachabilityFlags flags, void *info)
+{
+	CFArrayRef		hosts		= NULL;
+	ptr_lookupRef		lookup		= (ptr_lookupRef)info;
+	struct timeval		ptrQueryComplete;
+	struct timeval		ptrQueryElapsed;
+	primary_ptr_query_t	query;
+
+	(void) gettimeofday(&ptrQueryComplete, NULL);
+	timersub(&ptrQueryComplete, &lookup->start, &ptrQueryElapsed);
+
+	if (flags & kSCNetworkReachabilityFlagsReachable) {
+		int		error_num;
+
+		/*
+		 * if [reverse] DNS query was successful
+		 */
+		hosts = SCNetworkReachabilityCopyResolvedAddress(target, &error_num);
+		if (hosts == NULL) {
+			// if kSCNetworkReachabilityFlagsReachable and hosts == NULL
+			// it means the PTR request has not come back yet
+			// we must wait for this callback to be called again
+			my_log(LOG_INFO, "ptr query reply w/no hosts (query time = %ld.%3.3d)",
+			       ptrQueryElapsed.tv_sec,
+			       ptrQueryElapsed.tv_usec / 1000);
+			return;
+		}
+
+		if (CFArrayGetCount(hosts) == 0) {
+			my_log(LOG_INFO, "ptr query complete w/no hosts (query time = %ld.%3.3d)",
+			       ptrQueryElapsed.tv_sec,
+			       ptrQueryElapsed.tv_usec / 1000);
+		} else {
+			my_log(LOG_INFO, "ptr query complete (query time = %ld.%3.3d)",
+			       ptrQueryElapsed.tv_sec,
+			       ptrQueryElapsed.tv_usec / 1000);
+		}
+	} else {
+		my_log(LOG_INFO, "ptr query complete, host not found (query time = %ld.%3.3d)",
+		       ptrQueryElapsed.tv_sec,
+		       ptrQueryElapsed.tv_usec / 1000);
+	}
+
+	// remember the answer
+	ptr_cache_set(lookup->address, hosts);
+
+	// and report it to anyone who asked
+	lookup->completing = TRUE;
+	while ((query = LIST_FIRST(&lookup->queries)) != NULL) {
+		LIST_REMOVE(query, link);
+		(*query->callback)(hosts, query->context);
+		free(query);
+	}
+	ptr_lookup_free(lookup);
+
+	if (hosts != NULL) CFRelease(hosts);
+	return;
+}
+
+
+static ptr_lookupRef
+ptr_lookup_start(CFStringRef address, CFRunLoopRef rl)
+{
+	union {
+		struct sockaddr         sa;
+		struct sockaddr_in      sin;
+		struct sockaddr_in6     sin6;
+	} addr;
+	char				buf[64];
+	SCNetworkReachabilityContext	context	= { 0, NULL, NULL, NULL, NULL };
+	CFDataRef			data;
+	ptr_lookupRef			lookup;
+	CFMutableDictionaryRef		options;
+	SCNetworkReachabilityRef	target;
+
+	if (_SC_cfstring_to_cstring(address, buf, sizeof(buf), kCFStringEncodingASCII) == NULL) {
+		my_log(LOG_ERR, "could not convert [primary] address string");
+		return NULL;
+	}
+
+	if (_SC_string_to_sockaddr(buf, AF_UNSPEC, (void *)&addr, sizeof(addr)) == NULL) {
+		my_log(LOG_ERR, "could not convert [primary] address");
+		return NULL;
+	}
+
+	options = CFDictionaryCreateMutable(NULL,
+					    0,
+					    &kCFTypeDictionaryKeyCallBacks,
+					    &kCFTypeDictionaryValueCallBacks);
+	data = CFDataCreate(NULL, (const UInt8 *)&addr.sa, addr.sa.sa_len);
+	CFDictionarySetValue(options, kSCNetworkReachabilityOptionPTRAddress, data);
+	CFRelease(data);
+	target = SCNetworkReachabilityCreateWithOptions(NULL, options);
+	CFRelease(options);
+	if (target == NULL) {
+		my_log(LOG_ERR, "could not resolve [primary] address");
+		return NULL;
+	}
+
+	lookup = calloc(1, sizeof(*lookup));
+	lookup->address = CFRetain(address);
+	lookup->target = target;
+	lookup->rl = rl;
+	LIST_INIT(&lookup->queries);
+	LIST_INSERT_HEAD(&S_ptr_lookups, lookup, link);
+
+	my_log(LOG_INFO, "ptr query start (%@)", address);
+	(void) gettimeofday(&lookup->start, NULL);
+
+	context.info = lookup;
+	(void) SCNetworkReachabilitySetCallback(target, ptr_lookup_callback, &context);
+	(void) SCNetworkReachabilityScheduleWithRunLoop(target, rl, kCFRunLoopDefaultMode);
+
+	return lookup;
+}
+
+
+static ptr_lookupRef
+ptr_lookup_find(CFStringRef address, CFRunLoopRef rl)
+{
+	ptr_lookupRef	lookup;
+
+	LIST_FOREACH(lookup, &S_ptr_lookups, link) {
+		if ((lookup->rl == rl) &&
+		    !lookup->completing &&
+		    CFEqual(lookup->address, address)) {
+			return lookup;
+		}
+	}
+
+	return NULL;
+}
+
+
+__private_extern__
+primary_ptr_query_t
+primary_ptr_query_start(CFStringRef			address,
+			CFRunLoopRef			rl,
+			primary_ptr_query_callback_t	callback,
+			void				*context)
+{
+	Boolean			found;
+	CFArrayRef		hosts;
+	ptr_lookupRef		lookup;
+	primary_ptr_query_t	query;
+
+	primary_check();
+
+	hosts = ptr_cache_copy(address, &found);
+	if (found) {
+		// if we already know the answer, report it (from the run loop)
+		my_log(LOG_INFO, "ptr query answered from cache (%@)", address);
+
+		query = calloc(1, sizeof(*query));
+		query->callback = callback;
+		query->context = context;
+		CFRunLoopPerformBlock(rl, kCFRunLoopDefaultMode, ^{
+			if (query->callback != NULL) {
+				(*query->callback)(hosts, query->context);
+			}
+			if (hosts != NULL) CFRelease(hosts);
+			free(query);
+		});
+		CFRunLoopWakeUp(rl);
+		return query;
+	}
+
+	// join an in-progress query for the same address (or start a new one)
+	lookup = ptr_lookup_find(address, rl);
+	if (lookup == NULL) {
+		lookup = ptr_lookup_start(address, rl);
+		if (lookup == NULL) {
+			return NULL;
+		}
+	}
+
+	query = calloc(1, sizeof(*query));
+	query->lookup = lookup;
+	query->callback = callback;
+	query->context = context;
+	LIST_INSERT_HEAD(&lookup->queries, query, link);
+
+	return query;
+}
+
+
+__private_extern__
+void
+primary_ptr_query_cancel(primary_ptr_query_t query)
+{
+	ptr_lookupRef	lookup	= query->lookup;
+
+	if (lookup == NULL) {
+		// if answered from the cache (the pending callout will free the query)
+		query->callback = NULL;
+		return;
+	}
+
+	LIST_REMOVE(query, link);
+	free(query);
+
+	if (LIST_EMPTY(&lookup->queries) && !lookup->completing) {
+		// if no one else is waiting for the answer
+		ptr_lookup_free(lookup);
+	}
+
+	return;
+}
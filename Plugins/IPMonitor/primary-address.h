@@ -0,0 +1,65 @@
+/*
+ * Copyright (c) 2018 Apple Inc. All rights reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+
+#ifndef _PRIMARY_ADDRESS_H
+#define _PRIMARY_ADDRESS_H
+
+#include <TargetConditionals.h>
+#include <sys/cdefs.h>
+#include <CoreFoundation/CoreFoundation.h>
+#include <SystemConfiguration/SystemConfiguration.h>
+
+
+typedef struct __primary_ptr_query *	primary_ptr_query_t;
+
+/*
+ * primary_ptr_query_callback_t
+ *   called (once) when a reverse DNS query completes.  The "hosts" array
+ *   contains the resolved names, NULL if the address could not be resolved.
+ *   Once called, the query has been released and must not be cancelled.
+ */
+typedef void (*primary_ptr_query_callback_t)(CFArrayRef		hosts,
+					     void		*context);
+
+
+__BEGIN_DECLS
+
+CFStringRef
+primary_service_copy		(SCDynamicStoreRef		store);
+
+CFStringRef
+primary_address_copy		(SCDynamicStoreRef		store,
+				 CFStringRef			serviceID);
+
+primary_ptr_query_t
+primary_ptr_query_start		(CFStringRef			address,
+				 CFRunLoopRef			rl,
+				 primary_ptr_query_callback_t	callback,
+				 void				*context);
+
+void
+primary_ptr_query_cancel	(primary_ptr_query_t		query);
+
+__END_DECLS
+
+#endif /* _PRIMARY_ADDRESS_H */
@@ -29,6 +29,7 @@
  */
 
 #include <TargetConditionals.h>
+#include <stdlib.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <net/if.h>
@@ -50,57 +51,117 @@
 CFBooleanRef	G_supplemental_proxies_follow_dns	= NULL;
 
 
+/*
+ * S_supplemental_fragments
+ *   [serviceID] --> { FRAGMENT_INPUT_KEY  : proxy configuration (w/DNS match domains)
+ *		       FRAGMENT_ORDER_KEY  : default match order
+ *		       FRAGMENT_PROXIES_KEY: expanded supplemental proxies }
+ *
+ * The expanded supplemental proxies for each service are retained across
+ * updates and only re-computed when the service's proxy configuration
+ * (or its default match order) changes.
+ */
+static CFDictionaryRef	S_supplemental_fragments		= NULL;
+
+#define FRAGMENT_INPUT_KEY	CFSTR("input")
+#define FRAGMENT_ORDER_KEY	CFSTR("order")
+#define FRAGMENT_PROXIES_KEY	CFSTR("proxies")
+
+
+/*
+ * S_sorted_inputs, S_sorted_proxies, S_sorted_order_added
+ *
+ * The merged and sorted list of proxies (and the supplemental fragments /
+ * default proxy it was built from).  When none of the fragments (nor the
+ * default proxy) have changed the list is reused rather than being merged
+ * and sorted again.
+ */
+static CFArrayRef	S_sorted_inputs				= NULL;
+static CFArrayRef	S_sorted_proxies			= NULL;
+static Boolean		S_sorted_order_added			= FALSE;
+
+
+/*
+ * The proxies already added to the list are tracked in a set so that the
+ * duplicate check (CFEqual) is a hashed lookup.  CFHash() of a dictionary
+ * is just its count so the match domain is mixed in.
+ */
+static CFHashCode
+proxy_hash(const void *value)
+{
+	CFStringRef	domain;
+	CFHashCode	hash;
+	CFDictionaryRef	proxy	= (CFDictionaryRef)value;
+
+	hash = CFDictionaryGetCount(proxy);
+	domain = CFDictionaryGetValue(proxy, kSCPropNetProxiesSupplementalMatchDomain);
+	if (domain != NULL) {
+		hash ^= CFHash(domain);
+	}
+
+	return hash;
+}
+
+
+static CFMutableSetRef
+proxy_set_create(void)
+{
+	CFSetCallBacks	callbacks	= kCFTypeSetCallBacks;
+
+	callbacks.hash = proxy_hash;
+	return CFSetCreateMutable(NULL, 0, &callbacks);
+}
+
+
 static void
-add_proxy(CFMutableArrayRef proxies, CFMutableDictionaryRef proxy)
+add_proxy(CFMutableArrayRef proxies, CFMutableSetRef added, CFMutableDictionaryRef proxy)
 {
-	CFIndex		i;
 	CFIndex		n_proxies;
 	CFNumberRef	order;
 
-	n_proxies = CFArrayGetCount(proxies);
-	for (i = 0; i < n_proxies; i++) {
-		CFDictionaryRef		match_proxy;
-
-		match_proxy = CFArrayGetValueAtIndex(proxies, i);
-		if (CFEqual(proxy, match_proxy)) {
-			// a real duplicate
-			return;
-		}
+	if (CFSetContainsValue(added, proxy)) {
+		// a real duplicate
+		return;
 	}
 
+	n_proxies = CFArrayGetCount(proxies);
 	order = CFNumberCreate(NULL, kCFNumberCFIndexType, &n_proxies);
 	CFDictionarySetValue(proxy, ORDER_KEY, order);
 	CFRelease(order);
 
 	CFArrayAppendValue(proxies, proxy);
+	CFSetAddValue(added, proxy);
 	return;
 }
 
 
-static void
-add_supplemental(CFMutableArrayRef proxies, CFDictionaryRef proxy, uint32_t defaultOrder)
+static CFArrayRef
+copy_supplemental_fragment(CFDictionaryRef proxy, uint32_t defaultOrder)
 {
-	CFArrayRef	domains;
-	CFIndex		i;
-	CFIndex		n_domains;
-	CFArrayRef	orders;
+	CFArrayRef		domains;
+	CFMutableArrayRef	fragment;
+	CFIndex			i;
+	CFIndex			n_domains;
+	CFArrayRef		orders;
+
+	fragment = CFArrayCreateMutable(NULL, 0, &kCFTypeArrayCallBacks);
 
 	domains = CFDictionaryGetValue(proxy, kSCPropNetProxiesSupplementalMatchDomains);
 	n_domains = isA_CFArray(domains) ? CFArrayGetCount(domains) : 0;
 	if (n_domains == 0) {
-		return;
+		return fragment;
 	}
 
 	orders = CFDictionaryGetValue(proxy, kSCPropNetProxiesSupplementalMatchOrders);
 	if (orders != NULL) {
 		if (!isA_CFArray(orders) || (n_domains != CFArrayGetCount(orders))) {
-			return;
+			return fragment;
 		}
 	}
 
 	/*
 	 * yes, this is a "supplemental" proxy configuration, expand
-	 * the match domains and add each to the proxies list.
+	 * the match domains and add each to the fragment.
 	 */
 	for (i = 0; i < n_domains; i++) {
 		CFStringRef		match_domain;
@@ -142,7 +203,76 @@ add_supplemental(CFMutableArrayRef proxies, CFDictionaryRef proxy, uint32_t defa
 		CFDictionaryRemoveValue(match_proxy, kSCPropNetProxiesSupplementalMatchOrders);
 		CFDictionaryRemoveValue(match_proxy, kSCPropInterfaceName);
 
-		add_proxy(proxies, match_proxy);
+		CFArrayAppendValue(fragment, match_proxy);
+		CFRelease(match_proxy);
+	}
+
+	return fragment;
+}
+
+
+static CFArrayRef
+copy_cached_supplemental_fragment(CFMutableDictionaryRef	fragments,
+				  CFStringRef			serviceID,
+				  CFDictionaryRef		proxy,
+				  uint32_t			defaultOrder)
+{
+	CFDictionaryRef		cached		= NULL;
+	CFArrayRef		fragment;
+	CFNumberRef		order;
+	const void *		keys[3];
+	const void *		vals[3];
+
+	order = CFNumberCreate(NULL, kCFNumberIntType, &defaultOrder);
+
+	if (S_supplemental_fragments != NULL) {
+		cached = CFDictionaryGetValue(S_supplemental_fragments, serviceID);
+	}
+	if ((cached != NULL) &&
+	    CFEqual(order, CFDictionaryGetValue(cached, FRAGMENT_ORDER_KEY)) &&
+	    CFEqual(proxy, CFDictionaryGetValue(cached, FRAGMENT_INPUT_KEY))) {
+		// if the service's proxy configuration has not changed
+		fragment = CFDictionaryGetValue(cached, FRAGMENT_PROXIES_KEY);
+		CFRetain(fragment);
+		CFDictionarySetValue(fragments, serviceID, cached);
+		CFRelease(order);
+		return fragment;
+	}
+
+	fragment = copy_supplemental_fragment(proxy, defaultOrder);
+
+	keys[0] = FRAGMENT_INPUT_KEY;
+	vals[0] = proxy;
+	keys[1] = FRAGMENT_ORDER_KEY;
+	vals[1] = order;
+	keys[2] = FRAGMENT_PROXIES_KEY;
+	vals[2] = fragment;
+	cached = CFDictionaryCreate(NULL,
+				    keys,
+				    vals,
+				    sizeof(keys) / sizeof(keys[0]),
+				    &kCFTypeDictionaryKeyCallBacks,
+				    &kCFTypeDictionaryValueCallBacks);
+	CFDictionarySetValue(fragments, serviceID, cached);
+	CFRelease(cached);
+	CFRelease(order);
+
+	return fragment;
+}
+
+
+static void
+add_supplemental(CFMutableArrayRef proxies, CFMutableSetRef added, CFArrayRef fragment)
+{
+	CFIndex		i;
+	CFIndex		n;
+
+	n = CFArrayGetCount(fragment);
+	for (i = 0; i < n; i++) {
+		CFMutableDictionaryRef	match_proxy;
+
+		match_proxy = CFDictionaryCreateMutableCopy(NULL, 0, CFArrayGetValueAtIndex(fragment, i));
+		add_proxy(proxies, added, match_proxy);
 		CFRelease(match_proxy);
 	}
 
@@ -153,20 +283,52 @@ add_supplemental(CFMutableArrayRef proxies, CFDictionaryRef proxy, uint32_t defa
 #define	N_QUICK	32
 
 
-static void
-add_supplemental_proxies(CFMutableArrayRef proxies, CFDictionaryRef services, CFArrayRef service_order)
+static CFSetRef
+service_order_copy_set(CFArrayRef service_order)
 {
+	CFIndex			i;
+	CFIndex			n_order;
+	CFMutableSetRef		ordered;
+
+	n_order = CFArrayGetCount(service_order);
+	ordered = CFSetCreateMutable(NULL, n_order, &kCFTypeSetCallBacks);
+	for (i = 0; i < n_order; i++) {
+		CFSetAddValue(ordered, CFArrayGetValueAtIndex(service_order, i));
+	}
+
+	return ordered;
+}
+
+
+/*
+ * copy_supplemental_fragments
+ *
+ * Returns the (cached, when unchanged) expanded supplemental proxies of
+ * each service, in the order that they should be merged.
+ */
+static CFMutableArrayRef
+copy_supplemental_fragments(CFDictionaryRef services, CFArrayRef service_order)
+{
+	CFMutableDictionaryRef	fragments;
+	CFMutableArrayRef	merge;
 	const void *		keys_q[N_QUICK];
 	const void **		keys	= keys_q;
 	CFIndex			i;
 	CFIndex			n_order;
 	CFIndex			n_services;
+	CFSetRef		ordered	= NULL;
 	const void *		vals_q[N_QUICK];
 	const void **		vals	= vals_q;
 
+	merge = CFArrayCreateMutable(NULL, 0, &kCFTypeArrayCallBacks);
+	fragments = CFDictionaryCreateMutable(NULL,
+					      0,
+					      &kCFTypeDictionaryKeyCallBacks,
+					      &kCFTypeDictionaryValueCallBacks);
+
 	n_services = isA_CFDictionary(services) ? CFDictionaryGetCount(services) : 0;
 	if (n_services == 0) {
-		return;		// if no services
+		goto done;	// if no services
 	}
 
 	if (n_services > (CFIndex)(sizeof(keys_q) / sizeof(CFTypeRef))) {
@@ -175,10 +337,14 @@ add_supplemental_proxies(CFMutableArrayRef proxies, CFDictionaryRef services, CF
 	}
 
 	n_order = isA_CFArray(service_order) ? CFArrayGetCount(service_order) : 0;
+	if (n_order > 0) {
+		ordered = service_order_copy_set(service_order);
+	}
 
 	CFDictionaryGetKeysAndValues(services, keys, vals);
 	for (i = 0; i < n_services; i++) {
 		uint32_t		defaultOrder;
+		CFArrayRef		fragment;
 		CFDictionaryRef		proxy;
 		CFMutableDictionaryRef	proxyWithDNS	= NULL;
 		CFDictionaryRef		service		= (CFDictionaryRef)vals[i];
@@ -217,67 +383,105 @@ add_supplemental_proxies(CFMutableArrayRef proxies, CFDictionaryRef services, CF
 		defaultOrder = DEFAULT_MATCH_ORDER
 			       - (DEFAULT_MATCH_ORDER / 2)
 			       + ((DEFAULT_MATCH_ORDER / 1000) * (uint32_t)i);
-		if ((n_order > 0) &&
-		    !CFArrayContainsValue(service_order, CFRangeMake(0, n_order), keys[i])) {
+		if ((ordered != NULL) &&
+		    !CFSetContainsValue(ordered, keys[i])) {
 			// push out services not specified in service order
 			defaultOrder += (DEFAULT_MATCH_ORDER / 1000) * n_services;
 		}
 
-		add_supplemental(proxies, proxy, defaultOrder);
+		fragment = copy_cached_supplemental_fragment(fragments, keys[i], proxy, defaultOrder);
+		CFArrayAppendValue(merge, fragment);
+		CFRelease(fragment);
 		if (proxyWithDNS != NULL) CFRelease(proxyWithDNS);
 	}
 
+	if (ordered != NULL) {
+		CFRelease(ordered);
+	}
+
 	if (keys != keys_q) {
 		CFAllocatorDeallocate(NULL, keys);
 		CFAllocatorDeallocate(NULL, vals);
 	}
 
-	return;
+    done :
+
+	// retain only the fragments for the current services
+	if (S_supplemental_fragments != NULL) {
+		CFRelease(S_supplemental_fragments);
+	}
+	S_supplemental_fragments = fragments;
+
+	return merge;
 }
 
 
-static CFComparisonResult
-compareBySearchOrder(const void *val1, const void *val2, void *context)
+/*
+ * proxySortKey
+ *
+ * The per-proxy values needed to sort the proxies, derived once (rather
+ * than on each comparison).
+ */
+typedef struct {
+	CFDictionaryRef		proxy;
+	CFStringRef		domain;		// NULL if "default" proxy
+	Boolean			reverse;	// if PTR (".arpa") domain
+	CFArrayRef		labels;		// domain labels
+	uint32_t		match_order;
+	Boolean			has_order;
+	uint32_t		order;
+	CFIndex			index;		// position before sorting
+} proxySortKey, *proxySortKeyRef;
+
+
+static void
+proxySortKeyInit(proxySortKeyRef key, CFDictionaryRef proxy, CFIndex index)
 {
-#pragma unused(context)
-	CFDictionaryRef	proxy1	= (CFDictionaryRef)val1;
-	CFDictionaryRef	proxy2	= (CFDictionaryRef)val2;
-	CFNumberRef	num1;
-	CFNumberRef	num2;
-	uint32_t	order1	= DEFAULT_MATCH_ORDER;
-	uint32_t	order2	= DEFAULT_MATCH_ORDER;
+	CFNumberRef	num;
+
+	bzero(key, sizeof(*key));
+	key->proxy = proxy;
+	key->index = index;
 
-	num1 = CFDictionaryGetValue(proxy1, PROXY_MATCH_ORDER_KEY);
-	if (!isA_CFNumber(num1) ||
-	    !CFNumberGetValue(num1, kCFNumberSInt32Type, &order1)) {
-		order1 = DEFAULT_MATCH_ORDER;
+	key->domain = CFDictionaryGetValue(proxy, kSCPropNetProxiesSupplementalMatchDomain);
+	if (key->domain != NULL) {
+		key->reverse = CFStringHasSuffix(key->domain, CFSTR(".arpa"));
+		key->labels = CFStringCreateArrayBySeparatingStrings(NULL, key->domain, CFSTR("."));
 	}
 
-	num2 = CFDictionaryGetValue(proxy2, PROXY_MATCH_ORDER_KEY);
-	if (!isA_CFNumber(num2) ||
-	    !CFNumberGetValue(num2, kCFNumberSInt32Type, &order2)) {
-		order2 = DEFAULT_MATCH_ORDER;
+	num = CFDictionaryGetValue(proxy, PROXY_MATCH_ORDER_KEY);
+	if (!isA_CFNumber(num) ||
+	    !CFNumberGetValue(num, kCFNumberSInt32Type, &key->match_order)) {
+		key->match_order = DEFAULT_MATCH_ORDER;
 	}
 
-	if (order1 == order2) {
+	num = CFDictionaryGetValue(proxy, ORDER_KEY);
+	if (isA_CFNumber(num) &&
+	    CFNumberGetValue(num, kCFNumberSInt32Type, &key->order)) {
+		key->has_order = TRUE;
+	}
+
+	return;
+}
+
+
+static CFComparisonResult
+compareBySearchOrder(proxySortKeyRef key1, proxySortKeyRef key2)
+{
+	if (key1->match_order == key2->match_order) {
 		// if same match "order", retain original ordering for configurations
-		if (CFDictionaryGetValueIfPresent(proxy1, ORDER_KEY, (const void **)&num1) &&
-		    CFDictionaryGetValueIfPresent(proxy2, ORDER_KEY, (const void **)&num2) &&
-		    isA_CFNumber(num1) &&
-		    isA_CFNumber(num2) &&
-		    CFNumberGetValue(num1, kCFNumberSInt32Type, &order1) &&
-		    CFNumberGetValue(num2, kCFNumberSInt32Type, &order2)) {
-			if (order1 == order2) {
+		if (key1->has_order && key2->has_order) {
+			if (key1->order == key2->order) {
 				return kCFCompareEqualTo;
 			} else {
-				return (order1 < order2) ? kCFCompareLessThan : kCFCompareGreaterThan;
+				return (key1->order < key2->order) ? kCFCompareLessThan : kCFCompareGreaterThan;
 			}
 		}
 
 		return kCFCompareEqualTo;
 	}
 
-	return (order1 < order2) ? kCFCompareLessThan : kCFCompareGreaterThan;
+	return (key1->match_order < key2->match_order) ? kCFCompareLessThan : kCFCompareGreaterThan;
 }
 
 
@@ -335,6 +539,7 @@ service_order_copy_all(CFDictionaryRef services, CFArrayRef service_order)
 	CFIndex			n_order;
 	CFIndex			n_services;
 	CFMutableArrayRef	order;
+	CFSetRef		ordered;
 
 	// ensure that we process all services in order
 	n_services = isA_CFDictionary(services) ? CFDictionaryGetCount(services) : 0;
@@ -348,8 +553,10 @@ service_order_copy_all(CFDictionaryRef services, CFArrayRef service_order)
 	n_order = isA_CFArray(service_order) ? CFArrayGetCount(service_order) : 0;
 	if (n_order > 0) {
 		order = CFArrayCreateMutableCopy(NULL, 0, service_order);
+		ordered = service_order_copy_set(service_order);
 	} else {
 		order = CFArrayCreateMutable(NULL, 0, &kCFTypeArrayCallBacks);
+		ordered = CFSetCreateMutable(NULL, 0, &kCFTypeSetCallBacks);
 	}
 
 	if (n_services > (CFIndex)(sizeof(keys_q) / sizeof(CFTypeRef))) {
@@ -359,14 +566,15 @@ service_order_copy_all(CFDictionaryRef services, CFArrayRef service_order)
 	for (i = 0; i < n_services; i++) {
 		CFStringRef	serviceID	= (CFStringRef)keys[i];
 
-		if (!CFArrayContainsValue(order, CFRangeMake(0, n_order), serviceID)) {
+		if (!CFSetContainsValue(ordered, serviceID)) {
 			CFArrayAppendValue(order, serviceID);
-			n_order++;
+			CFSetAddValue((CFMutableSetRef)ordered, serviceID);
 		}
 	}
 	if (keys != keys_q) {
 		CFAllocatorDeallocate(NULL, keys);
 	}
+	CFRelease(ordered);
 
 	return order;
 }
@@ -520,10 +728,8 @@ copy_scoped_proxies(CFDictionaryRef services, CFArrayRef order)
 }
 
 
-static void
-add_default_proxy(CFMutableArrayRef	proxies,
-		  CFDictionaryRef	defaultProxy,
-		  Boolean		*orderAdded)
+static CFMutableDictionaryRef
+copy_default_proxy(CFDictionaryRef defaultProxy, Boolean *orderAdded)
 {
 	CFMutableDictionaryRef	myDefault;
 	uint32_t		myOrder	= DEFAULT_MATCH_ORDER;
@@ -551,122 +757,197 @@ add_default_proxy(CFMutableArrayRef	proxies,
 		*orderAdded = TRUE;
 	}
 
-	// add the default proxy
-
-	add_proxy(proxies, myDefault);
-	CFRelease(myDefault);
-	return;
+	return myDefault;
 }
 
 
 static CFComparisonResult
-compareDomain(const void *val1, const void *val2, void *context)
+compareDomain(proxySortKeyRef key1, proxySortKeyRef key2)
 {
-	CFDictionaryRef		proxy1	= (CFDictionaryRef)val1;
-	CFDictionaryRef		proxy2	= (CFDictionaryRef)val2;
-	CFStringRef		domain1;
-	CFStringRef		domain2;
-	CFArrayRef		labels1	= NULL;
-	CFArrayRef		labels2	= NULL;
 	CFIndex			n1;
 	CFIndex			n2;
 	CFComparisonResult	result;
-	Boolean			rev1;
-	Boolean			rev2;
 
 	// "default" domains sort before "supplemental" domains
-	domain1 = CFDictionaryGetValue(proxy1, kSCPropNetProxiesSupplementalMatchDomain);
-	domain2 = CFDictionaryGetValue(proxy2, kSCPropNetProxiesSupplementalMatchDomain);
-	if (domain1 == NULL) {
-		if (domain2 == NULL) {
+	if (key1->domain == NULL) {
+		if (key2->domain == NULL) {
 			return kCFCompareEqualTo;
 		}
 		return kCFCompareLessThan;
-	} else if (domain2 == NULL) {
+	} else if (key2->domain == NULL) {
 		return kCFCompareGreaterThan;
 	}
 
 	// forward (A, AAAA) domains sort before reverse (PTR) domains
-	rev1 = CFStringHasSuffix(domain1, CFSTR(".arpa"));
-	rev2 = CFStringHasSuffix(domain2, CFSTR(".arpa"));
-	if (rev1 != rev2) {
-		if (rev1) {
+	if (key1->reverse != key2->reverse) {
+		if (key1->reverse) {
 			return kCFCompareGreaterThan;
 		} else {
 			return kCFCompareLessThan;
 		}
 	}
 
-	labels1 = CFStringCreateArrayBySeparatingStrings(NULL, domain1, CFSTR("."));
-	n1 = CFArrayGetCount(labels1);
-
-	labels2 = CFStringCreateArrayBySeparatingStrings(NULL, domain2, CFSTR("."));
-	n2 = CFArrayGetCount(labels2);
+	n1 = CFArrayGetCount(key1->labels);
+	n2 = CFArrayGetCount(key2->labels);
 
 	while ((n1 > 0) && (n2 > 0)) {
-		CFStringRef	label1	= CFArrayGetValueAtIndex(labels1, --n1);
-		CFStringRef	label2	= CFArrayGetValueAtIndex(labels2, --n2);
+		CFStringRef	label1	= CFArrayGetValueAtIndex(key1->labels, --n1);
+		CFStringRef	label2	= CFArrayGetValueAtIndex(key2->labels, --n2);
 
 		// compare domain labels
 		result = CFStringCompare(label1, label2, kCFCompareCaseInsensitive);
 		if (result != kCFCompareEqualTo) {
-			goto done;
+			return result;
 		}
 	}
 
 	// longer labels (corp.apple.com) sort before shorter labels (apple.com)
 	if (n1 > n2) {
-		result = kCFCompareLessThan;
-		goto done;
+		return kCFCompareLessThan;
 	} else if (n1 < n2) {
-		result = kCFCompareGreaterThan;
-		goto done;
+		return kCFCompareGreaterThan;
 	}
 
 	// sort by search order
-	result = compareBySearchOrder(val1, val2, context);
+	return compareBySearchOrder(key1, key2);
+}
 
-    done :
 
-	if (labels1 != NULL) CFRelease(labels1);
-	if (labels2 != NULL) CFRelease(labels2);
+static int
+compareProxySortKeys(const void *val1, const void *val2)
+{
+	proxySortKeyRef		key1	= (proxySortKeyRef)val1;
+	proxySortKeyRef		key2	= (proxySortKeyRef)val2;
+	CFComparisonResult	result;
+
+	result = compareDomain(key1, key2);
+	if ((result == kCFCompareEqualTo) && (key1->index != key2->index)) {
+		// retain the original ordering (a stable sort, like CFArraySortValues)
+		result = (key1->index < key2->index) ? kCFCompareLessThan : kCFCompareGreaterThan;
+	}
+
 	return result;
 }
 
 
-__private_extern__
-CF_RETURNS_RETAINED CFDictionaryRef
-proxy_configuration_update(CFDictionaryRef	defaultProxy,
-			   CFDictionaryRef	services,
-			   CFArrayRef		serviceOrder,
-			   CFDictionaryRef	servicesInfo)
+static void
+sort_proxies(CFMutableArrayRef proxies)
+{
+	CFIndex		i;
+	proxySortKeyRef	keys;
+	CFIndex		n_proxies;
+	CFArrayRef	unsorted;
+
+	n_proxies = CFArrayGetCount(proxies);
+	if (n_proxies <= 1) {
+		return;
+	}
+
+	// derive the sort keys (once) for each proxy
+	unsorted = CFArrayCreateCopy(NULL, proxies);
+	keys = CFAllocatorAllocate(NULL, n_proxies * sizeof(proxySortKey), 0);
+	for (i = 0; i < n_proxies; i++) {
+		proxySortKeyInit(&keys[i], CFArrayGetValueAtIndex(unsorted, i), i);
+	}
+
+	// ... sort
+	qsort(keys, n_proxies, sizeof(proxySortKey), compareProxySortKeys);
+
+	// ... and replace the proxies with the sorted list
+	CFArrayRemoveAllValues(proxies);
+	for (i = 0; i < n_proxies; i++) {
+		CFArrayAppendValue(proxies, keys[i].proxy);
+		if (keys[i].labels != NULL) CFRelease(keys[i].labels);
+	}
+	CFAllocatorDeallocate(NULL, keys);
+	CFRelease(unsorted);
+
+	return;
+}
+
+
+static CFMutableArrayRef
+copy_sorted_proxies(CFDictionaryRef	defaultProxy,
+		    CFDictionaryRef	services,
+		    CFArrayRef		serviceOrder,
+		    Boolean		*orderAdded)
 {
+	CFMutableSetRef		added;
 	CFIndex			i;
+	CFMutableArrayRef	inputs;
 	CFMutableDictionaryRef	myDefault;
-	Boolean			myOrderAdded	= FALSE;
-	CFMutableDictionaryRef	newProxy	= NULL;
-	CFIndex			n_proxies;
-	CFDictionaryRef		proxy;
+	CFIndex			n;
 	CFMutableArrayRef	proxies;
 
+	// collect the "supplemental" proxy configurations (and the "default" proxy)
+
+	inputs = copy_supplemental_fragments(services, serviceOrder);
+	if (defaultProxy != NULL) {
+		CFDictionaryRef	copy;
+
+		copy = CFDictionaryCreateCopy(NULL, defaultProxy);
+		CFArrayAppendValue(inputs, copy);
+		CFRelease(copy);
+	} else {
+		CFArrayAppendValue(inputs, kCFNull);
+	}
+
+	if ((S_sorted_inputs != NULL) && CFEqual(inputs, S_sorted_inputs)) {
+		// if nothing has changed, use the previously merged/sorted proxies
+		CFRelease(inputs);
+		*orderAdded = S_sorted_order_added;
+		return CFArrayCreateMutableCopy(NULL, 0, S_sorted_proxies);
+	}
+
 	// establish full list of proxies
 
 	proxies = CFArrayCreateMutable(NULL, 0, &kCFTypeArrayCallBacks);
+	added = proxy_set_create();
 
-	// collect (and add) any "supplemental" proxy configurations
+	// add any "supplemental" proxy configurations
 
-	add_supplemental_proxies(proxies, services, serviceOrder);
+	n = CFArrayGetCount(inputs) - 1;
+	for (i = 0; i < n; i++) {
+		add_supplemental(proxies, added, CFArrayGetValueAtIndex(inputs, i));
+	}
 
 	// add the "default" proxy
 
-	add_default_proxy(proxies, defaultProxy, &myOrderAdded);
+	*orderAdded = FALSE;
+	myDefault = copy_default_proxy(defaultProxy, orderAdded);
+	add_proxy(proxies, added, myDefault);
+	CFRelease(myDefault);
+	CFRelease(added);
+
+	// sort proxies
+
+	sort_proxies(proxies);
+
+	// ... and remember the result
+	if (S_sorted_inputs != NULL) CFRelease(S_sorted_inputs);
+	S_sorted_inputs = inputs;
+	if (S_sorted_proxies != NULL) CFRelease(S_sorted_proxies);
+	S_sorted_proxies = CFArrayCreateCopy(NULL, proxies);
+	S_sorted_order_added = *orderAdded;
+
+	return proxies;
+}
 
-	// sort proxies, cleanup
+
+static CFDictionaryRef
+copy_proxy_configuration(CFMutableArrayRef	proxies,
+			 Boolean		myOrderAdded,
+			 CFDictionaryRef	services,
+			 CFArrayRef		serviceOrder,
+			 CFDictionaryRef	servicesInfo)
+{
+	CFIndex			i;
+	CFMutableDictionaryRef	myDefault;
+	CFMutableDictionaryRef	newProxy	= NULL;
+	CFIndex			n_proxies;
+	CFDictionaryRef		proxy;
 
 	n_proxies = CFArrayGetCount(proxies);
-	if (n_proxies > 1) {
-		CFArraySortValues(proxies, CFRangeMake(0, n_proxies), compareDomain, NULL);
-	}
 
 	// cleanup
 
@@ -762,6 +1043,28 @@ proxy_configuration_update(CFDictionaryRef	defaultProxy,
 		newProxy = NULL;
 	}
 
+	return newProxy;
+}
+
+
+__private_extern__
+CF_RETURNS_RETAINED CFDictionaryRef
+proxy_configuration_update(CFDictionaryRef	defaultProxy,
+			   CFDictionaryRef	services,
+			   CFArrayRef		serviceOrder,
+			   CFDictionaryRef	servicesInfo)
+{
+	Boolean			myOrderAdded	= FALSE;
+	CFDictionaryRef		newProxy;
+	CFMutableArrayRef	proxies;
+
+	// establish the full (sorted) list of proxies
+
+	proxies = copy_sorted_proxies(defaultProxy, services, serviceOrder, &myOrderAdded);
+
+	// cleanup, establish proxy configuration
+
+	newProxy = copy_proxy_configuration(proxies, myOrderAdded, services, serviceOrder, servicesInfo);
 	CFRelease(proxies);
 	return newProxy;
 }
@@ -976,7 +1279,19 @@ main(int argc, char **argv)
 					      service_order,
 					      NULL);
 	if (newProxy != NULL) {
+		CFDictionaryRef	cachedProxy;
+
 		SCPrint(TRUE, stdout, CFSTR("%@\n"), newProxy);
+
+		// update again (using the cached supplemental proxies) and compare
+		cachedProxy = proxy_configuration_update(primary_proxy,
+							 service_state_dict,
+							 service_order,
+							 NULL);
+		if (!_SC_CFEqual(newProxy, cachedProxy)) {
+			SCPrint(TRUE, stdout, CFSTR("*** cached proxy configuration differs ***\n%@\n"), cachedProxy);
+		}
+		if (cachedProxy != NULL) CFRelease(cachedProxy);
 		CFRelease(newProxy);
 	}
 
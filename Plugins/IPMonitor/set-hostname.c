@@ -41,6 +41,8 @@
 
 #include <notify.h>
 
+#include "primary-address.h"
+
 #ifdef	MAIN
 #define	my_log(__level, __format, ...)	SCPrint(TRUE, stdout, CFSTR(__format "\n"), ## __VA_ARGS__)
 #else	// MAIN
@@ -54,8 +56,7 @@ static dispatch_queue_t		queue		= NULL;
 
 static int			notify_token	= -1;
 
-static struct timeval		ptrQueryStart;
-static SCNetworkReachabilityRef	ptrTarget	= NULL;
+static primary_ptr_query_t	ptrQuery	= NULL;
 
 
 #define	HOSTNAME_NOTIFY_KEY	"com.apple.system.hostname"
@@ -144,83 +145,17 @@ copy_prefs_hostname(SCDynamicStoreRef store)
 }
 
 
-static CFStringRef
-copy_primary_service(SCDynamicStoreRef store)
-{
-	CFDictionaryRef	dict;
-	CFStringRef	key;
-	CFStringRef	serviceID	= NULL;
-
-	key = SCDynamicStoreKeyCreateNetworkGlobalEntity(NULL,
-							 kSCDynamicStoreDomainState,
-							 kSCEntNetIPv4);
-	dict = SCDynamicStoreCopyValue(store, key);
-	CFRelease(key);
-
-	if (dict != NULL) {
-		if (isA_CFDictionary(dict)) {
-			serviceID = CFDictionaryGetValue(dict, kSCDynamicStorePropNetPrimaryService);
-			if (isA_CFString(serviceID)) {
-				CFRetain(serviceID);
-			} else {
-				serviceID = NULL;
-			}
-		}
-		CFRelease(dict);
-	}
-
-	return serviceID;
-}
-
-
-static CFStringRef
-copy_primary_ip(SCDynamicStoreRef store, CFStringRef serviceID)
-{
-	CFDictionaryRef	dict;
-	CFStringRef	key;
-	CFStringRef	address	= NULL;
-
-	key = SCDynamicStoreKeyCreateNetworkServiceEntity(NULL,
-							  kSCDynamicStoreDomainState,
-							  serviceID,
-							  kSCEntNetIPv4);
-	dict = SCDynamicStoreCopyValue(store, key);
-	CFRelease(key);
-
-	if (dict != NULL) {
-		if (isA_CFDictionary(dict)) {
-			CFArrayRef	addresses;
-
-			addresses = CFDictionaryGetValue(dict, kSCPropNetIPv4Addresses);
-			if (isA_CFArray(addresses) && (CFArrayGetCount(addresses) > 0)) {
-				address = CFArrayGetValueAtIndex(addresses, 0);
-				if (isA_CFString(address)) {
-					CFRetain(address);
-				} else {
-					address = NULL;
-				}
-			}
-		}
-		CFRelease(dict);
-	}
-
-	return address;
-}
-
-
 static void
 ptr_query_stop()
 {
-	if (ptrTarget == NULL) {
+	if (ptrQuery == NULL) {
 		return;
 	}
 
 	my_log(LOG_INFO, "hostname: ptr query stop");
 
-	SCNetworkReachabilitySetCallback(ptrTarget, NULL, NULL);
-	SCNetworkReachabilityUnscheduleFromRunLoop(ptrTarget, rl, kCFRunLoopDefaultMode);
-	CFRelease(ptrTarget);
-	ptrTarget = NULL;
+	primary_ptr_query_cancel(ptrQuery);
+	ptrQuery = NULL;
 
 	return;
 }
@@ -277,89 +212,54 @@ hostname_match_first_label(CFArrayRef hosts, CFIndex count, CFStringRef nameToMa
 
 
 static void
-ptr_query_callback(SCNetworkReachabilityRef target, SCNetworkReachabilityFlags flags, void *info)
+ptr_query_callback(CFArrayRef hosts, void *context)
 {
-#pragma unused(info)
+#pragma unused(context)
 	CFStringRef		hostname	= NULL;
-	struct timeval		ptrQueryComplete;
-	struct timeval		ptrQueryElapsed;
 
-	(void) gettimeofday(&ptrQueryComplete, NULL);
-	timersub(&ptrQueryComplete, &ptrQueryStart, &ptrQueryElapsed);
+	// the query has completed (and been released)
+	ptrQuery = NULL;
 
 	// use reverse DNS name, if available
 
-	if (flags & kSCNetworkReachabilityFlagsReachable) {
-		int		error_num;
-		CFArrayRef	hosts;
-
-		/*
-		 * if [reverse] DNS query was successful
-		 */
-		hosts = SCNetworkReachabilityCopyResolvedAddress(target, &error_num);
-		if (hosts != NULL) {
-			CFIndex count = CFArrayGetCount(hosts);
-			if (count > 0) {
-				CFStringRef	computerName;
-				CFStringRef	localHostName;
-
-				my_log(LOG_INFO, "hostname: ptr query complete (query time = %ld.%3.3d)",
-				       ptrQueryElapsed.tv_sec,
-				       ptrQueryElapsed.tv_usec / 1000);
-
-				// first, check if ComputerName is dns-clean
-				computerName = _SCPreferencesCopyComputerName(NULL, NULL);
-				if (computerName != NULL) {
-					if (_SC_CFStringIsValidDNSName(computerName)) {
-						CFRange	dotsCheck;
-
-						dotsCheck = CFStringFind(computerName, CFSTR("."), 0);
-						if (dotsCheck.length == 0) {
-							hostname = hostname_match_first_label(hosts, count, computerName);
-						} else {
-							hostname = hostname_match_full(hosts, count, computerName);
-						}
+	if (hosts != NULL) {
+		CFIndex count = CFArrayGetCount(hosts);
+		if (count > 0) {
+			CFStringRef	computerName;
+			CFStringRef	localHostName;
+
+			// first, check if ComputerName is dns-clean
+			computerName = _SCPreferencesCopyComputerName(NULL, NULL);
+			if (computerName != NULL) {
+				if (_SC_CFStringIsValidDNSName(computerName)) {
+					CFRange	dotsCheck;
+
+					dotsCheck = CFStringFind(computerName, CFSTR("."), 0);
+					if (dotsCheck.length == 0) {
+						hostname = hostname_match_first_label(hosts, count, computerName);
+					} else {
+						hostname = hostname_match_full(hosts, count, computerName);
 					}
-					CFRelease(computerName);
-				}
-
-				// if no match, check LocalHostName against the first label of FQDN
-				localHostName = (hostname == NULL) ? SCDynamicStoreCopyLocalHostName(store) : NULL;
-				if (localHostName != NULL) {
-					hostname = hostname_match_first_label(hosts, count, localHostName);
-					CFRelease(localHostName);
-				}
-
-				// if no match, use the first of the returned names
-				if (hostname == NULL) {
-					hostname = CFArrayGetValueAtIndex(hosts, 0);
 				}
+				CFRelease(computerName);
+			}
 
-				my_log(LOG_INFO, "hostname (reverse DNS query) = %@", hostname);
-				set_hostname(hostname);
-			} else {
-				my_log(LOG_INFO, "hostname: ptr query complete w/no hosts (query time = %ld.%3.3d)",
-				       ptrQueryElapsed.tv_sec,
-				       ptrQueryElapsed.tv_usec / 1000);
+			// if no match, check LocalHostName against the first label of FQDN
+			localHostName = (hostname == NULL) ? SCDynamicStoreCopyLocalHostName(store) : NULL;
+			if (localHostName != NULL) {
+				hostname = hostname_match_first_label(hosts, count, localHostName);
+				CFRelease(localHostName);
 			}
-			CFRelease(hosts);
 
-			if (hostname != NULL) {
-				goto done;
+			// if no match, use the first of the returned names
+			if (hostname == NULL) {
+				hostname = CFArrayGetValueAtIndex(hosts, 0);
 			}
-		} else {
-			// if kSCNetworkReachabilityFlagsReachable and hosts == NULL
-			// it means the PTR request has not come back yet
-			// we must wait for this callback to be called again
-			my_log(LOG_INFO, "hostname: ptr query reply w/no hosts (query time = %ld.%3.3d)",
-			       ptrQueryElapsed.tv_sec,
-			       ptrQueryElapsed.tv_usec / 1000);
-			return;
+
+			my_log(LOG_INFO, "hostname (reverse DNS query) = %@", hostname);
+			set_hostname(hostname);
+			goto done;
 		}
-	} else {
-		my_log(LOG_INFO, "hostname: ptr query complete, host not found (query time = %ld.%3.3d)",
-		       ptrQueryElapsed.tv_sec,
-		       ptrQueryElapsed.tv_usec / 1000);
 	}
 
 	// get local (multicast DNS) name, if available
@@ -385,8 +285,6 @@ ptr_query_callback(SCNetworkReachabilityRef target, SCNetworkReachabilityFlags f
 
     done :
 
-	ptr_query_stop();
-
 #ifdef	MAIN
 	CFRunLoopStop(rl);
 #endif	// MAIN
@@ -398,45 +296,10 @@ ptr_query_callback(SCNetworkReachabilityRef target, SCNetworkReachabilityFlags f
 static Boolean
 ptr_query_start(CFStringRef address)
 {
-	union {
-		struct sockaddr         sa;
-		struct sockaddr_in      sin;
-		struct sockaddr_in6     sin6;
-	} addr;
-	char				buf[64];
-	CFDataRef			data;
-	CFMutableDictionaryRef		options;
-
-	if (_SC_cfstring_to_cstring(address, buf, sizeof(buf), kCFStringEncodingASCII) == NULL) {
-		my_log(LOG_ERR, "could not convert [primary] address string");
-		return FALSE;
-	}
-
-	if (_SC_string_to_sockaddr(buf, AF_UNSPEC, (void *)&addr, sizeof(addr)) == NULL) {
-		my_log(LOG_ERR, "could not convert [primary] address");
-		return FALSE;
-	}
-
-	options = CFDictionaryCreateMutable(NULL,
-					    0,
-					    &kCFTypeDictionaryKeyCallBacks,
-					    &kCFTypeDictionaryValueCallBacks);
-	data = CFDataCreate(NULL, (const UInt8 *)&addr.sa, addr.sa.sa_len);
-	CFDictionarySetValue(options, kSCNetworkReachabilityOptionPTRAddress, data);
-	CFRelease(data);
-	ptrTarget = SCNetworkReachabilityCreateWithOptions(NULL, options);
-	CFRelease(options);
-	if (ptrTarget == NULL) {
-		my_log(LOG_ERR, "could not resolve [primary] address");
-		return FALSE;
-	}
-
 	my_log(LOG_INFO, "hostname: ptr query start");
 
-	(void) SCNetworkReachabilitySetCallback(ptrTarget, ptr_query_callback, NULL);
-	(void) SCNetworkReachabilityScheduleWithRunLoop(ptrTarget, rl, kCFRunLoopDefaultMode);
-
-	return TRUE;
+	ptrQuery = primary_ptr_query_start(address, rl, ptr_query_callback, NULL);
+	return (ptrQuery != NULL);
 }
 
 
@@ -451,7 +314,7 @@ update_hostname(SCDynamicStoreRef store, CFArrayRef changedKeys, void *info)
 
 	// if active, cancel any in-progress attempt to resolve the primary IP address
 
-	if (ptrTarget != NULL) {
+	if (ptrQuery != NULL) {
 		ptr_query_stop();
 	}
 
@@ -466,7 +329,7 @@ update_hostname(SCDynamicStoreRef store, CFArrayRef changedKeys, void *info)
 
 	// get primary service ID
 
-	serviceID = copy_primary_service(store);
+	serviceID = primary_service_copy(store);
 	if (serviceID == NULL) {
 		goto mDNS;
 	}
@@ -482,7 +345,7 @@ update_hostname(SCDynamicStoreRef store, CFArrayRef changedKeys, void *info)
 
 	// get DNS name associated with primary IP, if available
 
-	address = copy_primary_ip(store, serviceID);
+	address = primary_address_copy(store, serviceID);
 	if (address != NULL) {
 		boolean_t	isExpensive;
 
@@ -675,6 +538,8 @@ main(int argc, char **argv)
 	CFStringRef		serviceID;
 	SCDynamicStoreRef	store;
 
+	rl = CFRunLoopGetCurrent();
+
 	store = SCDynamicStoreCreate(NULL, CFSTR("set-hostname"), NULL, NULL);
 	if (store == NULL) {
 		SCPrint(TRUE, stdout,
@@ -699,7 +564,7 @@ main(int argc, char **argv)
 	}
 
 	// get primary service
-	serviceID = copy_primary_service(store);
+	serviceID = primary_service_copy(store);
 	if (serviceID != NULL) {
 		SCPrint(TRUE, stdout, CFSTR("primary service ID = %@\n"), serviceID);
 	} else {
@@ -721,7 +586,7 @@ main(int argc, char **argv)
 		}
 
 		// get primary IP address
-		address = copy_primary_ip(store, serviceID);
+		address = primary_address_copy(store, serviceID);
 		if (address != NULL) {
 			SCPrint(TRUE, stdout, CFSTR("primary address = %@\n"), address);
 
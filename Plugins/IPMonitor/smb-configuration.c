@@ -51,6 +51,8 @@
 #include <SystemConfiguration/SCValidation.h>
 #include <SystemConfiguration/SCPrivate.h>
 
+#include "primary-address.h"
+
 #ifdef	MAIN
 #define	my_log(__level, __format, ...)	SCPrint(TRUE, stdout, CFSTR(__format "\n"), ## __VA_ARGS__)
 #else	// MAIN
@@ -72,8 +74,7 @@ static dispatch_queue_t		queue		= NULL;
 
 static int			notify_token	= -1;
 
-static struct timeval		ptrQueryStart;
-static SCNetworkReachabilityRef	ptrTarget	= NULL;
+static primary_ptr_query_t	ptrQuery	= NULL;
 
 static CFRunLoopTimerRef	timer		= NULL;
 
@@ -382,104 +383,35 @@ smb_set_configuration(SCDynamicStoreRef store, CFDictionaryRef dict)
 }
 
 
-static CFStringRef
-copy_primary_service(SCDynamicStoreRef store)
-{
-	CFDictionaryRef	dict;
-	CFStringRef	key;
-	CFStringRef	serviceID	= NULL;
-
-	key = SCDynamicStoreKeyCreateNetworkGlobalEntity(NULL,
-							 kSCDynamicStoreDomainState,
-							 kSCEntNetIPv4);
-	dict = SCDynamicStoreCopyValue(store, key);
-	CFRelease(key);
-
-	if (dict != NULL) {
-		if (isA_CFDictionary(dict)) {
-			serviceID = CFDictionaryGetValue(dict, kSCDynamicStorePropNetPrimaryService);
-			if (isA_CFString(serviceID)) {
-				CFRetain(serviceID);
-			} else {
-				serviceID = NULL;
-			}
-		}
-		CFRelease(dict);
-	}
-
-	return serviceID;
-}
-
-
-static CFStringRef
-copy_primary_ip(SCDynamicStoreRef store, CFStringRef serviceID)
-{
-	CFStringRef	address	= NULL;
-	CFDictionaryRef	dict;
-	CFStringRef	key;
-
-	key = SCDynamicStoreKeyCreateNetworkServiceEntity(NULL,
-							  kSCDynamicStoreDomainState,
-							  serviceID,
-							  kSCEntNetIPv4);
-	dict = SCDynamicStoreCopyValue(store, key);
-	CFRelease(key);
-
-	if (dict != NULL) {
-		if (isA_CFDictionary(dict)) {
-			CFArrayRef	addresses;
-
-			addresses = CFDictionaryGetValue(dict, kSCPropNetIPv4Addresses);
-			if (isA_CFArray(addresses) && (CFArrayGetCount(addresses) > 0)) {
-				address = CFArrayGetValueAtIndex(addresses, 0);
-				if (isA_CFString(address)) {
-					CFRetain(address);
-				} else {
-					address = NULL;
-				}
-			}
-		}
-		CFRelease(dict);
-	}
-
-	return address;
-}
-
-
 static void
 ptr_query_stop()
 {
-	if (ptrTarget == NULL) {
+	if (ptrQuery == NULL) {
 		return;
 	}
 
 	my_log(LOG_INFO, "NetBIOS name: ptr query stop");
 
-	SCNetworkReachabilitySetCallback(ptrTarget, NULL, NULL);
-	SCNetworkReachabilityUnscheduleFromRunLoop(ptrTarget, rl, kCFRunLoopDefaultMode);
-	CFRelease(ptrTarget);
-	ptrTarget = NULL;
+	primary_ptr_query_cancel(ptrQuery);
+	ptrQuery = NULL;
 
 	return;
 }
 
 
 static void
-ptr_query_callback(SCNetworkReachabilityRef target, SCNetworkReachabilityFlags flags, void *info)
+ptr_query_callback(CFArrayRef hosts, void *context)
 {
-#pragma unused(info)
+#pragma unused(context)
 	CFDictionaryRef		dict;
 	CFStringRef		name;
 	CFMutableDictionaryRef	newDict;
-	struct timeval		ptrQueryComplete;
-	struct timeval		ptrQueryElapsed;
 
-	(void) gettimeofday(&ptrQueryComplete, NULL);
-	timersub(&ptrQueryComplete, &ptrQueryStart, &ptrQueryElapsed);
-	my_log(LOG_INFO, "NetBIOS name: ptr query complete%s (query time = %ld.%3.3d)",
-	       (flags & kSCNetworkReachabilityFlagsReachable) ? "" : ", host not found",
-	       ptrQueryElapsed.tv_sec,
-	       ptrQueryElapsed.tv_usec / 1000);
+	// the query has completed (and been released)
+	ptrQuery = NULL;
+
+	my_log(LOG_INFO, "NetBIOS name: ptr query complete%s",
+	       (hosts != NULL) ? "" : ", host not found");
 
 	// get network configuration
 	dict = smb_copy_global_configuration(store);
@@ -494,35 +426,26 @@ ptr_query_callback(SCNetworkReachabilityRef target, SCNetworkReachabilityFlags f
 	// use reverse DNS name, if available
 
 	name = NULL;
-	if (flags & kSCNetworkReachabilityFlagsReachable) {
-		int		error_num;
-		CFArrayRef	hosts;
+	if ((hosts != NULL) && (CFArrayGetCount(hosts) > 0)) {
+		CFIndex			ptrLen;
+		CFMutableStringRef	ptrName;
+		CFRange			range;
 
 		/*
 		 * if [reverse] DNS query was successful
 		 */
-		hosts = SCNetworkReachabilityCopyResolvedAddress(target, &error_num);
-		if (hosts != NULL) {
-			if (CFArrayGetCount(hosts) > 0) {
-				CFIndex			ptrLen;
-				CFMutableStringRef	ptrName;
-				CFRange			range;
-
-				name = CFArrayGetValueAtIndex(hosts, 0);
-				ptrName = CFStringCreateMutableCopy(NULL, 0, name);
-				ptrLen = CFStringGetLength(ptrName);
-				if (CFStringFindWithOptions(ptrName,
-							    CFSTR("."),
-							    CFRangeMake(0, ptrLen),
-							    0,
-							    &range)) {
-					CFStringDelete(ptrName,
-						       CFRangeMake(range.location, ptrLen - range.location));
-				}
-				name = ptrName;
-			}
-			CFRelease(hosts);
+		name = CFArrayGetValueAtIndex(hosts, 0);
+		ptrName = CFStringCreateMutableCopy(NULL, 0, name);
+		ptrLen = CFStringGetLength(ptrName);
+		if (CFStringFindWithOptions(ptrName,
+					    CFSTR("."),
+					    CFRangeMake(0, ptrLen),
+					    0,
+					    &range)) {
+			CFStringDelete(ptrName,
+				       CFRangeMake(range.location, ptrLen - range.location));
 		}
+		name = ptrName;
 	}
 	if (name != NULL) {
 		if (_SC_CFStringIsValidNetBIOSName(name)) {
@@ -565,8 +488,6 @@ ptr_query_callback(SCNetworkReachabilityRef target, SCNetworkReachabilityFlags f
 	smb_set_configuration(store, dict);
 	CFRelease(dict);
 
-	ptr_query_stop();
-
 #ifdef	MAIN
 	CFRunLoopStop(rl);
 #endif	// MAIN
@@ -578,45 +499,10 @@ ptr_query_callback(SCNetworkReachabilityRef target, SCNetworkReachabilityFlags f
 static Boolean
 ptr_query_start(CFStringRef address)
 {
-	union {
-		struct sockaddr         sa;
-		struct sockaddr_in      sin;
-		struct sockaddr_in6     sin6;
-	} addr;
-	char				buf[64];
-	CFDataRef			data;
-	CFMutableDictionaryRef		options;
-
-	if (_SC_cfstring_to_cstring(address, buf, sizeof(buf), kCFStringEncodingASCII) == NULL) {
-		my_log(LOG_ERR, "could not convert [primary] address string");
-		return FALSE;
-	}
-
-	if (_SC_string_to_sockaddr(buf, AF_UNSPEC, (void *)&addr, sizeof(addr)) == NULL) {
-		my_log(LOG_ERR, "could not convert [primary] address");
-		return FALSE;
-	}
-
-	options = CFDictionaryCreateMutable(NULL,
-					    0,
-					    &kCFTypeDictionaryKeyCallBacks,
-					    &kCFTypeDictionaryValueCallBacks);
-	data = CFDataCreate(NULL, (const UInt8 *)&addr.sa, addr.sa.sa_len);
-	CFDictionarySetValue(options, kSCNetworkReachabilityOptionPTRAddress, data);
-	CFRelease(data);
-	ptrTarget = SCNetworkReachabilityCreateWithOptions(NULL, options);
-	CFRelease(options);
-	if (ptrTarget == NULL) {
-		my_log(LOG_ERR, "could not resolve [primary] address");
-		return FALSE;
-	}
-
 	my_log(LOG_INFO, "NetBIOS name: ptr query start");
 
-	(void) SCNetworkReachabilitySetCallback(ptrTarget, ptr_query_callback, NULL);
-	(void) SCNetworkReachabilityScheduleWithRunLoop(ptrTarget, rl, kCFRunLoopDefaultMode);
-
-	return TRUE;
+	ptrQuery = primary_ptr_query_start(address, rl, ptr_query_callback, NULL);
+	return (ptrQuery != NULL);
 }
 
 
@@ -641,14 +527,14 @@ smb_update_configuration(CFRunLoopTimerRef _timer, void *info)
 	}
 
 	// get primary service ID
-	serviceID = copy_primary_service(store);
+	serviceID = primary_service_copy(store);
 	if (serviceID == NULL) {
 		// if no primary service
 		goto mDNS;
 	}
 
 	// get DNS name associated with primary IP, if available
-	address = copy_primary_ip(store, serviceID);
+	address = primary_address_copy(store, serviceID);
 	if (address != NULL) {
 		Boolean	ok;
 
@@ -725,7 +611,7 @@ configuration_changed(SCDynamicStoreRef store, CFArrayRef changedKeys, void *inf
 
 	// if active, cancel any in-progress attempt to resolve the primary IP address
 
-	if (ptrTarget != NULL) {
+	if (ptrQuery != NULL) {
 		ptr_query_stop();
 	}
 
@@ -887,6 +773,8 @@ main(int argc, char **argv)
 	CFStringRef		serviceID;
 	SCDynamicStoreRef	store;
 
+	rl = CFRunLoopGetCurrent();
+
 	_sc_log = FALSE;
 	if ((argc > 1) && (strcmp(argv[1], "-d") == 0)) {
 		_sc_verbose = TRUE;
@@ -910,7 +798,7 @@ main(int argc, char **argv)
 	}
 
 	// get primary service
-	serviceID = copy_primary_service(store);
+	serviceID = primary_service_copy(store);
 	if (serviceID != NULL) {
 		SCPrint(TRUE, stdout, CFSTR("primary service ID = %@\n"), serviceID);
 	} else {
@@ -925,7 +813,7 @@ main(int argc, char **argv)
 	}
 
 	// get primary IP address
-	address = copy_primary_ip(store, serviceID);
+	address = primary_address_copy(store, serviceID);
 	CFRelease(serviceID);
 	if (address != NULL) {
 		SCPrint(TRUE, stdout, CFSTR("primary address = %@\n"), address);
@@ -29,6 +29,7 @@
  */
 
 
+#include <fcntl.h>
 #include <mach/mach.h>
 #include <mach-o/fat.h>
 #include <mach-o/loader.h>
@@ -39,6 +40,7 @@
 #include <sys/kern_control.h>
 #include <sys/socket.h>
 #include <sys/sockio.h>
+#include <sys/stat.h>
 #include <sys/sys_domain.h>
 
 #define	SC_LOG_HANDLE	__log_QoSMarking()
@@ -56,6 +58,10 @@
 // define the QoSMarking.bundle Info.plist key containing paths to be white-listed
 #define kQoSMarkingExecutablePathsAppleAudioVideoCallsKey	CFSTR("QoSMarking_AppleAudioVideoCalls_ExecutablePaths")
 
+// define the file used to persist the [executable path] UUIDs across restarts
+// (must be in a root-only, writable location)
+#define QOS_MARKING_UUID_CACHE	"/var/db/com.apple.SystemConfiguration.QoSMarking.plist"
+
 // define the starting "order" value for any QoS Marking NEPolicy rules
 #define QOS_MARKING_PRIORITY_BLOCK_AV_APPS	1000
 #define QOS_MARKING_PRIORITY_BLOCK_AV_PATHS	1500
@@ -228,6 +234,53 @@ qosMarkingSetEnabled(int s, const char *ifname, BOOL enabled)
 @property (nonatomic) NSMutableDictionary *	enabled;
 @property (nonatomic) NSMutableDictionary *	enabledAV;
 
+/*
+ * installed
+ *   A dictionary for tracking the NECP policies installed for each
+ *   interface (so that policy changes can be applied incrementally).
+ *
+ *   Key   : interface [name]
+ *   Value : NSMutableDictionary* of installed entries
+ *             Key   : "<order>:<bundleID or path>"
+ *             Value : NSDictionary* with the NSSet* of resolved [executable]
+ *                     UUIDs and the NSArray* of NECP policy IDs
+ */
+@property (nonatomic) NSMutableDictionary *	installed;
+
+/*
+ * executableUUIDs
+ *   A dictionary for caching the UUIDs of whitelisted executables
+ *   (persisted in QOS_MARKING_UUID_CACHE)
+ *
+ *   Key   : executable path
+ *   Value : NSDictionary* with the file "signature" (device, inode,
+ *           modification time, size) and the UUID strings
+ */
+@property (nonatomic) NSMutableDictionary *	executableUUIDs;
+
+/*
+ * executableUUIDsChanged
+ *   TRUE if the executableUUIDs have changed since they were last saved
+ */
+@property (nonatomic) BOOL			executableUUIDsChanged;
+
+/*
+ * referencedPaths
+ *   The executable paths referenced by the policies of each interface
+ *   (used to prune executableUUIDs)
+ *
+ *   Key   : interface [name]
+ *   Value : NSSet* of executable paths
+ */
+@property (nonatomic) NSMutableDictionary *	referencedPaths;
+
+/*
+ * resolvedPaths
+ *   The executable paths resolved while the wanted policies for an
+ *   interface are being collected (nil otherwise)
+ */
+@property (nonatomic) NSMutableSet *		resolvedPaths;
+
 @end
 
 
@@ -439,7 +492,7 @@ qosMarkingSetEnabled(int s, const char *ifname, BOOL enabled)
 	return uuids;
 }
 
-- (NSArray *)copyUUIDsForExecutable:(const char *)executablePath
+- (NSArray *)copyUUIDsForExecutableFile:(const char *)executablePath
 {
 	int		fd;
 	uint32_t	magic;
@@ -498,18 +551,182 @@ qosMarkingSetEnabled(int s, const char *ifname, BOOL enabled)
 }
 
 
-- (void)addWhitelistedPathPolicy:(NSString *)interface forPath:(NSString *)path order:(uint32_t)order
+- (NSMutableDictionary *)loadExecutableUUIDs
+{
+	NSData *		data;
+	NSError *		error	= nil;
+	int			fd;
+	NSFileHandle *		fh;
+	id			plist;
+	struct stat		statBuf;
+
+	fd = open(QOS_MARKING_UUID_CACHE, O_RDONLY | O_NOFOLLOW, 0);
+	if (fd == -1) {
+		if (errno != ENOENT) {
+			SC_log(LOG_NOTICE, "could not open UUID cache: %s", strerror(errno));
+		}
+		return [NSMutableDictionary dictionary];
+	}
+
+	// only trust a regular file that is owned (and only writable) by root
+	if ((fstat(fd, &statBuf) == -1) ||
+	    !S_ISREG(statBuf.st_mode) ||
+	    (statBuf.st_uid != 0) ||
+	    ((statBuf.st_mode & (S_IWGRP | S_IWOTH)) != 0)) {
+		SC_log(LOG_ERR, "UUID cache not trusted, ignored");
+		close(fd);
+		return [NSMutableDictionary dictionary];
+	}
+
+	fh = [[NSFileHandle alloc] initWithFileDescriptor:fd closeOnDealloc:YES];
+	data = [fh readDataToEndOfFile];
+	if (data == nil) {
+		return [NSMutableDictionary dictionary];
+	}
+
+	plist = [NSPropertyListSerialization propertyListWithData:data
+							  options:NSPropertyListImmutable
+							   format:NULL
+							    error:&error];
+	if (![plist isKindOfClass:[NSDictionary class]]) {
+		SC_log(LOG_NOTICE, "could not load UUID cache: %@", error);
+		return [NSMutableDictionary dictionary];
+	}
+
+	return [plist mutableCopy];
+}
+
+
+- (void)pruneExecutableUUIDs
+{
+	NSMutableSet *	referenced	= [NSMutableSet set];
+
+	for (NSSet *paths in _referencedPaths.allValues) {
+		[referenced unionSet:paths];
+	}
+
+	for (NSString *path in _executableUUIDs.allKeys) {
+		if (![referenced containsObject:path]) {
+			// if no longer referenced by any policy
+			[_executableUUIDs removeObjectForKey:path];
+			_executableUUIDsChanged = YES;
+		}
+	}
+
+	return;
+}
+
+
+- (void)saveExecutableUUIDs
+{
+	NSData *	data;
+	NSError *	error	= nil;
+
+	_executableUUIDsChanged = NO;
+
+	data = [NSPropertyListSerialization dataWithPropertyList:_executableUUIDs
+							  format:NSPropertyListBinaryFormat_v1_0
+							 options:0
+							   error:&error];
+	if (data == nil) {
+		SC_log(LOG_ERR, "could not serialize UUID cache: %@", error);
+		return;
+	}
+
+	if (![data writeToFile:@QOS_MARKING_UUID_CACHE options:NSDataWritingAtomic error:&error]) {
+		SC_log(LOG_NOTICE, "could not save UUID cache: %@", error);
+	}
+
+	return;
+}
+
+
+- (NSArray *)copyUUIDsForExecutable:(const char *)executablePath
+{
+	NSDictionary *		cached;
+	NSString *		path;
+	NSArray *		signature;
+	struct stat		statBuf;
+	NSMutableArray *	uuidStrings;
+	NSArray *		uuids;
+
+	if (executablePath == NULL) {
+		return nil;
+	}
+
+	path = @(executablePath);
+	[_resolvedPaths addObject:path];
+	if (stat(executablePath, &statBuf) == -1) {
+		if ((errno == ENOENT) && (_executableUUIDs[path] != nil)) {
+			// if the executable is no longer present
+			[_executableUUIDs removeObjectForKey:path];
+			_executableUUIDsChanged = YES;
+		}
+
+		return [self copyUUIDsForExecutableFile:executablePath];
+	}
+
+	// the UUIDs only change when the executable does
+	signature = @[ @(statBuf.st_dev),
+		       @(statBuf.st_ino),
+		       @(statBuf.st_mtimespec.tv_sec),
+		       @(statBuf.st_mtimespec.tv_nsec),
+		       @(statBuf.st_size) ];
+
+	cached = _executableUUIDs[path];
+	if ([cached isKindOfClass:[NSDictionary class]] &&
+	    [cached[@"signature"] isEqual:signature] &&
+	    [cached[@"uuids"] isKindOfClass:[NSArray class]]) {
+		NSMutableArray *	cachedUUIDs	= [NSMutableArray array];
+
+		for (NSString *uuidString in cached[@"uuids"]) {
+			NSUUID *	uuid	= nil;
+
+			if ([uuidString isKindOfClass:[NSString class]]) {
+				uuid = [[NSUUID alloc] initWithUUIDString:uuidString];
+			}
+			if (uuid == nil) {
+				cachedUUIDs = nil;
+				break;
+			}
+			[cachedUUIDs addObject:uuid];
+		}
+
+		if (cachedUUIDs.count > 0) {
+			return cachedUUIDs;
+		}
+	}
+
+	uuids = [self copyUUIDsForExecutableFile:executablePath];
+	if (uuids.count == 0) {
+		// don't cache a failure
+		return uuids;
+	}
+
+	uuidStrings = [NSMutableArray arrayWithCapacity:uuids.count];
+	for (NSUUID *uuid in uuids) {
+		[uuidStrings addObject:uuid.UUIDString];
+	}
+	_executableUUIDs[path] = @{ @"signature" : signature,
+				    @"uuids"     : uuidStrings };
+	_executableUUIDsChanged = YES;
+
+	return uuids;
+}
+
+
+- (NSArray *)addWhitelistedPathPolicy:(NSString *)interface forPath:(NSString *)path uuids:(NSArray *)uuids order:(uint32_t)order
 {
 	NEPolicyCondition *	allInterfacesCondition;
+	NSMutableArray *	policyIDs	= [NSMutableArray array];
 	NEPolicyResult *	result;
 	NEPolicyRouteRule *	routeRule;
 	NEPolicySession *	session;
-	NSArray *		uuids;
 
 	session = _policySessions[interface];
 	if (session == nil) {
 		SC_log(LOG_ERR, "QoS marking policy: %@: no session", interface);
-		return;
+		return policyIDs;
 	}
 
 	// create QoS route rule
@@ -520,12 +737,11 @@ qosMarkingSetEnabled(int s, const char *ifname, BOOL enabled)
 	// create "all interfaces" condition
 	allInterfacesCondition = [NEPolicyCondition allInterfaces];
 
-	uuids = [self copyUUIDsForExecutable:[path UTF8String]];
 	if ((uuids == nil) || (uuids.count == 0)) {
 		SC_log(LOG_ERR, "QoS marking policy: %@: could not add path \"%@\"",
 		       interface,
 		       path);
-		return;
+		return policyIDs;
 	}
 
 	for (NSUUID *uuid in uuids) {
@@ -542,6 +758,7 @@ qosMarkingSetEnabled(int s, const char *ifname, BOOL enabled)
 					      conditions:@[ uuidCondition, allInterfacesCondition ]];
 		policyID = [session addPolicy:policy];
 		if (policyID != 0) {
+			[policyIDs addObject:@(policyID)];
 			SC_log(LOG_NOTICE, "QoS marking policy: %@: %u: whitelist path \"%@\" (%@)",
 			       interface,
 			       order,
@@ -556,8 +773,7 @@ qosMarkingSetEnabled(int s, const char *ifname, BOOL enabled)
 		}
 	}
 
-
-	return;
+	return policyIDs;
 }
 
 
@@ -605,27 +821,27 @@ qosMarkingSetEnabled(int s, const char *ifname, BOOL enabled)
 }
 
 
-- (void)addWhitelistedAppIdentifierPolicy:(NSString *)interface forApp:(NSString *)appBundleID order:(uint32_t)order
+- (NSArray *)addWhitelistedAppIdentifierPolicy:(NSString *)interface forApp:(NSString *)appBundleID uuids:(NSArray *)uuids order:(uint32_t)order
 {
 	NEPolicyCondition *	allInterfacesCondition;
+	NSMutableArray *	policyIDs	= [NSMutableArray array];
 	NEPolicyResult *	result;
 	NEPolicyRouteRule *	routeRule;
 	NEPolicySession *	session;
-	NSArray *		uuids;
 
 	if ([appBundleID hasPrefix:@"/"]) {
 		if (_SC_isAppleInternal()) {
 			// special case executable path handling (if internal)
-			[self addWhitelistedPathPolicy:interface forPath:appBundleID order:order];
+			return [self addWhitelistedPathPolicy:interface forPath:appBundleID uuids:uuids order:order];
 		}
 
-		return;
+		return policyIDs;
 	}
 
 	session = _policySessions[interface];
 	if (session == nil) {
 		SC_log(LOG_ERR, "QoS marking policy: %@: no session", interface);
-		return;
+		return policyIDs;
 	}
 
 	// create QoS route rule
@@ -636,12 +852,11 @@ qosMarkingSetEnabled(int s, const char *ifname, BOOL enabled)
 	// create "all interfaces" condition
 	allInterfacesCondition = [NEPolicyCondition allInterfaces];
 
-	uuids = [self copyUUIDsForBundleID:appBundleID];
 	if ((uuids == nil) || (uuids.count == 0)) {
 		SC_log(LOG_ERR, "QoS marking policy: %@: could not add bundleID \"%@\"",
 		       interface,
 		       appBundleID);
-		return;
+		return policyIDs;
 	}
 
 	for (NSUUID *uuid in uuids) {
@@ -658,6 +873,7 @@ qosMarkingSetEnabled(int s, const char *ifname, BOOL enabled)
 					      conditions:@[ uuidCondition, allInterfacesCondition ]];
 		policyID = [session addPolicy:policy];
 		if (policyID != 0) {
+			[policyIDs addObject:@(policyID)];
 			SC_log(LOG_NOTICE, "QoS marking policy: %@: %u: whitelist bundleID \"%@\" (%@)",
 			       interface,
 			       order,
@@ -672,10 +888,130 @@ qosMarkingSetEnabled(int s, const char *ifname, BOOL enabled)
 		}
 	}
 
+	return policyIDs;
+}
+
+
+#pragma mark -
+
+
+- (NSArray *)copyUUIDsForWhitelisted:(NSString *)name path:(BOOL)isPath
+{
+	if (!isPath && [name hasPrefix:@"/"]) {
+		if (!_SC_isAppleInternal()) {
+			return nil;
+		}
+
+		// special case executable path handling (if internal)
+		isPath = true;
+	}
+
+	if (isPath) {
+		return [self copyUUIDsForExecutable:[name UTF8String]];
+	}
+
+	return [self copyUUIDsForBundleID:name];
+}
+
+
+- (void)addWantedPolicy:(NSMutableDictionary *)wanted name:(NSString *)name order:(uint32_t)order path:(BOOL)isPath
+{
+	NSString *	key;
+	NSArray *	uuids;
+
+	// resolve the UUIDs now so that updated executables are noticed
+	uuids = [self copyUUIDsForWhitelisted:name path:isPath];
+	if (uuids == nil) {
+		uuids = @[];
+	}
+
+	key = [NSString stringWithFormat:@"%u:%@", order, name];
+	wanted[key] = @{ @"name"  : name,
+			 @"order" : @(order),
+			 @"path"  : @(isPath),
+			 @"uuids" : uuids };
 	return;
 }
 
 
+/*
+ * updateInstalledPolicies:forInterface:session:
+ *   Bring the NECP policies installed for the interface in line with
+ *   those wanted, only removing and adding the entries that changed (or
+ *   whose executable UUIDs changed).  Returns the number of entries whose
+ *   policies were removed or added.
+ */
+- (NSUInteger)updateInstalledPolicies:(NSDictionary *)wanted forInterface:(NSString *)interface session:(NEPolicySession *)session
+{
+	NSMutableDictionary *	installed;
+	NSUInteger		nAdded		= 0;
+	NSUInteger		nRemoved	= 0;
+
+	installed = _installed[interface];
+	if (installed == nil) {
+		installed = [NSMutableDictionary dictionary];
+		_installed[interface] = installed;
+	}
+
+	// remove any policies that are no longer wanted (or whose UUIDs changed)
+	for (NSString *key in installed.allKeys) {
+		NSDictionary *	entry	= installed[key];
+		NSArray *	policyIDs;
+
+		if ((wanted[key] != nil) &&
+		    [entry[@"uuids"] isEqual:[NSSet setWithArray:wanted[key][@"uuids"]]]) {
+			continue;
+		}
+
+		policyIDs = entry[@"policyIDs"];
+		for (NSNumber *policyID in policyIDs) {
+			if (![session removePolicyWithID:policyID.unsignedIntegerValue]) {
+				SC_log(LOG_ERR, "%@: could not remove policy %@", interface, policyID);
+			}
+		}
+		[installed removeObjectForKey:key];
+		if (policyIDs.count > 0) {
+			nRemoved++;
+		}
+	}
+
+	// add any [new] policies
+	for (NSString *key in wanted) {
+		NSDictionary *	entry;
+		NSArray *	policyIDs;
+		uint32_t	order;
+		NSArray *	uuids;
+
+		if (installed[key] != nil) {
+			continue;
+		}
+
+		entry = wanted[key];
+		order = [entry[@"order"] unsignedIntValue];
+		uuids = entry[@"uuids"];
+		if ([entry[@"path"] boolValue]) {
+			policyIDs = [self addWhitelistedPathPolicy:interface forPath:entry[@"name"] uuids:uuids order:order];
+		} else {
+			policyIDs = [self addWhitelistedAppIdentifierPolicy:interface forApp:entry[@"name"] uuids:uuids order:order];
+		}
+		if ((policyIDs.count > 0) || (uuids.count == 0)) {
+			// track the entry (even if nothing to install until the UUIDs change)
+			installed[key] = @{ @"uuids"     : [NSSet setWithArray:uuids],
+					    @"policyIDs" : policyIDs };
+		}
+		if (policyIDs.count > 0) {
+			nAdded++;
+		}
+	}
+
+	SC_log(LOG_INFO, "QoS marking policy: %@: %lu removed, %lu added",
+	       interface,
+	       (unsigned long)nRemoved,
+	       (unsigned long)nAdded);
+	return nRemoved + nAdded;
+}
+
+
 #pragma mark -
 
 
@@ -688,6 +1024,11 @@ qosMarkingSetEnabled(int s, const char *ifname, BOOL enabled)
 		_requested = [NSMutableDictionary dictionary];
 		_enabled = [NSMutableDictionary dictionary];
 		_enabledAV = [NSMutableDictionary dictionary];
+		_installed = [NSMutableDictionary dictionary];
+		_executableUUIDs = [self loadExecutableUUIDs];
+		_executableUUIDsChanged = NO;
+		_referencedPaths = [NSMutableDictionary dictionary];
+		_resolvedPaths = nil;
 	}
 
 	return self;
@@ -781,6 +1122,8 @@ qosMarkingSetEnabled(int s, const char *ifname, BOOL enabled)
 
 			// if QoS marking was enabled (for this interface), close session
 			[_policySessions removeObjectForKey:interface];
+			[_installed removeObjectForKey:interface];
+			[_referencedPaths removeObjectForKey:interface];
 
 			// QoS marking policy for this interface is no longer enabled
 			[_enabled   removeObjectForKey:interface];
@@ -819,9 +1162,11 @@ qosMarkingSetEnabled(int s, const char *ifname, BOOL enabled)
 		}
 
 		if (update) {
-			BOOL		ok;
-			uint32_t	order;
+			NSUInteger		nChanges	= 0;
+			BOOL			ok;
+			uint32_t		order;
 			NEPolicySession *	session;
+			NSMutableDictionary *	wanted		= [NSMutableDictionary dictionary];
 
 			// QoS marking being (or still) enabled for this interface
 			if (_enabled.count == 0) {
@@ -844,24 +1189,20 @@ qosMarkingSetEnabled(int s, const char *ifname, BOOL enabled)
 				session = [self createPolicySession];
 				if (session != nil) {
 					_policySessions[interface] = session;
+					[_installed removeObjectForKey:interface];
 				} else {
 					SC_log(LOG_ERR, "%@: failed to create policy session", interface);
 				}
 			}
 
-			// zap any previously stored policies
-			if (session != nil) {
-				ok = [session removeAllPolicies];
-				if (!ok) {
-					SC_log(LOG_ERR, "%@: could not remove policies", interface);
-				}
-			}
+			// track the executable paths referenced by the wanted policies
+			_resolvedPaths = [NSMutableSet set];
 
 			// if needed, add policies for any whitelisted applications
 			if ((session != nil) && (reqAppIDs.count > 0)) {
 				order = QOS_MARKING_PRIORITY_BLOCK_APPS;
 				for (NSString *app in reqAppIDs) {
-					[self addWhitelistedAppIdentifierPolicy:interface forApp:app order:order++];
+					[self addWantedPolicy:wanted name:app order:order++ path:false];
 				}
 			}
 
@@ -881,12 +1222,12 @@ qosMarkingSetEnabled(int s, const char *ifname, BOOL enabled)
 
 					order = QOS_MARKING_PRIORITY_BLOCK_AV_APPS;
 					for (NSString *app in qosMarkingAudioVideoCalls_bundleIDs) {
-						[self addWhitelistedAppIdentifierPolicy:interface forApp:app order:order++];
+						[self addWantedPolicy:wanted name:app order:order++ path:false];
 					}
 
 					order = QOS_MARKING_PRIORITY_BLOCK_AV_PATHS;
 					for (NSString *path in qosMarkingAudioVideoCalls_executablePaths) {
-						[self addWhitelistedPathPolicy:interface forPath:path order:order++];
+						[self addWantedPolicy:wanted name:path order:order++ path:true];
 					}
 				}
 			} else {
@@ -900,7 +1241,15 @@ qosMarkingSetEnabled(int s, const char *ifname, BOOL enabled)
 				}
 			}
 
+			_referencedPaths[interface] = _resolvedPaths;
+			_resolvedPaths = nil;
+
 			if (session != nil) {
+				// only remove/add the policies that changed
+				nChanges = [self updateInstalledPolicies:wanted forInterface:interface session:session];
+			}
+
+			if (nChanges > 0) {
 				ok = [session apply];
 				if (!ok) {
 					SC_log(LOG_ERR, "%@: could not apply new policies", interface);
@@ -914,6 +1263,13 @@ qosMarkingSetEnabled(int s, const char *ifname, BOOL enabled)
 		qosMarkingSetRestrictAVApps(false);
 		qosMarkingSetHavePolicies(false);
 	}
+
+	// persist any [executable path] UUID changes (once per update), dropping
+	// the executables that are no longer referenced by any policy
+	[self pruneExecutableUUIDs];
+	if (_executableUUIDsChanged) {
+		[self saveExecutableUUIDs];
+	}
 }
 
 
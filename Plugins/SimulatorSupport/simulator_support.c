@@ -44,6 +44,7 @@
 
 static CFMutableArrayRef	mirror_keys	= NULL;
 static CFMutableArrayRef	mirror_patterns	= NULL;
+static CFMutableSetRef		mirrored_keys	= NULL;	// keys currently mirrored to the "sim" store
 static SCDynamicStoreRef	store_host	= NULL;
 static SCDynamicStoreRef	store_sim	= NULL;
 
@@ -77,7 +78,6 @@ mirror(SCDynamicStoreRef store, CFArrayRef changes, void *info)
 {
 #pragma unused(store)
 	CFDictionaryRef	content_host;
-	CFDictionaryRef	content_sim;
 	CFIndex		i;
 	CFIndex		n;
 
@@ -94,9 +94,6 @@ mirror(SCDynamicStoreRef store, CFArrayRef changes, void *info)
 		content_host = (CFDictionaryRef)info;
 	}
 
-	// capture [current] "sim" content
-	content_sim = SCDynamicStoreCopyMultiple(store_sim, changes, NULL);
-
 	// update
 	cache_open();
 	for (i = 0; i < n; i++) {
@@ -108,12 +105,13 @@ mirror(SCDynamicStoreRef store, CFArrayRef changes, void *info)
 		if (val != NULL) {
 			// if "host" content changed
 			cache_SCDynamicStoreSetValue(store_sim, key, val);
+			CFSetAddValue(mirrored_keys, key);
 		} else {
 			// if no "host" content
-			val = (content_sim != NULL) ? CFDictionaryGetValue(content_sim, key) : NULL;
-			if (val != NULL) {
+			if (CFSetContainsValue(mirrored_keys, key)) {
 				// if we need to remove the "sim" content
 				cache_SCDynamicStoreRemoveValue(store_sim, key);
+				CFSetRemoveValue(mirrored_keys, key);
 			} else {
 				// if no "sim" content to remove, just notify
 				cache_SCDynamicStoreNotifyValue(store_sim, key);
@@ -127,9 +125,6 @@ mirror(SCDynamicStoreRef store, CFArrayRef changes, void *info)
 	if ((info == NULL) && (content_host != NULL)) {
 		CFRelease(content_host);
 	}
-	if (content_sim != NULL) {
-		CFRelease(content_sim);
-	}
 
 	return;
 }
@@ -143,6 +138,7 @@ mirror_setup()
 
 	mirror_keys     = CFArrayCreateMutable(NULL, 0, &kCFTypeArrayCallBacks);
 	mirror_patterns = CFArrayCreateMutable(NULL, 0, &kCFTypeArrayCallBacks);
+	mirrored_keys   = CFSetCreateMutable(NULL, 0, &kCFTypeSetCallBacks);
 
 	// Plugin:InterfaceNamer
 	key = SCDynamicStoreKeyCreate(NULL,
@@ -214,10 +210,35 @@ void
 prime_SimulatorSupport()
 {
 	CFDictionaryRef	content_host;
+	CFDictionaryRef	content_sim;
 	CFIndex		n;
 
 	SC_log(LOG_DEBUG, "prime() called");
 
+	// start with any content that is already in the _Sim store
+	content_sim = SCDynamicStoreCopyMultiple(store_sim, mirror_keys, mirror_patterns);
+	if (content_sim != NULL) {
+		n = CFDictionaryGetCount(content_sim);
+		if (n > 0) {
+			const void *	keys_sim_q[N_QUICK];
+			const void **	keys_sim	= keys_sim_q;
+
+			if (n > (CFIndex)(sizeof(keys_sim_q) / sizeof(CFStringRef))) {
+				keys_sim = CFAllocatorAllocate(NULL, n * sizeof(CFStringRef), 0);
+			}
+
+			CFDictionaryGetKeysAndValues(content_sim, keys_sim, NULL);
+			for (CFIndex i = 0; i < n; i++) {
+				CFSetAddValue(mirrored_keys, keys_sim[i]);
+			}
+
+			if (keys_sim != keys_sim_q) {
+				CFAllocatorDeallocate(NULL, keys_sim);
+			}
+		}
+		CFRelease(content_sim);
+	}
+
 	// copy current content from base OS store to _Sim store
 	content_host = SCDynamicStoreCopyMultiple(store_host, mirror_keys, mirror_patterns);
 	CFRelease(mirror_keys);
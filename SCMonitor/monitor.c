@@ -93,6 +93,10 @@ typedef struct {
 	// interfaces that we already know about
 	CFMutableSetRef			interfaces_known;
 
+	// coalesced interface list updates
+	CFRunLoopTimerRef		updateTimer;
+	uint32_t			updateRequests;
+
 	// interfaces that should be auto-configured (no user notification)
 	CFMutableArrayRef		interfaces_configure;
 
@@ -620,15 +624,27 @@ onConsole()
 #define kSCNetworkInterfaceConfigurationActionValueConfigureAuthorized	CFSTR("Configure-Authorized")
 
 
+static void
+removeKnownInterface(const void *value, void *context)
+{
+	CFMutableSetRef	interfaces_known	= (CFMutableSetRef)context;
+
+	CFSetRemoveValue(interfaces_known, value);
+	return;
+}
+
+
 static void
 updateInterfaceList(MyType *myInstance)
 {
+	CFIndex			added		= 0;
 	Boolean			changed		= FALSE;
 	CFIndex			i;
 	CFArrayRef		interfaces;
 	CFMutableSetRef		interfaces_old	= NULL;
 	CFIndex			n;
 	SCPreferencesRef	prefs;
+	CFIndex			removed		= 0;
 	SCNetworkSetRef		set		= NULL;
 
 	if (!onConsole()) {
@@ -640,15 +656,6 @@ updateInterfaceList(MyType *myInstance)
 		return;
 	}
 
-	set = SCNetworkSetCopyCurrent(prefs);
-	if (set == NULL) {
-		// if no "current" set, create new/default ("Automatic") set
-		set = _SCNetworkSetCreateDefault(prefs);
-		if (set == NULL) {
-			goto done;
-		}
-	}
-
 	interfaces_old = CFSetCreateMutableCopy(NULL, 0, myInstance->interfaces_known);
 
 	interfaces = _SCNetworkInterfaceCopyAllWithPreferences(prefs);
@@ -666,8 +673,23 @@ updateInterfaceList(MyType *myInstance)
 				// if we already know about this interface
 				continue;
 			}
+
+			if (set == NULL) {
+				// only needed when we have a new interface
+				set = SCNetworkSetCopyCurrent(prefs);
+				if (set == NULL) {
+					// if no "current" set, create new/default ("Automatic") set
+					set = _SCNetworkSetCreateDefault(prefs);
+					if (set == NULL) {
+						CFRelease(interfaces);
+						goto done;
+					}
+				}
+			}
+
 			CFSetAddValue(myInstance->interfaces_known, interface);
 			changed = TRUE;
+			added++;
 
 			ok = SCNetworkSetEstablishDefaultInterfaceConfiguration(set, interface);
 			if (ok) {
@@ -720,40 +742,40 @@ updateInterfaceList(MyType *myInstance)
 	}
 
 	// remove any posted notifications for network interfaces that have been removed
-	n = CFSetGetCount(interfaces_old);
-	if (n > 0) {
-		const void *    paths_q[32];
-		const void **   paths                 = paths_q;
-
-		if (n > (CFIndex)(sizeof(paths_q) / sizeof(CFTypeRef)))
-			paths = CFAllocatorAllocate(NULL, n * sizeof(CFTypeRef), 0);
-		CFSetGetValues(interfaces_old, paths);
-		for (i = 0; i < n; i++) {
-			if (myInstance->interfaces_prompt != NULL) {
-				CFIndex	j;
-
-				j = CFArrayGetCount(myInstance->interfaces_prompt);
-				while (j > 0) {
-					SCNetworkInterfaceRef	interface;
-
-					j--;
-					interface = CFArrayGetValueAtIndex(myInstance->interfaces_prompt, j);
-					if (CFEqual(interface, paths[i])) {
-						// if we have previously posted a notification
-						// for this no-longer-present interface
-						CFArrayRemoveValueAtIndex(myInstance->interfaces_prompt, j);
-						changed = TRUE;
-					}
+	removed = CFSetGetCount(interfaces_old);
+	if (removed > 0) {
+		if (myInstance->interfaces_prompt != NULL) {
+			i = CFArrayGetCount(myInstance->interfaces_prompt);
+			while (i > 0) {
+				SCNetworkInterfaceRef	interface;
+
+				i--;
+				interface = CFArrayGetValueAtIndex(myInstance->interfaces_prompt, i);
+				if (CFSetContainsValue(interfaces_old, interface)) {
+					// if we have previously posted a notification
+					// for this no-longer-present interface
+					CFArrayRemoveValueAtIndex(myInstance->interfaces_prompt, i);
+					changed = TRUE;
 				}
 			}
+		}
 
-			CFSetRemoveValue(myInstance->interfaces_known, paths[i]);
+		n = CFSetGetCount(myInstance->interfaces_known);
+		if (removed == n) {
+			CFSetRemoveAllValues(myInstance->interfaces_known);
+		} else {
+			CFSetApplyFunction(interfaces_old, removeKnownInterface, myInstance->interfaces_known);
 		}
-		if (paths != paths_q)       CFAllocatorDeallocate(NULL, paths);
 	}
 
     done :
 
+	SC_log(LOG_DEBUG, "interface list updated: %ld added, %ld removed, %u request(s) coalesced",
+	       added,
+	       removed,
+	       myInstance->updateRequests);
+	myInstance->updateRequests = 0;
+
 	if (changed) {
 		if (myInstance->interfaces_configure != NULL) {
 			// if we have network services to configure automatically
@@ -774,6 +796,71 @@ updateInterfaceList(MyType *myInstance)
 }
 
 
+#pragma mark -
+#pragma mark Coalesced interface list updates
+
+
+// interface list changes that arrive within this interval are handled together
+#define	UPDATE_COALESCE_INTERVAL	0.5
+
+
+static void
+updateInterfaceListTimer(CFRunLoopTimerRef timer, void *info)
+{
+#pragma unused(timer)
+	MyType	*myInstance	= (MyType *)info;
+
+	CFRunLoopTimerInvalidate(myInstance->updateTimer);
+	CFRelease(myInstance->updateTimer);
+	myInstance->updateTimer = NULL;
+
+	updateInterfaceList(myInstance);
+	return;
+}
+
+
+static void
+updateInterfaceListSoon(MyType *myInstance)
+{
+	CFRunLoopTimerContext	context	= { 0, (void *)myInstance, NULL, NULL, NULL };
+
+	myInstance->updateRequests++;
+	if (myInstance->updateTimer != NULL) {
+		// if an update is already pending
+		return;
+	}
+
+	myInstance->updateTimer = CFRunLoopTimerCreate(NULL,
+						       CFAbsoluteTimeGetCurrent() + UPDATE_COALESCE_INTERVAL,
+						       0,
+						       0,
+						       0,
+						       updateInterfaceListTimer,
+						       &context);
+	if (myInstance->updateTimer == NULL) {
+		// if we could not delay the update
+		updateInterfaceList(myInstance);
+		return;
+	}
+
+	CFRunLoopAddTimer(CFRunLoopGetCurrent(), myInstance->updateTimer, kCFRunLoopDefaultMode);
+	return;
+}
+
+
+static void
+updateInterfaceListCancel(MyType *myInstance)
+{
+	if (myInstance->updateTimer != NULL) {
+		CFRunLoopTimerInvalidate(myInstance->updateTimer);
+		CFRelease(myInstance->updateTimer);
+		myInstance->updateTimer = NULL;
+	}
+
+	return;
+}
+
+
 #pragma mark -
 #pragma mark Watch for new [network] interfaces
 
@@ -785,7 +872,7 @@ update_lan(SCDynamicStoreRef store, CFArrayRef changes, void * arg)
 #pragma unused(changes)
 	MyType	*myInstance	= (MyType *)arg;
 
-	updateInterfaceList(myInstance);
+	updateInterfaceListSoon(myInstance);
 	return;
 }
 
@@ -961,7 +1048,7 @@ update_node(void *refCon, io_service_t service, natural_t messageType, void *mes
 		}
 	}
 
-	updateInterfaceList(myInstance);
+	updateInterfaceListSoon(myInstance);
 	return;
 }
 
@@ -1100,7 +1187,7 @@ update_serial_nodes(void *refcon, io_iterator_t iter)
 	MyType	*myInstance	= (MyType *)refcon;
 
 	update_serial(refcon, iter);
-	updateInterfaceList(myInstance);
+	updateInterfaceListSoon(myInstance);
 }
 
 
@@ -1275,6 +1362,7 @@ watcher_remove(MyType *myInstance)
 {
 	watcher_remove_lan(myInstance);
 	watcher_remove_serial(myInstance);
+	updateInterfaceListCancel(myInstance);
 
 	if (myInstance->interfaces_known != NULL) {
 		CFRelease(myInstance->interfaces_known);
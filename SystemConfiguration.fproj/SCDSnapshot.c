@@ -79,3 +79,71 @@ SCDynamicStoreSnapshot(SCDynamicStoreRef store)
 
 	return TRUE;
 }
+
+
+CFDictionaryRef
+SCDynamicStoreCopyStatistics(SCDynamicStoreRef store)
+{
+	SCDynamicStorePrivateRef	storePrivate;
+	kern_return_t			status;
+	CFDictionaryRef			stats;
+	xmlDataOut_t			xmlDataRef	= NULL;		/* serialized data */
+	mach_msg_type_number_t		xmlDataLen	= 0;
+	int				sc_status;
+
+	if (store == NULL) {
+		store = __SCDynamicStoreNullSession();
+		if (store == NULL) {
+			/* sorry, you must provide a session */
+			_SCErrorSet(kSCStatusNoStoreSession);
+			return NULL;
+		}
+	}
+
+	storePrivate = (SCDynamicStorePrivateRef)store;
+	if (storePrivate->server == MACH_PORT_NULL) {
+		/* sorry, you must have an open session to play */
+		_SCErrorSet(kSCStatusNoStoreServer);
+		return NULL;
+	}
+
+#ifdef	VERBOSE_ACTIVITY_LOGGING
+	os_activity_scope(storePrivate->activity);
+#endif	// VERBOSE_ACTIVITY_LOGGING
+
+    retry :
+
+	status = statistics(storePrivate->server,
+			    &xmlDataRef,
+			    &xmlDataLen,
+			    (int *)&sc_status);
+
+	if (__SCDynamicStoreCheckRetryAndHandleError(store,
+						     status,
+						     &sc_status,
+						     "SCDynamicStoreCopyStatistics statistics()")) {
+		goto retry;
+	}
+
+	if (sc_status != kSCStatusOK) {
+		if (xmlDataRef != NULL) {
+			(void) vm_deallocate(mach_task_self(), (vm_address_t)xmlDataRef, xmlDataLen);
+		}
+		_SCErrorSet(sc_status);
+		return NULL;
+	}
+
+	/* un-serialize the statistics */
+	if (!_SCUnserialize((CFPropertyListRef *)&stats, NULL, xmlDataRef, xmlDataLen)) {
+		_SCErrorSet(kSCStatusFailed);
+		return NULL;
+	}
+
+	if (!isA_CFDictionary(stats)) {
+		if (stats != NULL) CFRelease(stats);
+		_SCErrorSet(kSCStatusFailed);
+		return NULL;
+	}
+
+	return stats;
+}
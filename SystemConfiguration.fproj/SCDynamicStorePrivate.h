@@ -230,6 +230,18 @@ SCDynamicStoreSetDisconnectCallBack	(
 Boolean
 SCDynamicStoreSnapshot			(SCDynamicStoreRef		store);
 
+/*!
+	@function SCDynamicStoreCopyStatistics
+	@discussion Returns the "configd" server's request, notification,
+		and pattern matching statistics.  Requires root access.
+	@param store The dynamic store session.
+	@result Returns a dictionary of statistics; NULL if an error
+		was encountered.
+		You must release the returned value.
+ */
+CFDictionaryRef
+SCDynamicStoreCopyStatistics		(SCDynamicStoreRef		store);
+
 __END_DECLS
 
 #endif	/* _SCDYNAMICSTOREPRIVATE_H */
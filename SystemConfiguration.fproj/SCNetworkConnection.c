@@ -61,6 +61,7 @@
 #include <arpa/inet.h>
 #include <netdb.h>
 #include <unistd.h>
+#include <limits.h>
 #include <sys/ioctl.h>
 #include <sys/socket.h>
 #include <net/if.h>
@@ -3003,6 +3004,8 @@ static int		notify_userprefs_token	= -1;
 
 static CFDictionaryRef	onDemand_configuration	= NULL;
 static Boolean		onDemand_force_refresh	= FALSE;
+static unsigned int	onDemand_fetch_count	= 0;
+static uint64_t		onDemand_generation	= 0;
 static pthread_mutex_t	onDemand_notify_lock	= PTHREAD_MUTEX_INITIALIZER;
 static int		onDemand_notify_token	= -1;
 
@@ -3171,9 +3174,11 @@ static CFDictionaryRef
 __SCNetworkConnectionCopyOnDemandConfiguration(void)
 {
 	int			changed		= 1;
+	CFDictionaryRef		configuration;
+	Boolean			fetch		= FALSE;
+	uint64_t		generation;
 	int			status;
 	uint64_t		triggersCount	= 0;
-	CFDictionaryRef		configuration;
 
 	pthread_mutex_lock(&onDemand_notify_lock);
 	if (onDemand_notify_token == -1) {
@@ -3203,30 +3208,67 @@ __SCNetworkConnectionCopyOnDemandConfiguration(void)
 	}
 
 	if (changed || onDemand_force_refresh) {
-		CFStringRef	key;
-
-		SC_log(LOG_INFO, "OnDemand information %s",
-		       (onDemand_configuration == NULL) ? "fetched" : "updated");
-
-		if (onDemand_configuration != NULL) {
+		if ((triggersCount > 0) || onDemand_force_refresh) {
+			// fetch the new configuration (below)
+			fetch = TRUE;
+		} else if (onDemand_configuration != NULL) {
+			SC_log(LOG_INFO, "OnDemand information removed");
 			CFRelease(onDemand_configuration);
 			onDemand_configuration = NULL;
 		}
 
-		if ((triggersCount > 0) || onDemand_force_refresh) {
-			key = SCDynamicStoreKeyCreateNetworkGlobalEntity(NULL, kSCDynamicStoreDomainState, kSCEntNetOnDemand);
-			onDemand_configuration = SCDynamicStoreCopyValue(NULL, key);
-			CFRelease(key);
-			if ((onDemand_configuration != NULL) && !isA_CFDictionary(onDemand_configuration)) {
-				CFRelease(onDemand_configuration);
-				onDemand_configuration = NULL;
-			}
+		onDemand_force_refresh = FALSE;
+		onDemand_generation++;
+	}
+
+	generation = onDemand_generation;
+	if (!fetch) {
+		// steady state, return the cached snapshot
+		configuration = (onDemand_configuration != NULL) ? CFRetain(onDemand_configuration) : NULL;
+		pthread_mutex_unlock(&onDemand_notify_lock);
+		return configuration;
+	}
+
+	pthread_mutex_unlock(&onDemand_notify_lock);
+
+	/*
+	 * fetch the configuration without holding the lock so that
+	 * other threads can continue to use the current snapshot
+	 */
+	{
+		CFStringRef	key;
+
+		key = SCDynamicStoreKeyCreateNetworkGlobalEntity(NULL, kSCDynamicStoreDomainState, kSCEntNetOnDemand);
+		configuration = SCDynamicStoreCopyValue(NULL, key);
+		CFRelease(key);
+		if ((configuration != NULL) && !isA_CFDictionary(configuration)) {
+			CFRelease(configuration);
+			configuration = NULL;
 		}
+	}
 
-		onDemand_force_refresh = FALSE;
+	pthread_mutex_lock(&onDemand_notify_lock);
+
+	onDemand_fetch_count++;
+	if (generation != onDemand_generation) {
+		// a newer change was noticed while fetching, let that caller update the snapshot
+	} else if ((onDemand_configuration != NULL) &&
+		   (configuration != NULL) &&
+		   CFEqual(onDemand_configuration, configuration)) {
+		// if unchanged, keep the existing snapshot (and anything compiled from it)
+		CFRelease(configuration);
+		configuration = CFRetain(onDemand_configuration);
+	} else {
+		SC_log(LOG_INFO, "OnDemand information %s (fetch #%u)",
+		       (onDemand_configuration == NULL) ? "fetched" : "updated",
+		       onDemand_fetch_count);
+
+		if (onDemand_configuration != NULL) {
+			CFRelease(onDemand_configuration);
+		}
+		onDemand_configuration = (configuration != NULL) ? CFRetain(configuration) : NULL;
 	}
 
-	configuration = (onDemand_configuration != NULL) ? CFRetain(onDemand_configuration) : NULL;
 	pthread_mutex_unlock(&onDemand_notify_lock);
 
 	return configuration;
@@ -3246,159 +3288,536 @@ __SCNetworkConnectionForceOnDemandConfigurationRefresh(void)
 
 
 static Boolean
-__SCNetworkConnectionShouldNeverMatch(CFDictionaryRef trigger, CFStringRef hostName, pid_t client_pid)
+__SCNetworkConnectionShouldAlwaysConnect(CFDictionaryRef trigger)
 {
-	CFArrayRef	exceptedProcesses;
-	CFIndex		exceptedProcessesCount;
-	CFIndex		exceptedProcessesIndex;
-	CFArrayRef	exceptions;
-	CFIndex		exceptionsCount;
-	int		exceptionsIndex;
+	CFStringRef action = CFDictionaryGetValue(trigger, kSCPropNetVPNOnDemandRuleAction);
+	return (isA_CFString(action) && CFEqual(action, kSCValNetVPNOnDemandRuleActionConnect));
+}
 
-	// we have a matching domain, check against exception list
-	exceptions = CFDictionaryGetValue(trigger, kSCNetworkConnectionOnDemandMatchDomainsNever);
-	exceptionsCount = isA_CFArray(exceptions) ? CFArrayGetCount(exceptions) : 0;
-	for (exceptionsIndex = 0; exceptionsIndex < exceptionsCount; exceptionsIndex++) {
-		CFStringRef	exception;
-
-		exception = CFArrayGetValueAtIndex(exceptions, exceptionsIndex);
-		if (isA_CFString(exception) && _SC_domainEndsWithDomain(hostName, exception)) {
-			// found matching exception
-			SC_log(LOG_INFO, "OnDemand match exception");
-			return TRUE;
+
+static Boolean
+__SCNetworkConnectionShouldIgnoreTrigger(CFDictionaryRef trigger)
+{
+	CFStringRef	action		= CFDictionaryGetValue(trigger, kSCPropNetVPNOnDemandRuleAction);
+
+	if (isA_CFString(action) &&
+	    (CFEqual(action, kSCValNetVPNOnDemandRuleActionIgnore) ||
+	     CFEqual(action, kSCValNetVPNOnDemandRuleActionDisconnect))) {
+		    return TRUE;
+	}
+
+	return FALSE;
+}
+
+
+#pragma mark -
+#pragma mark OnDemand trigger matching
+
+
+/*
+ * The OnDemand triggers are compiled once per configuration.  Each list of
+ * match domains is indexed by a trie keyed on the domain characters (in
+ * reverse order) so that a hostname can be checked against every domain in
+ * the list with a single pass.  The results must be the same as walking the
+ * list with _SC_domainEndsWithDomain(); any domain (or hostname) that cannot
+ * be indexed is checked with that function instead.
+ */
+
+#define	ONDEMAND_NO_MATCH	LONG_MAX
+#define	ONDEMAND_NAME_MAX	256
+
+typedef struct {
+	uint32_t		child;		// first child node (0 if none)
+	uint32_t		sibling;	// next sibling node (0 if none)
+	CFIndex			ordinal;	// first domain ending at this node
+	UInt8			ch;
+} onDemandDomainNode;
+
+typedef struct {
+	CFMutableArrayRef	domains;	// [ordinal] = match domain
+	onDemandDomainNode	*nodes;		// [0] = root
+	uint32_t		nodesCount;
+	uint32_t		nodesSize;
+	CFIndex			wildcard;	// first "*" domain
+	CFIndex			*unindexed;	// domains not in the trie (ascending)
+	CFIndex			unindexedCount;
+} onDemandDomainList;
+
+typedef enum {
+	kOnDemandTriggerInvalid	= 0,	// not a trigger dictionary
+	kOnDemandTriggerConnect,	// "Connect" action
+	kOnDemandTriggerIgnore,		// "Ignore" or "Disconnect" action
+	kOnDemandTriggerEvaluate,	// action w/parameters
+	kOnDemandTriggerDomains		// "always" and "on retry" domain lists
+} onDemandTriggerType;
+
+typedef struct {
+	CFDictionaryRef		trigger;
+	onDemandTriggerType	type;
+	onDemandDomainList	match;		// "always" or evaluated domains
+	CFMutableArrayRef	rules;		// [ordinal] = evaluated domain rule
+	onDemandDomainList	onRetry;
+	onDemandDomainList	never;
+	int			*pids;
+	CFIndex			pidsCount;
+} onDemandTrigger;
+
+typedef struct {
+	CFDictionaryRef		configuration;
+	CFIndex			triggersCount;
+	onDemandTrigger		*triggers;
+} onDemandMatcher;
+
+typedef struct {
+	CFStringRef		name;
+	const UInt8		*bytes;		// NULL if not indexable
+	CFIndex			length;
+	UInt8			buf[ONDEMAND_NAME_MAX];
+} onDemandHostName;
+
+static onDemandMatcher	*onDemand_matcher	= NULL;
+static pthread_mutex_t	onDemand_matcher_lock	= PTHREAD_MUTEX_INITIALIZER;
+
+
+static Boolean
+__onDemandGetASCII(CFStringRef str, UInt8 *buf, CFIndex bufSize, CFIndex *len)
+{
+	CFIndex	n;
+
+	n = CFStringGetLength(str);
+	if ((n > bufSize) ||
+	    (CFStringGetBytes(str, CFRangeMake(0, n), kCFStringEncodingASCII, 0, FALSE, buf, bufSize, len) != n)) {
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+
+static void
+__onDemandDomainListAdd(onDemandDomainList *list, CFStringRef domain)
+{
+	if (list->domains == NULL) {
+		list->domains = CFArrayCreateMutable(NULL, 0, &kCFTypeArrayCallBacks);
+	}
+	CFArrayAppendValue(list->domains, domain);
+	return;
+}
+
+
+static void
+__onDemandDomainListAddArray(onDemandDomainList *list, CFArrayRef domains)
+{
+	CFIndex	n;
+
+	n = isA_CFArray(domains) ? CFArrayGetCount(domains) : 0;
+	for (CFIndex i = 0; i < n; i++) {
+		CFStringRef	domain;
+
+		domain = CFArrayGetValueAtIndex(domains, i);
+		if (isA_CFString(domain)) {
+			__onDemandDomainListAdd(list, domain);
 		}
 	}
 
-	if (client_pid != 0) {
-		exceptedProcesses = CFDictionaryGetValue(trigger, kSCNetworkConnectionOnDemandPluginPIDs);
-		exceptedProcessesCount = isA_CFArray(exceptedProcesses) ? CFArrayGetCount(exceptedProcesses) : 0;
-		for (exceptedProcessesIndex = 0; exceptedProcessesIndex < exceptedProcessesCount; exceptedProcessesIndex++) {
-			int		pid;
-			CFNumberRef	pidRef;
-
-			pidRef = CFArrayGetValueAtIndex(exceptedProcesses, exceptedProcessesIndex);
-			if (isA_CFNumber(pidRef) && CFNumberGetValue(pidRef, kCFNumberIntType, &pid)) {
-				if (pid == client_pid) {
-					return TRUE;
-				}
+	return;
+}
+
+
+static void
+__onDemandDomainListInsert(onDemandDomainList *list, const UInt8 *domain, CFIndex len, CFIndex ordinal)
+{
+	uint32_t	node	= 0;
+
+	for (CFIndex i = len - 1; i >= 0; i--) {
+		uint32_t	child;
+
+		for (child = list->nodes[node].child; child != 0; child = list->nodes[child].sibling) {
+			if (list->nodes[child].ch == domain[i]) {
+				break;
 			}
 		}
+
+		if (child == 0) {
+			if (list->nodesCount == list->nodesSize) {
+				list->nodesSize *= 2;
+				list->nodes = reallocf(list->nodes, list->nodesSize * sizeof(onDemandDomainNode));
+			}
+			child = list->nodesCount++;
+			list->nodes[child].child   = 0;
+			list->nodes[child].sibling = list->nodes[node].child;
+			list->nodes[child].ordinal = ONDEMAND_NO_MATCH;
+			list->nodes[child].ch      = domain[i];
+			list->nodes[node].child    = child;
+		}
+
+		node = child;
 	}
 
-	return FALSE;
+	if (ordinal < list->nodes[node].ordinal) {
+		list->nodes[node].ordinal = ordinal;
+	}
+
+	return;
 }
 
-static CFStringRef
-__SCNetworkConnectionDomainGetMatchWithParameters(CFStringRef action, CFPropertyListRef actionParameters, CFStringRef hostName, CFStringRef *probeString)
+
+static void
+__onDemandDomainListCompile(onDemandDomainList *list)
 {
-	CFArrayRef	actionArray = NULL;
-	CFIndex		actionArraySize = 0;
-	CFIndex		i;
-	CFStringRef	matchDomain	= NULL;
+	CFIndex	n;
 
-	/* For now, only support EvaluateConnection, which takes a CFArray */
-	if (!CFEqual(action, kSCValNetVPNOnDemandRuleActionEvaluateConnection) || !isA_CFArray(actionParameters)) {
-		return NULL;
+	list->wildcard = ONDEMAND_NO_MATCH;
+
+	n = (list->domains != NULL) ? CFArrayGetCount(list->domains) : 0;
+	if (n == 0) {
+		return;
 	}
 
-	actionArray = (CFArrayRef)actionParameters;
-	actionArraySize = CFArrayGetCount(actionArray);
+	list->nodesSize = 64;
+	list->nodesCount = 1;
+	list->nodes = calloc(list->nodesSize, sizeof(onDemandDomainNode));
+	list->nodes[0].ordinal = ONDEMAND_NO_MATCH;
+	list->unindexed = malloc(n * sizeof(CFIndex));
+	list->unindexedCount = 0;
 
-	/* Process domain rules, with actions of ConnectIfNeeded and NeverConnect */
-	for (i = 0; i < actionArraySize; i++) {
-		CFStringRef	domainAction = NULL;
-		CFDictionaryRef	domainRule = CFArrayGetValueAtIndex(actionArray, i);
-		CFArrayRef	domains = NULL;
-		CFIndex		domainsCount = 0;
-		CFIndex		domainsIndex;
+	for (CFIndex i = 0; i < n; i++) {
+		UInt8		buf[ONDEMAND_NAME_MAX];
+		CFStringRef	domain;
+		CFIndex		len	= 0;
+		CFIndex		start	= 0;
 
-		if (!isA_CFDictionary(domainRule)) {
+		domain = CFArrayGetValueAtIndex(list->domains, i);
+		if (CFEqual(domain, WILD_CARD_MATCH_STR)) {
+			if (list->wildcard == ONDEMAND_NO_MATCH) {
+				list->wildcard = i;
+			}
 			continue;
 		}
 
-		domains = CFDictionaryGetValue(domainRule, kSCPropNetVPNOnDemandRuleActionParametersDomains);
-		if (!isA_CFArray(domains)) {
+		if (!__onDemandGetASCII(domain, buf, sizeof(buf), &len)) {
+			list->unindexed[list->unindexedCount++] = i;
 			continue;
 		}
 
-		domainsCount = CFArrayGetCount(domains);
-		for (domainsIndex = 0; domainsIndex < domainsCount; domainsIndex++) {
+		// trim the domain the same way as _SC_domainEndsWithDomain()
+		if ((len > 0) && (buf[len - 1] == '.')) {
+			len--;
+		}
+		if ((len >= 2) && (buf[0] == '*') && (buf[1] == '.')) {
+			start = 2;
+		}
+		if (len == start) {
+			list->unindexed[list->unindexedCount++] = i;
+			continue;
+		}
+
+		__onDemandDomainListInsert(list, &buf[start], len - start, i);
+	}
+
+	return;
+}
+
+
+static void
+__onDemandDomainListFree(onDemandDomainList *list)
+{
+	if (list->domains != NULL) CFRelease(list->domains);
+	if (list->nodes != NULL) free(list->nodes);
+	if (list->unindexed != NULL) free(list->unindexed);
+	return;
+}
+
+
+/*
+ * return the ordinal of the first domain in the list that the hostname
+ * ends with (or kCFNotFound)
+ */
+static CFIndex
+__onDemandDomainListGetMatch(const onDemandDomainList *list, const onDemandHostName *host)
+{
+	CFIndex		match;
+	CFIndex		n;
+	uint32_t	node	= 0;
+
+	n = (list->domains != NULL) ? CFArrayGetCount(list->domains) : 0;
+	if (n == 0) {
+		return kCFNotFound;
+	}
+
+	if (host->bytes == NULL) {
+		// if the hostname was not indexable, check each domain
+		for (CFIndex i = 0; i < n; i++) {
+			if (_SC_domainEndsWithDomain(host->name, CFArrayGetValueAtIndex(list->domains, i))) {
+				return i;
+			}
+		}
+		return kCFNotFound;
+	}
+
+	match = list->wildcard;
+	for (CFIndex i = host->length - 1; (i >= 0) && (match > 0); i--) {
+		uint32_t	child;
+
+		for (child = list->nodes[node].child; child != 0; child = list->nodes[child].sibling) {
+			if (list->nodes[child].ch == host->bytes[i]) {
+				break;
+			}
+		}
+		if (child == 0) {
+			break;
+		}
+
+		node = child;
+		if (list->nodes[node].ordinal < match) {
+			match = list->nodes[node].ordinal;
+		}
+	}
+
+	for (CFIndex i = 0; i < list->unindexedCount; i++) {
+		CFIndex	ordinal	= list->unindexed[i];
+
+		if (ordinal >= match) {
+			break;
+		}
+		if (_SC_domainEndsWithDomain(host->name, CFArrayGetValueAtIndex(list->domains, ordinal))) {
+			match = ordinal;
+			break;
+		}
+	}
+
+	return (match != ONDEMAND_NO_MATCH) ? match : kCFNotFound;
+}
+
+
+static void
+__onDemandTriggerCompileRules(onDemandTrigger *compiled, CFArrayRef actionArray)
+{
+	CFIndex	n;
+
+	/* Process domain rules, with actions of ConnectIfNeeded and NeverConnect */
+	n = CFArrayGetCount(actionArray);
+	for (CFIndex i = 0; i < n; i++) {
+		CFDictionaryRef	domainRule	= CFArrayGetValueAtIndex(actionArray, i);
+		CFArrayRef	domains;
+		CFIndex		domainsCount;
+
+		if (!isA_CFDictionary(domainRule)) {
+			continue;
+		}
+
+		domains = CFDictionaryGetValue(domainRule, kSCPropNetVPNOnDemandRuleActionParametersDomains);
+		domainsCount = isA_CFArray(domains) ? CFArrayGetCount(domains) : 0;
+		for (CFIndex domainsIndex = 0; domainsIndex < domainsCount; domainsIndex++) {
 			CFStringRef	domain;
+
 			domain = CFArrayGetValueAtIndex(domains, domainsIndex);
-			if (isA_CFString(domain) && _SC_domainEndsWithDomain(hostName, domain)) {
-				matchDomain = domain;
-				break;
+			if (!isA_CFString(domain)) {
+				continue;
+			}
+
+			if (compiled->rules == NULL) {
+				compiled->rules = CFArrayCreateMutable(NULL, 0, &kCFTypeArrayCallBacks);
 			}
+			__onDemandDomainListAdd(&compiled->match, domain);
+			CFArrayAppendValue(compiled->rules, domainRule);
 		}
+	}
 
-		if (matchDomain) {
-			domainAction = CFDictionaryGetValue(domainRule, kSCPropNetVPNOnDemandRuleActionParametersDomainAction);
-			if (isA_CFString(domainAction) && CFEqual(domainAction, kSCValNetVPNOnDemandRuleActionParametersDomainActionNeverConnect)) {
-				return NULL;
-			} else {
-				/* If we found a match, save the optional probe string as well */
-				if (probeString) {
-					*probeString = CFDictionaryGetValue(domainRule, kSCPropNetVPNOnDemandRuleActionParametersRequiredURLStringProbe);
+	return;
+}
+
+
+static void
+__onDemandTriggerCompile(onDemandTrigger *compiled, CFDictionaryRef trigger)
+{
+	if (!isA_CFDictionary(trigger)) {
+		// if not a valid "OnDemand" configuration
+		compiled->type = kOnDemandTriggerInvalid;
+	} else if (__SCNetworkConnectionShouldAlwaysConnect(trigger)) {
+		compiled->type = kOnDemandTriggerConnect;
+	} else if (__SCNetworkConnectionShouldIgnoreTrigger(trigger)) {
+		compiled->type = kOnDemandTriggerIgnore;
+	} else {
+		CFStringRef		action;
+		CFPropertyListRef	actionParameters;
+
+		action = CFDictionaryGetValue(trigger, kSCPropNetVPNOnDemandRuleAction);
+		actionParameters = CFDictionaryGetValue(trigger, kSCPropNetVPNOnDemandRuleActionParameters);
+		if ((action != NULL) && (actionParameters != NULL)) {
+			compiled->type = kOnDemandTriggerEvaluate;
+
+			/* For now, only support EvaluateConnection, which takes a CFArray */
+			if (CFEqual(action, kSCValNetVPNOnDemandRuleActionEvaluateConnection) && isA_CFArray(actionParameters)) {
+				__onDemandTriggerCompileRules(compiled, actionParameters);
+			}
+		} else {
+			/* Old configuration: always, never, on retry lists */
+			compiled->type = kOnDemandTriggerDomains;
+			__onDemandDomainListAddArray(&compiled->match,
+						     CFDictionaryGetValue(trigger, kSCNetworkConnectionOnDemandMatchDomainsAlways));
+			__onDemandDomainListAddArray(&compiled->onRetry,
+						     CFDictionaryGetValue(trigger, kSCNetworkConnectionOnDemandMatchDomainsOnRetry));
+		}
+	}
+
+	if ((compiled->type == kOnDemandTriggerConnect) ||
+	    (compiled->type == kOnDemandTriggerEvaluate) ||
+	    (compiled->type == kOnDemandTriggerDomains)) {
+		CFArrayRef	exceptedProcesses;
+		CFIndex		n;
+
+		compiled->trigger = trigger;
+
+		__onDemandDomainListAddArray(&compiled->never,
+					     CFDictionaryGetValue(trigger, kSCNetworkConnectionOnDemandMatchDomainsNever));
+
+		exceptedProcesses = CFDictionaryGetValue(trigger, kSCNetworkConnectionOnDemandPluginPIDs);
+		n = isA_CFArray(exceptedProcesses) ? CFArrayGetCount(exceptedProcesses) : 0;
+		if (n > 0) {
+			compiled->pids = malloc(n * sizeof(int));
+			for (CFIndex i = 0; i < n; i++) {
+				int		pid;
+				CFNumberRef	pidRef;
+
+				pidRef = CFArrayGetValueAtIndex(exceptedProcesses, i);
+				if (isA_CFNumber(pidRef) && CFNumberGetValue(pidRef, kCFNumberIntType, &pid)) {
+					compiled->pids[compiled->pidsCount++] = pid;
 				}
-				break;
 			}
 		}
 	}
 
-	return matchDomain;
+	__onDemandDomainListCompile(&compiled->match);
+	__onDemandDomainListCompile(&compiled->onRetry);
+	__onDemandDomainListCompile(&compiled->never);
+	return;
 }
 
-static CFStringRef
-__SCNetworkConnectionDomainGetMatch(CFDictionaryRef trigger, CFStringRef hostName, Boolean onDemandRetry)
+
+static void
+__onDemandMatcherFree(onDemandMatcher *matcher)
 {
-	CFArrayRef	domains;
-	CFIndex		domainsCount;
-	int		domainsIndex;
-	CFStringRef	key;
-	CFStringRef	match_domain	= NULL;
-
-	/* Old configuration: always, never, on retry lists */
-	key = onDemandRetry ? kSCNetworkConnectionOnDemandMatchDomainsOnRetry : kSCNetworkConnectionOnDemandMatchDomainsAlways;
-
-	domains = CFDictionaryGetValue(trigger, key);
-	domainsCount = isA_CFArray(domains) ? CFArrayGetCount(domains) : 0;
-	for (domainsIndex = 0; domainsIndex < domainsCount; domainsIndex++) {
-		CFStringRef	domain;
+	for (CFIndex i = 0; i < matcher->triggersCount; i++) {
+		onDemandTrigger	*compiled	= &matcher->triggers[i];
+
+		__onDemandDomainListFree(&compiled->match);
+		__onDemandDomainListFree(&compiled->onRetry);
+		__onDemandDomainListFree(&compiled->never);
+		if (compiled->rules != NULL) CFRelease(compiled->rules);
+		if (compiled->pids != NULL) free(compiled->pids);
+	}
+	if (matcher->triggers != NULL) free(matcher->triggers);
+	CFRelease(matcher->configuration);
+	free(matcher);
+	return;
+}
 
-		domain = CFArrayGetValueAtIndex(domains, domainsIndex);
-		if (isA_CFString(domain) && _SC_domainEndsWithDomain(hostName, domain)) {
-			match_domain = domain;
-			break;
+
+static onDemandMatcher *
+__onDemandMatcherCreate(CFDictionaryRef configuration)
+{
+	onDemandMatcher	*matcher;
+	CFArrayRef	triggers;
+
+	matcher = calloc(1, sizeof(*matcher));
+	matcher->configuration = CFRetain(configuration);
+
+	triggers = CFDictionaryGetValue(configuration, kSCNetworkConnectionOnDemandTriggers);
+	matcher->triggersCount = isA_CFArray(triggers) ? CFArrayGetCount(triggers) : 0;
+	if (matcher->triggersCount > 0) {
+		matcher->triggers = calloc(matcher->triggersCount, sizeof(onDemandTrigger));
+		for (CFIndex i = 0; i < matcher->triggersCount; i++) {
+			__onDemandTriggerCompile(&matcher->triggers[i], CFArrayGetValueAtIndex(triggers, i));
 		}
 	}
 
-	return match_domain;
+	return matcher;
 }
 
 
-static Boolean
-__SCNetworkConnectionShouldAlwaysConnect(CFDictionaryRef trigger)
+/*
+ * return the compiled matcher for the configuration, rebuilding it
+ * if the configuration has changed.  Must be called with the
+ * onDemand_matcher_lock held.
+ */
+static const onDemandMatcher *
+__onDemandMatcherGet(CFDictionaryRef configuration)
 {
-	CFStringRef action = CFDictionaryGetValue(trigger, kSCPropNetVPNOnDemandRuleAction);
-	return (isA_CFString(action) && CFEqual(action, kSCValNetVPNOnDemandRuleActionConnect));
+	if ((onDemand_matcher != NULL) && (onDemand_matcher->configuration != configuration)) {
+		__onDemandMatcherFree(onDemand_matcher);
+		onDemand_matcher = NULL;
+	}
+
+	if (onDemand_matcher == NULL) {
+		onDemand_matcher = __onDemandMatcherCreate(configuration);
+	}
+
+	return onDemand_matcher;
 }
 
 
 static Boolean
-__SCNetworkConnectionShouldIgnoreTrigger(CFDictionaryRef trigger)
+__onDemandTriggerShouldNeverMatch(const onDemandTrigger *compiled, const onDemandHostName *host, pid_t client_pid)
 {
-	CFStringRef	action		= CFDictionaryGetValue(trigger, kSCPropNetVPNOnDemandRuleAction);
+	// we have a matching domain, check against exception list
+	if (__onDemandDomainListGetMatch(&compiled->never, host) != kCFNotFound) {
+		// found matching exception
+		SC_log(LOG_INFO, "OnDemand match exception");
+		return TRUE;
+	}
 
-	if (isA_CFString(action) &&
-	    (CFEqual(action, kSCValNetVPNOnDemandRuleActionIgnore) ||
-	     CFEqual(action, kSCValNetVPNOnDemandRuleActionDisconnect))) {
-		    return TRUE;
+	if (client_pid != 0) {
+		for (CFIndex i = 0; i < compiled->pidsCount; i++) {
+			if (compiled->pids[i] == client_pid) {
+				return TRUE;
+			}
+		}
 	}
 
 	return FALSE;
 }
 
 
+static CFStringRef
+__onDemandTriggerGetMatchWithParameters(const onDemandTrigger *compiled, const onDemandHostName *host, CFStringRef *probeString)
+{
+	CFStringRef	domainAction;
+	CFDictionaryRef	domainRule;
+	CFIndex		ordinal;
+
+	ordinal = __onDemandDomainListGetMatch(&compiled->match, host);
+	if (ordinal == kCFNotFound) {
+		return NULL;
+	}
+
+	domainRule = CFArrayGetValueAtIndex(compiled->rules, ordinal);
+	domainAction = CFDictionaryGetValue(domainRule, kSCPropNetVPNOnDemandRuleActionParametersDomainAction);
+	if (isA_CFString(domainAction) && CFEqual(domainAction, kSCValNetVPNOnDemandRuleActionParametersDomainActionNeverConnect)) {
+		return NULL;
+	}
+
+	/* If we found a match, save the optional probe string as well */
+	if (probeString) {
+		*probeString = CFDictionaryGetValue(domainRule, kSCPropNetVPNOnDemandRuleActionParametersRequiredURLStringProbe);
+	}
+
+	return CFArrayGetValueAtIndex(compiled->match.domains, ordinal);
+}
+
+
+static CFStringRef
+__onDemandTriggerGetMatch(const onDemandTrigger *compiled, const onDemandHostName *host, Boolean onDemandRetry)
+{
+	const onDemandDomainList	*list;
+	CFIndex				ordinal;
+
+	list = onDemandRetry ? &compiled->onRetry : &compiled->match;
+	ordinal = __onDemandDomainListGetMatch(list, host);
+	return (ordinal != kCFNotFound) ? CFArrayGetValueAtIndex(list->domains, ordinal) : NULL;
+}
+
+
 static CFDictionaryRef
 __SCNetworkConnectionCopyMatchingTriggerWithName(CFDictionaryRef	configuration,
 						 CFStringRef		hostName,
@@ -3408,11 +3827,11 @@ __SCNetworkConnectionCopyMatchingTriggerWithName(CFDictionaryRef	configuration,
 						 Boolean		*triggerNow,
 						 CFStringRef		*probe_string)
 {
-	CFDictionaryRef	result		= NULL;
-	int		sc_status	= kSCStatusOK;
-	CFArrayRef	triggers;
-	CFIndex		triggersCount	= 0;
-	Boolean		usedOnDemandRetry = FALSE;
+	onDemandHostName	host;
+	const onDemandMatcher	*matcher;
+	CFDictionaryRef		result		= NULL;
+	int			sc_status	= kSCStatusOK;
+	Boolean			usedOnDemandRetry = FALSE;
 
 	if (triggerNow != NULL) {
 		*triggerNow = FALSE;
@@ -3422,61 +3841,66 @@ __SCNetworkConnectionCopyMatchingTriggerWithName(CFDictionaryRef	configuration,
 		*match_info = NULL;
 	}
 
-	triggers = CFDictionaryGetValue(configuration, kSCNetworkConnectionOnDemandTriggers);
-	triggersCount = isA_CFArray(triggers) ? CFArrayGetCount(triggers) : 0;
-	for (CFIndex triggersIndex = 0; triggersIndex < triggersCount; triggersIndex++) {
-		CFStringRef	matched_domain	= NULL;
-		CFStringRef	matched_probe_string = NULL;
-		CFDictionaryRef	trigger;
-		Boolean		trigger_matched	= FALSE;
+	host.name = hostName;
+	host.bytes = NULL;
+	host.length = 0;
+	if (__onDemandGetASCII(hostName, host.buf, sizeof(host.buf), &host.length)) {
+		if ((host.length > 0) && (host.buf[host.length - 1] == '.')) {
+			host.length--;
+		}
+		host.bytes = host.buf;
+	}
 
-		usedOnDemandRetry = FALSE;
+	pthread_mutex_lock(&onDemand_matcher_lock);
 
-		trigger = CFArrayGetValueAtIndex(triggers, triggersIndex);
-		if (!isA_CFDictionary(trigger)) {
-			// if not a valid "OnDemand" configuration
-			continue;
-		}
+	matcher = __onDemandMatcherGet(configuration);
+	for (CFIndex triggersIndex = 0; triggersIndex < matcher->triggersCount; triggersIndex++) {
+		const onDemandTrigger	*compiled	= &matcher->triggers[triggersIndex];
+		CFStringRef		matched_domain	= NULL;
+		CFStringRef		matched_probe_string = NULL;
+		Boolean			trigger_matched	= FALSE;
+
+		usedOnDemandRetry = FALSE;
 
-		if (__SCNetworkConnectionShouldAlwaysConnect(trigger)) {
-			/* If the trigger action is 'Connect', always match this trigger */
-			/* First check the never match list */
-			if (__SCNetworkConnectionShouldNeverMatch(trigger, hostName, client_pid)) {
+		switch (compiled->type) {
+			case kOnDemandTriggerInvalid :
 				continue;
-			}
-			trigger_matched = TRUE;
-		} else if (__SCNetworkConnectionShouldIgnoreTrigger(trigger)) {
-			/* If the trigger action is 'Ignore' or 'Disconnect', skip this trigger */
-			sc_status = kSCStatusConnectionIgnore;
-			continue;
-		} else {
-			CFStringRef action = CFDictionaryGetValue(trigger, kSCPropNetVPNOnDemandRuleAction);
-			CFArrayRef actionParameters = CFDictionaryGetValue(trigger, kSCPropNetVPNOnDemandRuleActionParameters);
-			if (action && actionParameters) {
-				matched_domain = __SCNetworkConnectionDomainGetMatchWithParameters(action, actionParameters, hostName, &matched_probe_string);
+			case kOnDemandTriggerConnect :
+				/* If the trigger action is 'Connect', always match this trigger */
+				/* First check the never match list */
+				if (__onDemandTriggerShouldNeverMatch(compiled, &host, client_pid)) {
+					continue;
+				}
+				trigger_matched = TRUE;
+				break;
+			case kOnDemandTriggerIgnore :
+				/* If the trigger action is 'Ignore' or 'Disconnect', skip this trigger */
+				sc_status = kSCStatusConnectionIgnore;
+				continue;
+			case kOnDemandTriggerEvaluate :
+				matched_domain = __onDemandTriggerGetMatchWithParameters(compiled, &host, &matched_probe_string);
 				usedOnDemandRetry = TRUE;
-			} else {
+				break;
+			case kOnDemandTriggerDomains :
 				if (onDemandRetry) {
-					matched_domain = __SCNetworkConnectionDomainGetMatch(trigger, hostName, TRUE);
+					matched_domain = __onDemandTriggerGetMatch(compiled, &host, TRUE);
 					usedOnDemandRetry = TRUE;
 				} else {
-					matched_domain = __SCNetworkConnectionDomainGetMatch(trigger, hostName, FALSE);
+					matched_domain = __onDemandTriggerGetMatch(compiled, &host, FALSE);
 					if (matched_domain == NULL && result == NULL) {
 						/* Check the retry list if Always failed */
-						matched_domain = __SCNetworkConnectionDomainGetMatch(trigger, hostName, TRUE);
+						matched_domain = __onDemandTriggerGetMatch(compiled, &host, TRUE);
 						usedOnDemandRetry = TRUE;
 					}
 				}
-			}
+				break;
+		}
 
-			if (matched_domain) {
-				if (__SCNetworkConnectionShouldNeverMatch(trigger, hostName, client_pid)) {
-					matched_domain = NULL;
-					continue;
-				} else {
-					trigger_matched = TRUE;
-				}
+		if (matched_domain) {
+			if (__onDemandTriggerShouldNeverMatch(compiled, &host, client_pid)) {
+				continue;
 			}
+			trigger_matched = TRUE;
 		}
 
 		if (trigger_matched) {
@@ -3521,7 +3945,7 @@ __SCNetworkConnectionCopyMatchingTriggerWithName(CFDictionaryRef	configuration,
 				}
 			}
 
-			result = trigger;
+			result = compiled->trigger;
 
 			/* If retry was requested, or we found Always match, trigger now */
 			if (onDemandRetry || !usedOnDemandRetry) {
@@ -3540,6 +3964,8 @@ __SCNetworkConnectionCopyMatchingTriggerWithName(CFDictionaryRef	configuration,
 		CFRetain(result);
 	}
 
+	pthread_mutex_unlock(&onDemand_matcher_lock);
+
 	_SCErrorSet(sc_status);
 	return result;
 }
@@ -4167,8 +4593,224 @@ __SCNetworkConnectionIPv6AddressMatchesRoutes (struct sockaddr_in6 *addr_in6, CF
 }
 
 
+/*
+ * Route sets are compiled into a binary prefix trie (one node per bit) so
+ * that an address can be checked against all of the routes with a single
+ * walk of at most 32 (or 128) bits.  The compiled tries are cached for the
+ * current OnDemand configuration.  A route set with a non-contiguous mask
+ * cannot be represented in the trie and is matched with the linear scan.
+ */
+
+typedef struct {
+	uint32_t	child[2];	// 0 if none
+	Boolean		route;		// a route prefix ends at this node
+} routeTrieNode;
+
+static CFDictionaryRef		routes_configuration	= NULL;
+static CFMutableDictionaryRef	routes_compiled		= NULL;		// [routes] = CFData (trie) or kCFNull
+static pthread_mutex_t		routes_lock		= PTHREAD_MUTEX_INITIALIZER;
+
+
+#define	ROUTE_BIT(addr, bit)	(((addr)[(bit) / 8] >> (7 - ((bit) % 8))) & 0x01)
+
+
+static int
+__SCNetworkConnectionRoutePrefixLength(const uint8_t *mask, size_t len)
+{
+	int	prefix	= 0;
+	size_t	i;
+
+	for (i = 0; (i < len) && (mask[i] == 0xff); i++) {
+		prefix += 8;
+	}
+
+	if (i < len) {
+		uint8_t	byte	= mask[i++];
+
+		while ((byte & 0x80) != 0) {
+			byte <<= 1;
+			prefix++;
+		}
+		if (byte != 0) {
+			return -1;	// if not contiguous
+		}
+	}
+
+	for (; i < len; i++) {
+		if (mask[i] != 0) {
+			return -1;	// if not contiguous
+		}
+	}
+
+	return prefix;
+}
+
+
+static CFTypeRef
+__SCNetworkConnectionCreateRouteTrie(CFDictionaryRef routes, size_t addrLen)
+{
+	CFIndex			count;
+	CFDataRef		maskData;
+	const uint8_t		*masks		= NULL;
+	CFIndex			nodesCount;
+	CFDataRef		routeaddrData;
+	const uint8_t		*routeAddrs;
+	CFMutableDataRef	trie;
+
+	routeaddrData = CFDictionaryGetValue(routes, kSCNetworkConnectionNetworkInfoAddresses);
+	maskData = CFDictionaryGetValue(routes, kSCNetworkConnectionNetworkInfoMasks);
+
+	/* routeaddrData and maskData are packed arrays of addresses; make sure they have the same length */
+	if (!isA_CFData(routeaddrData) || (maskData && (!isA_CFData(maskData) || CFDataGetLength(routeaddrData) != CFDataGetLength(maskData)))) {
+		return CFRetain(kCFNull);
+	}
+
+	routeAddrs = CFDataGetBytePtr(routeaddrData);
+	if (maskData) {
+		masks = CFDataGetBytePtr(maskData);
+	}
+
+	trie = CFDataCreateMutable(NULL, 0);
+	CFDataSetLength(trie, sizeof(routeTrieNode));	// root (zero filled)
+	nodesCount = 1;
+
+	count = CFDataGetLength(routeaddrData) / addrLen;
+	for (CFIndex i = 0; i < count; i++) {
+		uint32_t		node	= 0;
+		routeTrieNode		*nodes;
+		int			prefix	= (int)(addrLen * 8);
+		const uint8_t		*routeAddr	= routeAddrs + (i * addrLen);
+
+		if (masks != NULL) {
+			prefix = __SCNetworkConnectionRoutePrefixLength(masks + (i * addrLen), addrLen);
+			if (prefix < 0) {
+				// if non-contiguous mask, use linear scan
+				CFRelease(trie);
+				return CFRetain(kCFNull);
+			}
+		}
+
+		nodes = (routeTrieNode *)(void *)CFDataGetMutableBytePtr(trie);
+		for (int bit = 0; (bit < prefix) && !nodes[node].route; bit++) {
+			int	b	= ROUTE_BIT(routeAddr, bit);
+
+			if (nodes[node].child[b] == 0) {
+				CFDataIncreaseLength(trie, sizeof(routeTrieNode));
+				nodes = (routeTrieNode *)(void *)CFDataGetMutableBytePtr(trie);
+				nodes[node].child[b] = (uint32_t)nodesCount++;
+			}
+			node = nodes[node].child[b];
+		}
+
+		// a shorter (or equal) prefix already covers this route
+		nodes[node].route = TRUE;
+	}
+
+	return trie;
+}
+
+
+static Boolean
+__SCNetworkConnectionRouteTrieMatches(CFDataRef trie, const uint8_t *addr, size_t addrLen)
+{
+	uint32_t		node	= 0;
+	const routeTrieNode	*nodes;
+
+	nodes = (const routeTrieNode *)(const void *)CFDataGetBytePtr(trie);
+	for (int bit = 0; bit < (int)(addrLen * 8); bit++) {
+		if (nodes[node].route) {
+			return TRUE;
+		}
+		node = nodes[node].child[ROUTE_BIT(addr, bit)];
+		if (node == 0) {
+			return FALSE;
+		}
+	}
+
+	return nodes[node].route;
+}
+
+
+static CFTypeRef
+__SCNetworkConnectionCopyRouteTrie(CFDictionaryRef configuration, CFDictionaryRef routes, size_t addrLen)
+{
+	CFTypeRef	trie;
+
+	pthread_mutex_lock(&routes_lock);
+
+	if (routes_configuration != configuration) {
+		// if the OnDemand configuration changed, flush the compiled routes
+		if (routes_configuration != NULL) {
+			CFRelease(routes_configuration);
+		}
+		routes_configuration = CFRetain(configuration);
+		if (routes_compiled != NULL) {
+			CFDictionaryRemoveAllValues(routes_compiled);
+		}
+	}
+
+	if (routes_compiled == NULL) {
+		CFDictionaryKeyCallBacks	keyCallBacks	= kCFTypeDictionaryKeyCallBacks;
+
+		// route sets are keyed by identity
+		keyCallBacks.equal = NULL;
+		keyCallBacks.hash  = NULL;
+		routes_compiled = CFDictionaryCreateMutable(NULL,
+							    0,
+							    &keyCallBacks,
+							    &kCFTypeDictionaryValueCallBacks);
+	}
+
+	trie = CFDictionaryGetValue(routes_compiled, routes);
+	if (trie != NULL) {
+		CFRetain(trie);
+	} else {
+		trie = __SCNetworkConnectionCreateRouteTrie(routes, addrLen);
+		CFDictionarySetValue(routes_compiled, routes, trie);
+	}
+
+	pthread_mutex_unlock(&routes_lock);
+
+	return trie;
+}
+
+
+static Boolean
+__SCNetworkConnectionAddressMatchesRoutes(CFDictionaryRef configuration, const struct sockaddr *addr, CFDictionaryRef routes)
+{
+	const uint8_t	*addrBytes;
+	size_t		addrLen;
+	Boolean		match;
+	CFTypeRef	trie;
+
+	if (!isA_CFDictionary(routes)) {
+		return FALSE;
+	}
+
+	if (addr->sa_family == AF_INET) {
+		addrBytes = (const uint8_t *)&((const struct sockaddr_in *)(const void *)addr)->sin_addr;
+		addrLen = sizeof(struct in_addr);
+	} else {
+		addrBytes = (const uint8_t *)&((const struct sockaddr_in6 *)(const void *)addr)->sin6_addr;
+		addrLen = sizeof(struct in6_addr);
+	}
+
+	trie = __SCNetworkConnectionCopyRouteTrie(configuration, routes, addrLen);
+	if (isA_CFData(trie)) {
+		match = __SCNetworkConnectionRouteTrieMatches(trie, addrBytes, addrLen);
+	} else if (addr->sa_family == AF_INET) {
+		match = __SCNetworkConnectionIPv4AddressMatchesRoutes((struct sockaddr_in *)(void *)addr, routes);
+	} else {
+		match = __SCNetworkConnectionIPv6AddressMatchesRoutes((struct sockaddr_in6 *)(void *)addr, routes);
+	}
+	CFRelease(trie);
+
+	return match;
+}
+
+
 static Boolean
-__SCNetworkConnectionAddressMatchesRedirectedDNS(CFDictionaryRef trigger, const struct sockaddr *input_addr)
+__SCNetworkConnectionAddressMatchesRedirectedDNS(CFDictionaryRef configuration, CFDictionaryRef trigger, const struct sockaddr *input_addr)
 {
 	CFBooleanRef redirectedRef = CFDictionaryGetValue(trigger, kSCNetworkConnectionOnDemandDNSRedirectDetected);
 
@@ -4178,9 +4820,9 @@ __SCNetworkConnectionAddressMatchesRedirectedDNS(CFDictionaryRef trigger, const
 
 		if (isA_CFDictionary(redirectedAddressesRef)) {
 			if (input_addr->sa_family == AF_INET) {
-				return __SCNetworkConnectionIPv4AddressMatchesRoutes((struct sockaddr_in*)(void*)input_addr, CFDictionaryGetValue(redirectedAddressesRef, kSCNetworkConnectionNetworkInfoIPv4));
+				return __SCNetworkConnectionAddressMatchesRoutes(configuration, input_addr, CFDictionaryGetValue(redirectedAddressesRef, kSCNetworkConnectionNetworkInfoIPv4));
 			} else if (input_addr->sa_family == AF_INET6) {
-				return __SCNetworkConnectionIPv6AddressMatchesRoutes((struct sockaddr_in6*)(void*)input_addr, CFDictionaryGetValue(redirectedAddressesRef, kSCNetworkConnectionNetworkInfoIPv6));
+				return __SCNetworkConnectionAddressMatchesRoutes(configuration, input_addr, CFDictionaryGetValue(redirectedAddressesRef, kSCNetworkConnectionNetworkInfoIPv6));
 			}
 		}
 	}
@@ -4267,7 +4909,7 @@ SCNetworkConnectionCanTunnelAddress (SCNetworkConnectionRef connection, const st
 		goto done;
 	}
 
-	if (__SCNetworkConnectionAddressMatchesRedirectedDNS(trigger, address)) {
+	if (__SCNetworkConnectionAddressMatchesRedirectedDNS(configuration, trigger, address)) {
 		if (startImmediately) {
 			*startImmediately = TRUE;
 		}
@@ -4283,17 +4925,16 @@ SCNetworkConnectionCanTunnelAddress (SCNetworkConnectionRef connection, const st
 	if (address_family == AF_INET) {
 		CFDictionaryRef ip_dict;
 		Boolean matches = FALSE;
-		struct sockaddr_in *addr_in = (struct sockaddr_in *)(void*)address;
 
 		ip_dict = CFDictionaryGetValue(tunneledNetworks, kSCNetworkConnectionNetworkInfoIPv4);
 		if (!isA_CFDictionary(ip_dict)) {
 			goto done;
 		}
 
-		matches = __SCNetworkConnectionIPv4AddressMatchesRoutes(addr_in, CFDictionaryGetValue(ip_dict, kSCNetworkConnectionNetworkInfoIncludedRoutes));
+		matches = __SCNetworkConnectionAddressMatchesRoutes(configuration, address, CFDictionaryGetValue(ip_dict, kSCNetworkConnectionNetworkInfoIncludedRoutes));
 
 		if (matches) {
-			if (!__SCNetworkConnectionIPv4AddressMatchesRoutes(addr_in, CFDictionaryGetValue(ip_dict, kSCNetworkConnectionNetworkInfoExcludedRoutes))) {
+			if (!__SCNetworkConnectionAddressMatchesRoutes(configuration, address, CFDictionaryGetValue(ip_dict, kSCNetworkConnectionNetworkInfoExcludedRoutes))) {
 				success = TRUE;
 				goto done;
 			}
@@ -4301,17 +4942,16 @@ SCNetworkConnectionCanTunnelAddress (SCNetworkConnectionRef connection, const st
 	} else {
 		CFDictionaryRef ip6_dict;
 		Boolean matches = FALSE;
-		struct sockaddr_in6 *addr_in6 = (struct sockaddr_in6 *)(void*)address;
 
 		ip6_dict = CFDictionaryGetValue(tunneledNetworks, kSCNetworkConnectionNetworkInfoIPv6);
 		if (!isA_CFDictionary(ip6_dict)) {
 			goto done;
 		}
 
-		matches = __SCNetworkConnectionIPv6AddressMatchesRoutes(addr_in6, CFDictionaryGetValue(ip6_dict, kSCNetworkConnectionNetworkInfoIncludedRoutes));
+		matches = __SCNetworkConnectionAddressMatchesRoutes(configuration, address, CFDictionaryGetValue(ip6_dict, kSCNetworkConnectionNetworkInfoIncludedRoutes));
 
 		if (matches) {
-			if (!__SCNetworkConnectionIPv6AddressMatchesRoutes(addr_in6, CFDictionaryGetValue(ip6_dict, kSCNetworkConnectionNetworkInfoExcludedRoutes))) {
+			if (!__SCNetworkConnectionAddressMatchesRoutes(configuration, address, CFDictionaryGetValue(ip6_dict, kSCNetworkConnectionNetworkInfoExcludedRoutes))) {
 				success = TRUE;
 				goto done;
 			}
@@ -127,6 +127,9 @@ __SCNetworkReachabilityGetFlagsFromPath(nw_path_t			path,
 					Boolean				resolvedEndpointUseFlags,
 					SCNetworkReachabilityFlags	resolvedEndpointFlags);
 
+static SCNetworkReachabilityFlags
+__SCNetworkReachabilityGetCachedFlags(SCNetworkReachabilityPrivateRef	targetPrivate);
+
 static Boolean
 __SCNetworkReachabilitySetDispatchQueue(SCNetworkReachabilityPrivateRef	targetPrivate,
 					dispatch_queue_t		queue);
@@ -251,12 +254,7 @@ __SCNetworkReachabilityCopyTargetFlags(SCNetworkReachabilityRef target)
 	str = CFStringCreateWithFormat(allocator,
 				       NULL,
 				       CFSTR("flags = 0x%08x, if_index = %u"),
-				       __SCNetworkReachabilityGetFlagsFromPath(targetPrivate->lastPath,
-									       targetPrivate->type,
-									       targetPrivate->lastResolverStatus,
-									       targetPrivate->lastResolvedEndpoints,
-									       targetPrivate->lastResolvedEndpointHasFlags,
-									       targetPrivate->lastResolvedEndpointFlags),
+				       __SCNetworkReachabilityGetCachedFlags(targetPrivate),
 				       targetPrivate->lastResolvedEndpointHasFlags ? targetPrivate->lastResolvedEndpointInterfaceIndex
 										   : nw_path_get_interface_index(targetPrivate->lastPath));
 	return str;
@@ -416,6 +414,7 @@ __SCNetworkReachabilityCreatePrivate(CFAllocatorRef	allocator)
 
 	/* initialize non-zero/NULL members */
 	MUTEX_INIT(&targetPrivate->lock);
+	targetPrivate->lastPathGeneration = 1;	// no cached flags yet
 	if (_sc_log > 0) {
 		snprintf(targetPrivate->log_prefix,
 			 sizeof(targetPrivate->log_prefix),
@@ -1189,6 +1188,43 @@ __SCNetworkReachabilityGetFlagsFromPath(nw_path_t			path,
 	return (flags & kSCNetworkReachabilityFlagsMask);
 }
 
+/*
+ * __SCNetworkReachabilityPathUpdated
+ *
+ * Called (with the target lock held) whenever the path or resolver state
+ * that the reachability flags are derived from changes.  Invalidates the
+ * cached flags so that the next query re-evaluates them.
+ */
+static __inline__ void
+__SCNetworkReachabilityPathUpdated(SCNetworkReachabilityPrivateRef targetPrivate)
+{
+	targetPrivate->lastPathGeneration++;
+	return;
+}
+
+/*
+ * __SCNetworkReachabilityGetCachedFlags
+ *
+ * Returns the flags for the last known path / resolver state of a scheduled
+ * target.  The flags are only evaluated once per path update; subsequent
+ * queries return the cached value.
+ */
+static SCNetworkReachabilityFlags
+__SCNetworkReachabilityGetCachedFlags(SCNetworkReachabilityPrivateRef targetPrivate)
+{
+	if (targetPrivate->lastFlagsGeneration != targetPrivate->lastPathGeneration) {
+		targetPrivate->lastFlags = __SCNetworkReachabilityGetFlagsFromPath(targetPrivate->lastPath,
+										   targetPrivate->type,
+										   targetPrivate->lastResolverStatus,
+										   targetPrivate->lastResolvedEndpoints,
+										   targetPrivate->lastResolvedEndpointHasFlags,
+										   targetPrivate->lastResolvedEndpointFlags);
+		targetPrivate->lastFlagsGeneration = targetPrivate->lastPathGeneration;
+	}
+
+	return targetPrivate->lastFlags;
+}
+
 static nw_endpoint_t
 __SCNetworkReachabilityGetPrimaryEndpoint(SCNetworkReachabilityPrivateRef targetPrivate)
 {
@@ -1345,12 +1381,7 @@ SCNetworkReachabilityGetFlags(SCNetworkReachabilityRef		target,
 
 	if (targetPrivate->scheduled) {
 		// if being watched, return the last known (and what should be current) status
-		*flags = __SCNetworkReachabilityGetFlagsFromPath(targetPrivate->lastPath,
-								 targetPrivate->type,
-								 targetPrivate->lastResolverStatus,
-								 targetPrivate->lastResolvedEndpoints,
-								 targetPrivate->lastResolvedEndpointHasFlags,
-								 targetPrivate->lastResolvedEndpointFlags);
+		*flags = __SCNetworkReachabilityGetCachedFlags(targetPrivate);
 		// because we have synchronously captured the current status, we no longer
 		// need our by-name required callback
 		targetPrivate->sentFirstUpdate = TRUE;
@@ -1419,12 +1450,7 @@ reachPerformAndUnlock(SCNetworkReachabilityPrivateRef targetPrivate)
 		context_release	= NULL;
 	}
 
-	flags = __SCNetworkReachabilityGetFlagsFromPath(targetPrivate->lastPath,
-							targetPrivate->type,
-							targetPrivate->lastResolverStatus,
-							targetPrivate->lastResolvedEndpoints,
-							targetPrivate->lastResolvedEndpointHasFlags,
-							targetPrivate->lastResolvedEndpointFlags);
+	flags = __SCNetworkReachabilityGetCachedFlags(targetPrivate);
 
 	MUTEX_UNLOCK(&targetPrivate->lock);
 
@@ -1652,12 +1678,7 @@ static __inline__ void
 __SCNetworkReachabilityCopyPathStatus(SCNetworkReachabilityPrivateRef targetPrivate, SCNetworkReachabilityFlags *flags, uint *ifIndex, size_t *endpointCount)
 {
 	if (flags) {
-		*flags = __SCNetworkReachabilityGetFlagsFromPath(targetPrivate->lastPath,
-								 targetPrivate->type,
-								 targetPrivate->lastResolverStatus,
-								 targetPrivate->lastResolvedEndpoints,
-								 targetPrivate->lastResolvedEndpointHasFlags,
-								 targetPrivate->lastResolvedEndpointFlags);
+		*flags = __SCNetworkReachabilityGetCachedFlags(targetPrivate);
 	}
 	if (ifIndex) {
 		*ifIndex = nw_path_get_interface_index(targetPrivate->lastPath);
@@ -1759,6 +1780,7 @@ __SCNetworkReachabilityRestartResolver(SCNetworkReachabilityPrivateRef targetPri
 					return TRUE;
 				});
 				targetPrivate->lastResolvedEndpointHasFlags = hasFlags;
+				__SCNetworkReachabilityPathUpdated(targetPrivate);
 
 				if (__SCNetworkReachabilityShouldUpdateClient(targetPrivate, oldFlags, oldIFIndex, oldEndpointCount)) {
 					reachUpdateAndUnlock(targetPrivate);
@@ -1828,6 +1850,7 @@ __SCNetworkReachabilitySetDispatchQueue(SCNetworkReachabilityPrivateRef	targetPr
 		targetPrivate->lastResolverStatus = nw_resolver_status_invalid;
 		network_release(targetPrivate->lastResolvedEndpoints);
 		targetPrivate->lastResolvedEndpoints = NULL;
+		__SCNetworkReachabilityPathUpdated(targetPrivate);
 		__SCNetworkReachabilityRestartResolver(targetPrivate);
 
 		CFRetain(targetPrivate);
@@ -1869,6 +1892,7 @@ __SCNetworkReachabilitySetDispatchQueue(SCNetworkReachabilityPrivateRef	targetPr
 					targetPrivate->lastResolverStatus = nw_resolver_status_invalid;
 					__SCNetworkReachabilityRestartResolver(targetPrivate);
 				}
+				__SCNetworkReachabilityPathUpdated(targetPrivate);
 
 				if (__SCNetworkReachabilityShouldUpdateClient(targetPrivate, oldFlags, oldIFIndex, oldEndpointCount)) {
 					reachUpdateAndUnlock(targetPrivate);
@@ -1905,6 +1929,7 @@ __SCNetworkReachabilitySetDispatchQueue(SCNetworkReachabilityPrivateRef	targetPr
 		targetPrivate->lastPathParameters = NULL;
 		network_release(targetPrivate->lastResolvedEndpoints);
 		targetPrivate->lastResolvedEndpoints = NULL;
+		__SCNetworkReachabilityPathUpdated(targetPrivate);
 		if (NULL != targetPrivate->resolver) {
 			nw_resolver_cancel(targetPrivate->resolver);
 			targetPrivate->resolver = NULL;
@@ -118,6 +118,11 @@ typedef struct {
 	SCNetworkReachabilityFlags	lastResolvedEndpointFlags;
 	uint				lastResolvedEndpointInterfaceIndex;
 
+	/* cached flags, valid while lastFlagsGeneration == lastPathGeneration */
+	uint64_t			lastPathGeneration;
+	uint64_t			lastFlagsGeneration;
+	SCNetworkReachabilityFlags	lastFlags;
+
 } SCNetworkReachabilityPrivate, *SCNetworkReachabilityPrivateRef;
 
 
@@ -39,9 +39,128 @@
 #include <unistd.h>
 #include <sys/errno.h>
 
+static void
+addPrefsChanges(CFMutableArrayRef	changes,
+		CFMutableArrayRef	path,
+		CFDictionaryRef		dictOld,
+		CFDictionaryRef		dictNew)
+{
+	CFIndex		i;
+	const void *	keys_q[32];
+	const void **	keys	= keys_q;
+	CFIndex		n;
+	const void *	vals_q[32];
+	const void **	vals	= vals_q;
+
+	// report any keys that were removed
+	n = CFDictionaryGetCount(dictOld);
+	if (n > (CFIndex)(sizeof(keys_q) / sizeof(CFTypeRef))) {
+		keys = CFAllocatorAllocate(NULL, n * sizeof(CFTypeRef), 0);
+	}
+	CFDictionaryGetKeysAndValues(dictOld, keys, NULL);
+	for (i = 0; i < n; i++) {
+		if (!CFDictionaryContainsKey(dictNew, keys[i])) {
+			CFArrayRef	change;
+			CFArrayRef	changePath;
+
+			CFArrayAppendValue(path, keys[i]);
+			changePath = CFArrayCreateCopy(NULL, path);
+			change = CFArrayCreate(NULL, (const void **)&changePath, 1, &kCFTypeArrayCallBacks);
+			CFArrayAppendValue(changes, change);
+			CFRelease(change);
+			CFRelease(changePath);
+			CFArrayRemoveValueAtIndex(path, CFArrayGetCount(path) - 1);
+		}
+	}
+	if (keys != keys_q) {
+		CFAllocatorDeallocate(NULL, keys);
+		keys = keys_q;
+	}
+
+	// report any keys that were added or changed
+	n = CFDictionaryGetCount(dictNew);
+	if (n > (CFIndex)(sizeof(keys_q) / sizeof(CFTypeRef))) {
+		keys = CFAllocatorAllocate(NULL, n * sizeof(CFTypeRef), 0);
+		vals = CFAllocatorAllocate(NULL, n * sizeof(CFTypeRef), 0);
+	}
+	CFDictionaryGetKeysAndValues(dictNew, keys, vals);
+	for (i = 0; i < n; i++) {
+		CFTypeRef	valOld;
+
+		valOld = CFDictionaryGetValue(dictOld, keys[i]);
+		if (valOld == vals[i]) {
+			// if unchanged (and shared)
+			continue;
+		}
+
+		CFArrayAppendValue(path, keys[i]);
+		if (isA_CFDictionary(valOld) && isA_CFDictionary(vals[i])) {
+			// if still a dictionary, only report what changed within
+			addPrefsChanges(changes, path, valOld, vals[i]);
+		} else if (!_SC_CFEqual(valOld, vals[i])) {
+			CFArrayRef	change;
+			CFArrayRef	changePath;
+			const void *	values[2];
+
+			changePath = CFArrayCreateCopy(NULL, path);
+			values[0] = changePath;
+			values[1] = vals[i];
+			change = CFArrayCreate(NULL, values, 2, &kCFTypeArrayCallBacks);
+			CFArrayAppendValue(changes, change);
+			CFRelease(change);
+			CFRelease(changePath);
+		}
+		CFArrayRemoveValueAtIndex(path, CFArrayGetCount(path) - 1);
+	}
+	if (keys != keys_q) {
+		CFAllocatorDeallocate(NULL, keys);
+		CFAllocatorDeallocate(NULL, vals);
+	}
+
+	return;
+}
+
+
+static CFDataRef
+copyPrefsDelta(SCPreferencesRef prefs)
+{
+	CFMutableArrayRef	changes;
+	CFDataRef		data		= NULL;
+	CFMutableDictionaryRef	deltaDict;
+	CFMutableArrayRef	path;
+	SCPreferencesPrivateRef	prefsPrivate	= (SCPreferencesPrivateRef)prefs;
+
+	if ((prefsPrivate->helper_prefs == NULL) || (prefsPrivate->signature == NULL)) {
+		// if we don't know what the helper has
+		return NULL;
+	}
+
+	changes = CFArrayCreateMutable(NULL, 0, &kCFTypeArrayCallBacks);
+	path = CFArrayCreateMutable(NULL, 0, &kCFTypeArrayCallBacks);
+	addPrefsChanges(changes, path, prefsPrivate->helper_prefs, prefsPrivate->prefs);
+	CFRelease(path);
+
+	deltaDict = CFDictionaryCreateMutable(NULL,
+					      0,
+					      &kCFTypeDictionaryKeyCallBacks,
+					      &kCFTypeDictionaryValueCallBacks);
+	CFDictionarySetValue(deltaDict, CFSTR("signature"), prefsPrivate->signature);
+	CFDictionarySetValue(deltaDict, CFSTR("changes"), changes);
+	CFRelease(changes);
+
+	if (!_SCSerialize(deltaDict, &data, NULL, NULL)) {
+		data = NULL;
+	}
+	CFRelease(deltaDict);
+
+	return data;
+}
+
+
 static Boolean
 __SCPreferencesCommitChanges_helper(SCPreferencesRef prefs)
 {
+	int			command		= SCHELPER_MSG_PREFS_COMMIT;
 	CFDataRef		data		= NULL;
 	Boolean			ok;
 	SCPreferencesPrivateRef	prefsPrivate	= (SCPreferencesPrivateRef)prefs;
@@ -55,6 +174,16 @@ __SCPreferencesCommitChanges_helper(SCPreferencesRef prefs)
 	}
 
 	if (prefsPrivate->changed) {
+		// pass just the changes to the helper (if we can)
+		data = copyPrefsDelta(prefs);
+		if (data != NULL) {
+			command = SCHELPER_MSG_PREFS_COMMIT_DELTA;
+		}
+	}
+
+    retry :
+
+	if (prefsPrivate->changed && (data == NULL)) {
 		ok = _SCSerialize(prefsPrivate->prefs, &data, NULL, NULL);
 		if (!ok) {
 			status = kSCStatusFailed;
@@ -71,15 +200,29 @@ __SCPreferencesCommitChanges_helper(SCPreferencesRef prefs)
 //	status = kSCStatusOK;
 //	reply  = NULL;
 	ok = _SCHelperExec(prefsPrivate->helper_port,
-			   SCHELPER_MSG_PREFS_COMMIT,
+			   command,
 			   data,
 			   &status,
 			   &reply);
-	if (data != NULL) CFRelease(data);
+	if (data != NULL) {
+		CFRelease(data);
+		data = NULL;
+	}
 	if (!ok) {
 		goto fail;
 	}
 
+	if ((status == kSCStatusStale) && (command == SCHELPER_MSG_PREFS_COMMIT_DELTA)) {
+		// if the helper's preferences don't match ours, send everything
+		if (reply != NULL) {
+			CFRelease(reply);
+			reply = NULL;
+		}
+		command = SCHELPER_MSG_PREFS_COMMIT;
+		status = kSCStatusOK;
+		goto retry;
+	}
+
 	if (status != kSCStatusOK) {
 		goto error;
 	}
@@ -87,6 +230,13 @@ __SCPreferencesCommitChanges_helper(SCPreferencesRef prefs)
 	if (prefsPrivate->changed) {
 		if (prefsPrivate->signature != NULL) CFRelease(prefsPrivate->signature);
 		prefsPrivate->signature = reply;
+
+		// the helper now has our preferences, keep the committed dictionary
+		// (no longer modified) and continue with a shallow copy so that any
+		// unchanged values remain shared with what the helper has
+		if (prefsPrivate->helper_prefs != NULL) CFRelease(prefsPrivate->helper_prefs);
+		prefsPrivate->helper_prefs = prefsPrivate->prefs;
+		prefsPrivate->prefs = CFDictionaryCreateMutableCopy(NULL, 0, prefsPrivate->helper_prefs);
 	} else {
 		if (reply != NULL) CFRelease(reply);
 	}
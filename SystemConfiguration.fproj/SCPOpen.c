@@ -139,6 +139,7 @@ __SCPreferencesDeallocate(CFTypeRef cf)
 	}
 	if (prefsPrivate->prefs)		CFRelease(prefsPrivate->prefs);
 	if (prefsPrivate->authorizationData != NULL) CFRelease(prefsPrivate->authorizationData);
+	if (prefsPrivate->helper_prefs)		CFRelease(prefsPrivate->helper_prefs);
 	if (prefsPrivate->helper_port != MACH_PORT_NULL) {
 		(void) _SCHelperExec(prefsPrivate->helper_port,
 				     SCHELPER_MSG_PREFS_CLOSE,
@@ -353,6 +354,11 @@ __SCPreferencesAccess_helper(SCPreferencesRef prefs)
 	prefsPrivate->prefs     = CFDictionaryCreateMutableCopy(NULL, 0, serverPrefs);
 	prefsPrivate->signature = CFRetain(serverSignature);
 	prefsPrivate->accessed  = TRUE;
+
+	// remember what the helper has (so that we can commit just the changes)
+	if (prefsPrivate->helper_prefs != NULL) CFRelease(prefsPrivate->helper_prefs);
+	prefsPrivate->helper_prefs = CFRetain(serverPrefs);
+
 	CFRelease(serverDict);
 
 	return TRUE;
@@ -1209,6 +1215,10 @@ SCPreferencesSynchronize(SCPreferencesRef prefs)
 		CFRelease(prefsPrivate->signature);
 		prefsPrivate->signature = NULL;
 	}
+	if (prefsPrivate->helper_prefs != NULL) {
+		CFRelease(prefsPrivate->helper_prefs);
+		prefsPrivate->helper_prefs = NULL;
+	}
 	prefsPrivate->accessed = FALSE;
 	prefsPrivate->changed  = FALSE;
 
@@ -116,6 +116,7 @@ typedef struct {
 	/* authorization, helper */
 	CFDataRef		authorizationData;
 	mach_port_t		helper_port;
+	CFDictionaryRef		helper_prefs;	// preferences known to the helper (at "signature")
 
 } SCPreferencesPrivate, *SCPreferencesPrivateRef;
 
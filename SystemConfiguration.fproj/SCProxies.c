@@ -35,6 +35,8 @@
 #include <SystemConfiguration/VPNAppLayerPrivate.h>
 
 #include <netdb.h>
+#include <pthread.h>
+#include <libkern/OSAtomic.h>
 #if	!TARGET_OS_SIMULATOR
 #include <ne_session.h>
 #endif	// !TARGET_OS_SIMULATOR
@@ -391,6 +393,53 @@ normalize_supplemental_proxy(const void *value, void *context)
 	return;
 }
 
+/*
+ * copy_normalized_proxies
+ *
+ * Returns the normalized form of the proxy configuration.  The (immutable)
+ * result for the most recent configuration is remembered so that callers
+ * who fetch the (unchanged) proxy configuration repeatedly share the same
+ * normalized dictionary instead of paying for a new one each time.  The
+ * supplemental proxy matcher is compiled once for each new configuration.
+ */
+static pthread_mutex_t	normalized_lock		= PTHREAD_MUTEX_INITIALIZER;
+static CFDictionaryRef	normalized_base		= NULL;
+static CFDictionaryRef	normalized_proxies	= NULL;
+
+static void
+proxy_matcher_update(CFDictionaryRef proxies);
+
+static CFDictionaryRef
+copy_normalized_proxies(CFDictionaryRef base)
+{
+	CFDictionaryRef	proxies;
+
+	pthread_mutex_lock(&normalized_lock);
+	if ((normalized_base == NULL) || !CFEqual(base, normalized_base)) {
+		CFDictionaryRef	normalized;
+
+		if (normalized_base != NULL) CFRelease(normalized_base);
+		if (normalized_proxies != NULL) CFRelease(normalized_proxies);
+		normalized_base = isA_CFDictionary(base) ? CFDictionaryCreateCopy(NULL, base)
+							 : CFRetain(base);
+		normalized = __SCNetworkProxiesCopyNormalized(base);
+		normalized_proxies = CFPropertyListCreateDeepCopy(NULL,
+								  normalized,
+								  kCFPropertyListImmutable);
+		if (normalized_proxies == NULL) {
+			// if not a property list
+			normalized_proxies = CFDictionaryCreateCopy(NULL, normalized);
+		}
+		CFRelease(normalized);
+
+		proxy_matcher_update(normalized_proxies);
+	}
+	proxies = CFRetain(normalized_proxies);
+	pthread_mutex_unlock(&normalized_lock);
+
+	return proxies;
+}
+
 CFDictionaryRef
 SCDynamicStoreCopyProxies(SCDynamicStoreRef store)
 {
@@ -446,7 +495,7 @@ SCDynamicStoreCopyProxiesWithOptions(SCDynamicStoreRef store, CFDictionaryRef op
 	if (proxies != NULL) {
 		CFDictionaryRef	base	= proxies;
 
-		proxies = __SCNetworkProxiesCopyNormalized(base);
+		proxies = copy_normalized_proxies(base);
 		CFRelease(base);
 	} else {
 		proxies = CFDictionaryCreate(NULL,
@@ -460,6 +509,334 @@ SCDynamicStoreCopyProxiesWithOptions(SCDynamicStoreRef store, CFDictionaryRef op
 	return proxies;
 }
 
+#pragma mark -
+#pragma mark Supplemental proxy matching
+
+
+/*
+ * The supplemental proxy configurations are compiled into a trie keyed
+ * by the (case folded) labels of the match domains, most significant
+ * label first.  Matching a host name then requires a single walk down
+ * the trie, collecting the proxies found along the way, rather than a
+ * suffix comparison against every supplemental match domain.
+ *
+ * The matcher is compiled once for each (normalized) configuration
+ * returned by SCDynamicStoreCopyProxies() and is found by the identity
+ * of that configuration's supplemental proxies.  Once compiled, a matcher
+ * is never modified so lookups only hold the lock long enough to retain
+ * it.  Any other supplemental proxies are compiled for the one lookup.
+ */
+
+typedef struct proxyDomainNode {
+	CFMutableDictionaryRef		children;	// [folded label] --> (proxyDomainNodeRef)
+	CFIndex				n_proxies;
+	CFIndex				*proxies;	// indices into the supplemental proxies
+} proxyDomainNode, *proxyDomainNodeRef;
+
+typedef struct {
+	int32_t				retain_count;
+	CFArrayRef			supplemental;	// the compiled supplemental proxies (retained)
+	CFMutableArrayRef		proxies;	// supplemental proxies w/o match domain (or kCFNull)
+	proxyDomainNodeRef		root;
+} proxyMatcher, *proxyMatcherRef;
+
+static pthread_mutex_t	matcher_lock	= PTHREAD_MUTEX_INITIALIZER;
+static proxyMatcherRef	matcher		= NULL;
+
+
+static proxyDomainNodeRef
+proxyDomainNodeCreate(void)
+{
+	proxyDomainNodeRef	node;
+
+	node = calloc(1, sizeof(*node));
+	return node;
+}
+
+
+static void
+proxyDomainNodeRelease(proxyDomainNodeRef node);
+
+
+static void
+release_child_node(const void *key, const void *value, void *context)
+{
+#pragma unused(key)
+#pragma unused(context)
+	proxyDomainNodeRelease((proxyDomainNodeRef)value);
+	return;
+}
+
+
+static void
+proxyDomainNodeRelease(proxyDomainNodeRef node)
+{
+	if (node->children != NULL) {
+		CFDictionaryApplyFunction(node->children, release_child_node, NULL);
+		CFRelease(node->children);
+	}
+	if (node->proxies != NULL) {
+		free(node->proxies);
+	}
+	free(node);
+	return;
+}
+
+
+static CFArrayRef
+proxyDomainCopyFoldedLabels(CFStringRef name)
+{
+	CFMutableStringRef	folded;
+	CFArrayRef		labels;
+
+	folded = CFStringCreateMutableCopy(NULL, 0, name);
+	CFStringFold(folded, kCFCompareCaseInsensitive, NULL);
+	labels = CFStringCreateArrayBySeparatingStrings(NULL, folded, CFSTR("."));
+	CFRelease(folded);
+	return labels;
+}
+
+
+static proxyDomainNodeRef
+proxyDomainNodeGetChild(proxyDomainNodeRef node, CFStringRef folded, Boolean create)
+{
+	proxyDomainNodeRef	child	= NULL;
+
+	if (node->children == NULL) {
+		if (!create) {
+			return NULL;
+		}
+	} else {
+		child = (proxyDomainNodeRef)CFDictionaryGetValue(node->children, folded);
+	}
+
+	if ((child == NULL) && create) {
+		if (node->children == NULL) {
+			node->children = CFDictionaryCreateMutable(NULL,
+								   0,
+								   &kCFTypeDictionaryKeyCallBacks,
+								   NULL);
+		}
+		child = proxyDomainNodeCreate();
+		CFDictionarySetValue(node->children, folded, child);
+	}
+
+	return child;
+}
+
+
+static void
+proxyDomainNodeAddProxy(proxyDomainNodeRef node, CFIndex index)
+{
+	node->proxies = reallocf(node->proxies, (node->n_proxies + 1) * sizeof(CFIndex));
+	node->proxies[node->n_proxies++] = index;
+	return;
+}
+
+
+static proxyMatcherRef
+proxyMatcherRetain(proxyMatcherRef m)
+{
+	(void)OSAtomicIncrement32(&m->retain_count);
+	return m;
+}
+
+
+static void
+proxyMatcherRelease(proxyMatcherRef m)
+{
+	int32_t		new_val;
+
+	new_val = OSAtomicDecrement32(&m->retain_count);
+	if (new_val > 0) {
+		return;
+	}
+
+	CFRelease(m->supplemental);
+	CFRelease(m->proxies);
+	proxyDomainNodeRelease(m->root);
+	free(m);
+	return;
+}
+
+
+static proxyMatcherRef
+proxyMatcherCreate(CFArrayRef supplemental)
+{
+	CFIndex		i;
+	proxyMatcherRef	m;
+	CFIndex		n;
+
+	m = calloc(1, sizeof(*m));
+	m->retain_count = 1;
+	m->supplemental = CFRetain(supplemental);
+	n = CFArrayGetCount(supplemental);
+	m->proxies = CFArrayCreateMutable(NULL, n, &kCFTypeArrayCallBacks);
+	m->root = proxyDomainNodeCreate();
+
+	for (i = 0; i < n; i++) {
+		CFStringRef		domain;
+		CFMutableDictionaryRef	newProxy;
+		proxyDomainNodeRef	node;
+		CFDictionaryRef		proxy;
+
+		proxy = CFArrayGetValueAtIndex(supplemental, i);
+		if (!isA_CFDictionary(proxy)) {
+			// if corrupt proxy configuration
+			CFArrayAppendValue(m->proxies, kCFNull);
+			continue;
+		}
+
+		domain = CFDictionaryGetValue(proxy, kSCPropNetProxiesSupplementalMatchDomain);
+		if (!isA_CFString(domain)) {
+			// if corrupt proxy configuration
+			CFArrayAppendValue(m->proxies, kCFNull);
+			continue;
+		}
+
+		newProxy = CFDictionaryCreateMutableCopy(NULL, 0, proxy);
+		CFDictionaryRemoveValue(newProxy, kSCPropNetProxiesSupplementalMatchDomain);
+		CFArrayAppendValue(m->proxies, newProxy);
+		CFRelease(newProxy);
+
+		node = m->root;
+		if (CFStringGetLength(domain) > 0) {
+			CFIndex		j;
+			CFArrayRef	labels;
+
+			labels = proxyDomainCopyFoldedLabels(domain);
+			for (j = CFArrayGetCount(labels) - 1; j >= 0; j--) {
+				node = proxyDomainNodeGetChild(node, CFArrayGetValueAtIndex(labels, j), TRUE);
+			}
+			CFRelease(labels);
+//		} else {
+//			// if this is a "default" (match all) proxy domain
+		}
+
+		proxyDomainNodeAddProxy(node, i);
+	}
+
+	return m;
+}
+
+
+static void
+proxy_matcher_update(CFDictionaryRef proxies)
+{
+	proxyMatcherRef	m		= NULL;
+	proxyMatcherRef	old;
+	CFArrayRef	supplemental;
+
+	supplemental = CFDictionaryGetValue(proxies, kSCPropNetProxiesSupplemental);
+	if (isA_CFArray(supplemental)) {
+		m = proxyMatcherCreate(supplemental);
+	}
+
+	pthread_mutex_lock(&matcher_lock);
+	old = matcher;
+	matcher = m;
+	pthread_mutex_unlock(&matcher_lock);
+
+	if (old != NULL) {
+		proxyMatcherRelease(old);
+	}
+	return;
+}
+
+
+static int
+compare_proxy_index(const void *a, const void *b)
+{
+	CFIndex	ia	= *(const CFIndex *)a;
+	CFIndex	ib	= *(const CFIndex *)b;
+
+	return (ia < ib) ? -1 : ((ia > ib) ? 1 : 0);
+}
+
+
+static CFArrayRef
+proxyMatcherCopyMatching(proxyMatcherRef m, CFStringRef server)
+{
+	CFIndex			i;
+	CFIndex			j;
+	CFArrayRef		labels;
+	CFIndex			*matched	= NULL;
+	CFMutableArrayRef	matching	= NULL;
+	CFIndex			n_matched	= 0;
+	proxyDomainNodeRef	node;
+	CFArrayRef		proxies		= NULL;
+
+	labels = proxyDomainCopyFoldedLabels(server);
+	node = m->root;
+	i = CFArrayGetCount(labels);
+	while (node != NULL) {
+		if (node->n_proxies > 0) {
+			matched = reallocf(matched, (n_matched + node->n_proxies) * sizeof(CFIndex));
+			memcpy(&matched[n_matched], node->proxies, node->n_proxies * sizeof(CFIndex));
+			n_matched += node->n_proxies;
+		}
+
+		if (--i < 0) {
+			break;
+		}
+		node = proxyDomainNodeGetChild(node, CFArrayGetValueAtIndex(labels, i), FALSE);
+	}
+	CFRelease(labels);
+
+	if (n_matched == 0) {
+		return NULL;
+	}
+
+	// return the matching proxies in configuration order
+	qsort(matched, n_matched, sizeof(CFIndex), compare_proxy_index);
+
+	matching = CFArrayCreateMutable(NULL, 0, &kCFTypeArrayCallBacks);
+	for (j = 0; j < n_matched; j++) {
+		CFIndex		n_matching;
+		CFDictionaryRef	newProxy;
+
+		newProxy = CFArrayGetValueAtIndex(m->proxies, matched[j]);
+		n_matching = CFArrayGetCount(matching);
+		if ((n_matching == 0) ||
+		    !CFArrayContainsValue(matching, CFRangeMake(0, n_matching), newProxy)) {
+			// add this matching proxy
+			CFArrayAppendValue(matching, newProxy);
+		}
+	}
+	free(matched);
+
+	proxies = CFArrayCreateCopy(NULL, matching);
+	CFRelease(matching);
+	return proxies;
+}
+
+
+static CFArrayRef
+copy_matching_supplemental_proxies(CFArrayRef supplemental, CFStringRef server)
+{
+	proxyMatcherRef	m		= NULL;
+	CFArrayRef	proxies;
+
+	pthread_mutex_lock(&matcher_lock);
+	if ((matcher != NULL) && (matcher->supplemental == supplemental)) {
+		// if the supplemental proxies from SCDynamicStoreCopyProxies()
+		m = proxyMatcherRetain(matcher);
+	}
+	pthread_mutex_unlock(&matcher_lock);
+
+	if (m == NULL) {
+		// if some other configuration
+		m = proxyMatcherCreate(supplemental);
+	}
+
+	proxies = proxyMatcherCopyMatching(m, server);
+	proxyMatcherRelease(m);
+	return proxies;
+}
+
+
+#pragma mark -
+
 
 static CFArrayRef
 _SCNetworkProxiesCopyMatchingInternal(CFDictionaryRef	globalConfiguration,
@@ -557,10 +934,6 @@ _SCNetworkProxiesCopyMatchingInternal(CFDictionaryRef	globalConfiguration,
 
 
 	if (server != NULL) {
-		CFIndex			i;
-		CFMutableArrayRef	matching	= NULL;
-		CFIndex			n		= 0;
-		CFIndex			server_len;
 		CFArrayRef		supplemental;
 
 		trimmed = _SC_trimDomain(server);
@@ -570,7 +943,6 @@ _SCNetworkProxiesCopyMatchingInternal(CFDictionaryRef	globalConfiguration,
 		}
 
 		server = trimmed;
-		server_len = CFStringGetLength(server);
 
 		supplemental = CFDictionaryGetValue(globalConfiguration, kSCPropNetProxiesSupplemental);
 		if (supplemental != NULL) {
@@ -580,70 +952,11 @@ _SCNetworkProxiesCopyMatchingInternal(CFDictionaryRef	globalConfiguration,
 				goto done;
 			}
 
-			n = CFArrayGetCount(supplemental);
-		}
-
-		for (i = 0; i < n; i++) {
-			CFStringRef	domain;
-			CFIndex		domain_len;
-			CFIndex		n_matching;
-
-			proxy = CFArrayGetValueAtIndex(supplemental, i);
-			if (!isA_CFDictionary(proxy)) {
-				// if corrupt proxy configuration
-				continue;
-			}
-
-			domain = CFDictionaryGetValue(proxy, kSCPropNetProxiesSupplementalMatchDomain);
-			if (!isA_CFString(domain)) {
-				// if corrupt proxy configuration
-				continue;
-			}
-
-			domain_len = CFStringGetLength(domain);
-			if (domain_len > 0) {
-				if (!CFStringFindWithOptions(server,
-							     domain,
-							     CFRangeMake(0, server_len),
-							     kCFCompareCaseInsensitive|kCFCompareAnchored|kCFCompareBackwards,
-							     NULL)) {
-					// if server does not match this proxy domain (or host)
-					continue;
-				}
-
-				if ((server_len > domain_len) &&
-				    !CFStringFindWithOptions(server,
-							     CFSTR("."),
-							     CFRangeMake(0, server_len - domain_len),
-							     kCFCompareCaseInsensitive|kCFCompareAnchored|kCFCompareBackwards,
-							     NULL)) {
-					// if server does not match this proxy domain
-					continue;
-				}
-//			} else {
-//				// if this is a "default" (match all) proxy domain
-			}
-
-			if (matching == NULL) {
-				matching = CFArrayCreateMutable(NULL, 0, &kCFTypeArrayCallBacks);
-			}
-			n_matching = CFArrayGetCount(matching);
-
-			newProxy = CFDictionaryCreateMutableCopy(NULL, 0, proxy);
-			CFDictionaryRemoveValue(newProxy, kSCPropNetProxiesSupplementalMatchDomain);
-			if ((n_matching == 0) ||
-			    !CFArrayContainsValue(matching, CFRangeMake(0, n_matching), newProxy)) {
-				// add this matching proxy
-				CFArrayAppendValue(matching, newProxy);
+			proxies = copy_matching_supplemental_proxies(supplemental, server);
+			if (proxies != NULL) {
+				// if we have any supplemental match domains
+				goto done;
 			}
-			CFRelease(newProxy);
-		}
-
-		if (matching != NULL) {
-			// if we have any supplemental match domains
-			proxies = CFArrayCreateCopy(NULL, matching);
-			CFRelease(matching);
-			goto done;
 		}
 	}
 
@@ -52,6 +52,7 @@ enum {
 	SCHELPER_MSG_PREFS_UNLOCK,
 	SCHELPER_MSG_PREFS_CLOSE,
 	SCHELPER_MSG_PREFS_SYNCHRONIZE,
+	SCHELPER_MSG_PREFS_COMMIT_DELTA,
 
 	// SCNetworkConfiguration
 	SCHELPER_MSG_INTERFACE_REFRESH	= 200,
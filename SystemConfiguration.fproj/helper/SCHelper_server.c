@@ -86,6 +86,9 @@ typedef struct {
 	lazyBoolean		callerReadAccess;
 	lazyBoolean		callerWriteAccess;
 
+	// entitlements of the caller (kCFNull if not present)
+	CFMutableDictionaryRef	entitlements;
+
 	// configuration filtering
 	lazyBoolean		isSetChange;	// only network "set" changes
 	lazyBoolean		isVPNChange;	// only VPN configuration changes
@@ -116,6 +119,10 @@ static int		sessions_closed			= 0;	// count of sessions recently closed
 static int		sessions_generation		= 0;
 static pthread_mutex_t	sessions_lock			= PTHREAD_MUTEX_INITIALIZER;
 
+// sessions, indexed by [session] mach port
+static CFMutableDictionaryRef	sessions_by_port		= NULL;
+static pthread_rwlock_t		sessions_by_port_lock		= PTHREAD_RWLOCK_INITIALIZER;
+
 
 #pragma mark -
 #pragma mark Logging
@@ -306,6 +313,16 @@ __SCHelperSessionSetPreferences(SCHelperSessionRef session, SCPreferencesRef pre
 	}
 	sessionPrivate->prefs = prefs;
 
+	// access decisions are specific to the preferences being accessed
+	sessionPrivate->callerReadAccess	= UNKNOWN;
+	sessionPrivate->callerWriteAccess	= UNKNOWN;
+	sessionPrivate->isSetChange		= UNKNOWN;
+	sessionPrivate->isVPNChange		= UNKNOWN;
+	if (sessionPrivate->vpnTypes != NULL) {
+		CFRelease(sessionPrivate->vpnTypes);
+		sessionPrivate->vpnTypes = NULL;
+	}
+
 	__SCHelperSessionSetThreadName(session);
 
 	pthread_mutex_unlock(&sessionPrivate->lock);
@@ -470,11 +487,25 @@ __SCHelperSessionDeallocate(CFTypeRef cf)
 	__SCHelperSessionSetNetworkSetFilter(session, FALSE);
 	__SCHelperSessionSetVPNFilter(session, FALSE, NULL);
 	pthread_mutex_destroy(&sessionPrivate->lock);
+	if (sessionPrivate->entitlements != NULL) {
+		CFRelease(sessionPrivate->entitlements);
+	}
 	if (sessionPrivate->backtraces != NULL) {
 		CFRelease(sessionPrivate->backtraces);
 	}
 
 	// we no longer need/want to track this session
+	if (sessionPrivate->port != MACH_PORT_NULL) {
+		const void	*key	= (const void *)(uintptr_t)sessionPrivate->port;
+
+		pthread_rwlock_wrlock(&sessions_by_port_lock);
+		if ((sessions_by_port != NULL) &&
+		    (CFDictionaryGetValue(sessions_by_port, key) == sessionPrivate)) {
+			// if the port has not since been re-used by another session
+			CFDictionaryRemoveValue(sessions_by_port, key);
+		}
+		pthread_rwlock_unlock(&sessions_by_port_lock);
+	}
 	CFSetRemoveValue(sessions, sessionPrivate);
 	sessions_generation++;
 	sessions_closed++;
@@ -547,35 +578,36 @@ __SCHelperSessionCreate(CFAllocatorRef allocator)
 #pragma mark -
 
 
+static void
+__SCHelperSessionSetPort(SCHelperSessionRef session, mach_port_t port)
+{
+	SCHelperSessionPrivateRef	sessionPrivate	= (SCHelperSessionPrivateRef)session;
+
+	sessionPrivate->port = port;
+
+	// index this session by port
+	pthread_rwlock_wrlock(&sessions_by_port_lock);
+	if (sessions_by_port == NULL) {
+		// create a non-retaining dictionary (keyed by mach port)
+		sessions_by_port = CFDictionaryCreateMutable(NULL, 0, NULL, NULL);
+	}
+	CFDictionarySetValue(sessions_by_port, (const void *)(uintptr_t)port, sessionPrivate);
+	pthread_rwlock_unlock(&sessions_by_port_lock);
+
+	return;
+}
+
+
 static SCHelperSessionRef
 __SCHelperSessionFindWithPort(mach_port_t port)
 {
 	SCHelperSessionRef	session	= NULL;
 
-	// keep track this session
-	pthread_mutex_lock(&sessions_lock);
-	if (sessions != NULL) {
-		CFIndex		i;
-		CFIndex		n	= CFSetGetCount(sessions);
-		const void *	vals_q[16];
-		const void **	vals	= vals_q;
-
-		if (n > (CFIndex)(sizeof(vals_q) / sizeof(SCHelperSessionRef)))
-			vals = CFAllocatorAllocate(NULL, n * sizeof(CFStringRef), 0);
-		CFSetGetValues(sessions, vals);
-		for (i = 0; i < n; i++) {
-			SCHelperSessionPrivateRef	sessionPrivate;
-
-			sessionPrivate = (SCHelperSessionPrivateRef)vals[i];
-			if (sessionPrivate->port == port) {
-				session = (SCHelperSessionRef)sessionPrivate;
-				break;
-			}
-		}
-		if (vals != vals_q)
-			CFAllocatorDeallocate(NULL, vals);
+	pthread_rwlock_rdlock(&sessions_by_port_lock);
+	if (sessions_by_port != NULL) {
+		session = CFDictionaryGetValue(sessions_by_port, (const void *)(uintptr_t)port);
 	}
-	pthread_mutex_unlock(&sessions_lock);
+	pthread_rwlock_unlock(&sessions_by_port_lock);
 
 	return session;
 }
@@ -1191,16 +1223,181 @@ do_prefs_Lock(SCHelperSessionRef session, void *info, CFDataRef data, uint32_t *
 }
 
 
+static CFSetRef
+copyChangedKeys(CFDictionaryRef prefsOld, CFDictionaryRef prefsNew)
+{
+	CFMutableSetRef	changed;
+	const void *	keys_q[16];
+	const void **	keys	= keys_q;
+	CFIndex		i;
+	CFIndex		n;
+
+	changed = CFSetCreateMutable(NULL, 0, &kCFTypeSetCallBacks);
+
+	// check for any keys that were removed or changed
+	n = CFDictionaryGetCount(prefsOld);
+	if (n > (CFIndex)(sizeof(keys_q) / sizeof(CFTypeRef))) {
+		keys = CFAllocatorAllocate(NULL, n * sizeof(CFTypeRef), 0);
+	}
+	CFDictionaryGetKeysAndValues(prefsOld, keys, NULL);
+	for (i = 0; i < n; i++) {
+		if (!_SC_CFEqual(CFDictionaryGetValue(prefsOld, keys[i]),
+				 CFDictionaryGetValue(prefsNew, keys[i]))) {
+			CFSetAddValue(changed, keys[i]);
+		}
+	}
+	if (keys != keys_q) {
+		CFAllocatorDeallocate(NULL, keys);
+		keys = keys_q;
+	}
+
+	// check for any keys that were added
+	n = CFDictionaryGetCount(prefsNew);
+	if (n > (CFIndex)(sizeof(keys_q) / sizeof(CFTypeRef))) {
+		keys = CFAllocatorAllocate(NULL, n * sizeof(CFTypeRef), 0);
+	}
+	CFDictionaryGetKeysAndValues(prefsNew, keys, NULL);
+	for (i = 0; i < n; i++) {
+		if (!CFDictionaryContainsKey(prefsOld, keys[i])) {
+			CFSetAddValue(changed, keys[i]);
+		}
+	}
+	if (keys != keys_q) {
+		CFAllocatorDeallocate(NULL, keys);
+	}
+
+	return changed;
+}
+
+
+static Boolean
+onlyChangedKeys(CFSetRef changed, const CFStringRef *allowed, CFIndex n_allowed)
+{
+	CFIndex		n;
+
+	n = CFSetGetCount(changed);
+	for (CFIndex i = 0; i < n_allowed; i++) {
+		if (CFSetContainsValue(changed, allowed[i])) {
+			n--;
+		}
+	}
+
+	return (n == 0);
+}
+
+
+static CFDictionaryRef
+copyPrefsWithPathValue(CFDictionaryRef dict, CFArrayRef path, CFIndex depth, CFTypeRef value)
+{
+	CFStringRef		key;
+	CFMutableDictionaryRef	newDict;
+
+	key = CFArrayGetValueAtIndex(path, depth);
+	if (dict != NULL) {
+		newDict = CFDictionaryCreateMutableCopy(NULL, 0, dict);
+	} else {
+		newDict = CFDictionaryCreateMutable(NULL,
+						    0,
+						    &kCFTypeDictionaryKeyCallBacks,
+						    &kCFTypeDictionaryValueCallBacks);
+	}
+
+	if (depth == (CFArrayGetCount(path) - 1)) {
+		// if last path component
+		if (value != NULL) {
+			CFDictionarySetValue(newDict, key, value);
+		} else {
+			CFDictionaryRemoveValue(newDict, key);
+		}
+	} else {
+		CFDictionaryRef	child;
+		CFDictionaryRef	newChild;
+
+		child = CFDictionaryGetValue(newDict, key);
+		newChild = copyPrefsWithPathValue(isA_CFDictionary(child), path, depth + 1, value);
+		CFDictionarySetValue(newDict, key, newChild);
+		CFRelease(newChild);
+	}
+
+	return newDict;
+}
+
+
+static CFDictionaryRef
+copyPrefsWithDelta(CFDictionaryRef prefs, CFArrayRef changes)
+{
+	CFIndex		i;
+	CFIndex		n;
+	CFDictionaryRef	newPrefs;
+
+	newPrefs = CFRetain(prefs);
+
+	n = CFArrayGetCount(changes);
+	for (i = 0; i < n; i++) {
+		CFArrayRef	change;
+		CFIndex		j;
+		CFIndex		nPath;
+		CFArrayRef	path;
+		CFDictionaryRef	updated;
+		CFTypeRef	value		= NULL;
+
+		// each change is [ path ] (remove) or [ path, value ] (set)
+		change = CFArrayGetValueAtIndex(changes, i);
+		if (!isA_CFArray(change) ||
+		    (CFArrayGetCount(change) < 1) ||
+		    (CFArrayGetCount(change) > 2)) {
+			goto error;
+		}
+
+		path = CFArrayGetValueAtIndex(change, 0);
+		if (!isA_CFArray(path)) {
+			goto error;
+		}
+		nPath = CFArrayGetCount(path);
+		if (nPath < 1) {
+			goto error;
+		}
+		for (j = 0; j < nPath; j++) {
+			if (!isA_CFString(CFArrayGetValueAtIndex(path, j))) {
+				goto error;
+			}
+		}
+
+		if (CFArrayGetCount(change) == 2) {
+			value = CFArrayGetValueAtIndex(change, 1);
+		}
+
+		updated = copyPrefsWithPathValue(newPrefs, path, 0, value);
+		CFRelease(newPrefs);
+		newPrefs = updated;
+	}
+
+	return newPrefs;
+
+    error :
+
+	SC_log(LOG_NOTICE, "preferences delta not valid");
+	CFRelease(newPrefs);
+	return NULL;
+}
+
+
 /*
  * COMMIT
  *   (in)  data   = new preferences (NULL if commit w/no changes)
  *   (out) status = SCError()
  *   (out) reply  = new signature
+ *
+ * COMMIT (delta)
+ *   (in)  data   = signature of the preferences the changes were made against
+ *                  + changes ([ path ] or [ path, value ])
+ *   (out) status = SCError(), kSCStatusStale if signature does not match
+ *   (out) reply  = new signature
  */
 static Boolean
 do_prefs_Commit(SCHelperSessionRef session, void *info, CFDataRef data, uint32_t *status, CFDataRef *reply)
 {
-#pragma unused(info)
+	Boolean			delta			= (info == (void *)FALSE) ? FALSE : TRUE;
 	Boolean			ok;
 	SCPreferencesRef	prefs			= __SCHelperSessionGetPreferences(session);
 	CFPropertyListRef	prefsData		= NULL;
@@ -1227,6 +1424,29 @@ do_prefs_Commit(SCHelperSessionRef session, void *info, CFDataRef data, uint32_t
 		return FALSE;
 	}
 
+	if (delta && isA_CFDictionary(prefsData)) {
+		CFArrayRef		changes;
+		CFDictionaryRef		deltaDict	= prefsData;
+		CFDataRef		signature;
+
+		prefsData = NULL;
+
+		signature = CFDictionaryGetValue(deltaDict, CFSTR("signature"));
+		if (!_SC_CFEqual(signature, SCPreferencesGetSignature(prefs)) ||
+		    (prefsPrivate->prefs == NULL)) {
+			// if the client's changes were not made against our preferences
+			CFRelease(deltaDict);
+			*status = kSCStatusStale;
+			return TRUE;
+		}
+
+		changes = CFDictionaryGetValue(deltaDict, CFSTR("changes"));
+		if (isA_CFArray(changes)) {
+			prefsData = copyPrefsWithDelta(prefsPrivate->prefs, changes);
+		}
+		CFRelease(deltaDict);
+	}
+
 	if (!isA_CFDictionary(prefsData)) {
 		*status = kSCStatusFailed;
 		ok = FALSE;
@@ -1236,15 +1456,36 @@ do_prefs_Commit(SCHelperSessionRef session, void *info, CFDataRef data, uint32_t
 	useSetFilter = __SCHelperSessionUseNetworkSetFilter(session);
 	useVPNFilter = __SCHelperSessionUseVPNFilter(session, &vpnTypes);
 	if (useSetFilter || useVPNFilter) {
+		CFSetRef		changed		= NULL;
+		const CFStringRef	setKeys[]	= { kSCPrefCurrentSet };
+		const CFStringRef	vpnKeys[]	= { kSCPrefNetworkServices, kSCPrefSets };
+
 		ok = FALSE;
 
 		if (prefsPrivate->prefs != NULL) {
+			// classify the commit by the top-level keys that were modified
+			changed = copyChangedKeys(prefsPrivate->prefs, prefsData);
+		}
+
+		if (changed == NULL) {
+			// if no current preferences
+		} else if (CFSetGetCount(changed) == 0) {
+			// if nothing changed
+			ok = TRUE;
+		} else if (useSetFilter) {
+			// only the current network set selection can change
+			ok = onlyChangedKeys(changed, setKeys, sizeof(setKeys) / sizeof(setKeys[0]));
+		} else if (onlyChangedKeys(changed, vpnKeys, sizeof(vpnKeys) / sizeof(vpnKeys[0]))) {
+			// VPN service changes can only touch services and sets, compare
+			// the filtered configurations
 			CFIndex			c;
 			CFMutableDictionaryRef	prefsNew	= NULL;
 			CFMutableDictionaryRef	prefsOld	= NULL;
 			CFMutableDictionaryRef	prefsSave	= prefsPrivate->prefs;
 
 			for (c = 0; c < 2; c++) {
+				CFRange		range		= CFRangeMake(0, CFArrayGetCount(vpnTypes));
+				CFArrayRef	services;
 
 				switch (c) {
 					case 0 :
@@ -1255,49 +1496,41 @@ do_prefs_Commit(SCHelperSessionRef session, void *info, CFDataRef data, uint32_t
 						break;
 				}
 
-				if (useSetFilter) {
-					// filter out current network set selection
-					(void) SCPreferencesRemoveValue(prefs, kSCPrefCurrentSet);
-				} else if (useVPNFilter) {
-					CFRange		range		= CFRangeMake(0, CFArrayGetCount(vpnTypes));
-					CFArrayRef	services;
-
-					// filter out VPN services of the specified type
-					services = SCNetworkServiceCopyAll(prefs);
-					if (services != NULL) {
-						CFIndex	i;
-						CFIndex	n	= CFArrayGetCount(services);
-
-						for (i = 0; i < n; i++) {
-							SCNetworkServiceRef	service;
-
-							service = CFArrayGetValueAtIndex(services, i);
-							if (_SCNetworkServiceIsVPN(service)) {
-								SCNetworkInterfaceRef	child;
-								CFStringRef		childType	= NULL;
-								SCNetworkInterfaceRef	interface;
-								CFStringRef		interfaceType;
-
-								interface     = SCNetworkServiceGetInterface(service);
-								interfaceType = SCNetworkInterfaceGetInterfaceType(interface);
-								child         = SCNetworkInterfaceGetInterface(interface);
-								if (child != NULL) {
-									childType = SCNetworkInterfaceGetInterfaceType(child);
-								}
-								if (CFEqual(interfaceType, kSCNetworkInterfaceTypeVPN) &&
-								    (childType != NULL) &&
-								    CFArrayContainsValue(vpnTypes, range, childType)) {
-									// filter out VPN service
-									(void) SCNetworkServiceRemove(service);
-								} else {
-									// mark all other VPN services "enabled"
-									(void) SCNetworkServiceSetEnabled(service, TRUE);
-								}
+				// filter out VPN services of the specified type
+				services = SCNetworkServiceCopyAll(prefs);
+				if (services != NULL) {
+					CFIndex	i;
+					CFIndex	n	= CFArrayGetCount(services);
+
+					for (i = 0; i < n; i++) {
+						SCNetworkServiceRef	service;
+
+						service = CFArrayGetValueAtIndex(services, i);
+						if (_SCNetworkServiceIsVPN(service)) {
+							SCNetworkInterfaceRef	child;
+							CFStringRef		childType	= NULL;
+							SCNetworkInterfaceRef	interface;
+							CFStringRef		interfaceType;
+
+							interface     = SCNetworkServiceGetInterface(service);
+							interfaceType = SCNetworkInterfaceGetInterfaceType(interface);
+							child         = SCNetworkInterfaceGetInterface(interface);
+							if (child != NULL) {
+								childType = SCNetworkInterfaceGetInterfaceType(child);
+							}
+							if (CFEqual(interfaceType, kSCNetworkInterfaceTypeVPN) &&
+							    (childType != NULL) &&
+							    CFArrayContainsValue(vpnTypes, range, childType)) {
+								// filter out VPN service
+								(void) SCNetworkServiceRemove(service);
+							} else {
+								// mark all other VPN services "enabled"
+								(void) SCNetworkServiceSetEnabled(service, TRUE);
 							}
 						}
-
-						CFRelease(services);
 					}
+
+					CFRelease(services);
 				}
 
 				switch (c) {
@@ -1319,6 +1552,8 @@ do_prefs_Commit(SCHelperSessionRef session, void *info, CFDataRef data, uint32_t
 			prefsPrivate->prefs = prefsSave;
 		}
 
+		if (changed != NULL) CFRelease(changed);
+
 		if (!ok) {
 			*status = kSCStatusAccessError;
 			goto done;
@@ -1518,6 +1753,18 @@ copyEntitlement(SCHelperSessionRef session, CFStringRef entitlement)
 	SecTaskRef			task;
 	CFTypeRef			value		= NULL;
 
+	// the entitlements of the caller don't change for the life of the session
+	pthread_mutex_lock(&sessionPrivate->lock);
+	if (sessionPrivate->entitlements != NULL) {
+		value = CFDictionaryGetValue(sessionPrivate->entitlements, entitlement);
+		if (value != NULL) {
+			value = (value != kCFNull) ? CFRetain(value) : NULL;
+			pthread_mutex_unlock(&sessionPrivate->lock);
+			return value;
+		}
+	}
+	pthread_mutex_unlock(&sessionPrivate->lock);
+
 	// Create the security task from the audit token
 	task = SecTaskCreateWithAuditToken(NULL, sessionPrivate->auditToken);
 	if (task != NULL) {
@@ -1541,6 +1788,18 @@ copyEntitlement(SCHelperSessionRef session, CFStringRef entitlement)
 		}
 
 		CFRelease(task);
+
+		pthread_mutex_lock(&sessionPrivate->lock);
+		if (sessionPrivate->entitlements == NULL) {
+			sessionPrivate->entitlements = CFDictionaryCreateMutable(NULL,
+										 0,
+										 &kCFTypeDictionaryKeyCallBacks,
+										 &kCFTypeDictionaryValueCallBacks);
+		}
+		CFDictionarySetValue(sessionPrivate->entitlements,
+				     entitlement,
+				     (value != NULL) ? value : kCFNull);
+		pthread_mutex_unlock(&sessionPrivate->lock);
 	} else {
 		SC_log(LOG_NOTICE, "SecTaskCreateWithAuditToken() failed: %@",
 		       sessionName(session));
@@ -1796,7 +2055,8 @@ static const struct helper {
 	{ SCHELPER_MSG_PREFS_ACCESS,		"PREFS access",		TRUE,	FALSE,	do_prefs_Access		, NULL		},
 	{ SCHELPER_MSG_PREFS_LOCK,		"PREFS lock",		TRUE,	TRUE,	do_prefs_Lock		, (void *)FALSE	},
 	{ SCHELPER_MSG_PREFS_LOCKWAIT,		"PREFS lock/wait",	TRUE,	TRUE,	do_prefs_Lock		, (void *)TRUE	},
-	{ SCHELPER_MSG_PREFS_COMMIT,		"PREFS commit",		TRUE,	TRUE,	do_prefs_Commit		, NULL		},
+	{ SCHELPER_MSG_PREFS_COMMIT,		"PREFS commit",		TRUE,	TRUE,	do_prefs_Commit		, (void *)FALSE	},
+	{ SCHELPER_MSG_PREFS_COMMIT_DELTA,	"PREFS commit/delta",	TRUE,	TRUE,	do_prefs_Commit		, (void *)TRUE	},
 	{ SCHELPER_MSG_PREFS_APPLY,		"PREFS apply",		TRUE,	TRUE,	do_prefs_Apply		, NULL		},
 	{ SCHELPER_MSG_PREFS_UNLOCK,		"PREFS unlock",		FALSE,	TRUE,	do_prefs_Unlock		, NULL		},
 	{ SCHELPER_MSG_PREFS_CLOSE,		"PREFS close",		FALSE,	FALSE,	do_prefs_Close		, NULL		},
@@ -2111,14 +2371,14 @@ _helperinit(mach_port_t			server,
 	sessionPrivate = (SCHelperSessionPrivateRef)session;
 
 	// create per-session port
-	kr = mach_port_allocate(mach_task_self(), MACH_PORT_RIGHT_RECEIVE, &sessionPrivate->port);
+	kr = mach_port_allocate(mach_task_self(), MACH_PORT_RIGHT_RECEIVE, newSession);
 	if (kr != KERN_SUCCESS) {
 		SC_log(LOG_ERR, "mach_port_allocate() failed: %s", mach_error_string(kr));
 		*status = kr;
 		goto done;
 	}
 
-	*newSession = sessionPrivate->port;
+	__SCHelperSessionSetPort(session, *newSession);
 
 	(void) mach_port_set_attributes(mach_task_self(),
 					*newSession,
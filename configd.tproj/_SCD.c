@@ -53,6 +53,8 @@ __private_extern__ CFMutableSetRef		removedSessionKeys	= NULL;
 
 __private_extern__ CFMutableSetRef		needsNotification	= NULL;
 
+__private_extern__ storeStatistics		storeStats;
+
 
 __private_extern__
 void
@@ -250,6 +252,9 @@ pushNotifications(void)
 		return;		/* if no sessions need to be kicked */
 
 	notifyCnt = CFSetGetCount(needsNotification);
+	storeStats.notifyPushes++;
+	storeStats.notifySessions += notifyCnt;
+	storeStats.notifyFanout[storeStatsBucket(notifyCnt)]++;
 	if (notifyCnt > (CFIndex)(sizeof(sessionsToNotify_q) / sizeof(CFNumberRef)))
 		sessionsToNotify = CFAllocatorAllocate(NULL, notifyCnt * sizeof(CFNumberRef), 0);
 	CFSetGetValues(needsNotification, sessionsToNotify);
@@ -86,6 +86,47 @@ extern CFMutableSetRef		removedSessionKeys;
 extern CFMutableSetRef		needsNotification;
 
 
+/*
+ * store statistics
+ *
+ * Note: the counters are only updated (and reported) on the SCDynamicStore
+ *       server thread so no locking is needed.
+ */
+#define	SCD_STATS_REQUESTS	32	/* # of [MiG] requests tracked by message ID */
+#define	SCD_STATS_BUCKETS	24	/* # of (log2) histogram buckets */
+
+typedef struct {
+	/* requests */
+	uint64_t		requests[SCD_STATS_REQUESTS + 1];	/* [SCD_STATS_REQUESTS] == other */
+	uint64_t		requestBytesIn;
+	uint64_t		requestBytesOut;
+	uint64_t		requestLatency[SCD_STATS_BUCKETS];	/* usec */
+
+	/* notifications */
+	uint64_t		notifyPushes;
+	uint64_t		notifySessions;
+	uint64_t		notifyFanout[SCD_STATS_BUCKETS];	/* sessions per push */
+
+	/* patterns */
+	uint64_t		patternCompiles;
+	uint64_t		patternEvaluations;
+	uint64_t		patternMatches;
+} storeStatistics;
+
+extern storeStatistics		storeStats;
+
+
+static __inline__ unsigned int
+storeStatsBucket(uint64_t value)
+{
+	unsigned int	bucket;
+
+	/* bucket "n" holds values in the range [2^(n-1), 2^n) */
+	bucket = (value != 0) ? (unsigned int)(64 - __builtin_clzll(value)) : 0;
+	return (bucket < SCD_STATS_BUCKETS) ? bucket : (SCD_STATS_BUCKETS - 1);
+}
+
+
 __BEGIN_DECLS
 
 int
@@ -145,6 +186,10 @@ __SCDynamicStoreNotifyValue		(SCDynamicStoreRef	store,
 int
 __SCDynamicStoreSnapshot		(SCDynamicStoreRef	store);
 
+int
+__SCDynamicStoreCopyStatistics		(SCDynamicStoreRef	store,
+					 CFDictionaryRef	*statistics);
+
 int
 __SCDynamicStoreAddWatchedKey		(SCDynamicStoreRef	store,
 					 CFStringRef		key,
@@ -234,3 +234,215 @@ _snapshot(mach_port_t server, int *sc_status, audit_token_t audit_token)
 	*sc_status = __SCDynamicStoreSnapshot(mySession->store);
 	return KERN_SUCCESS;
 }
+
+
+/*
+ * names of the [config.defs] requests, indexed by (msgh_id - 20000)
+ */
+static const char	*requestNames[SCD_STATS_REQUESTS]	= {
+	[ 0]	= "configopen",
+	[ 8]	= "configlist",
+	[ 9]	= "configadd",
+	[10]	= "configget",
+	[11]	= "configset",
+	[12]	= "configremove",
+	[14]	= "configadd_s",
+	[15]	= "confignotify",
+	[16]	= "configget_m",
+	[17]	= "configset_m",
+	[18]	= "notifyadd",
+	[19]	= "notifyremove",
+	[20]	= "notifychanges",
+	[21]	= "notifyviaport",
+	[23]	= "notifyviasignal",
+	[24]	= "notifycancel",
+	[25]	= "notifyset",
+	[26]	= "notifyviafd",
+	[29]	= "snapshot",
+	[30]	= "statistics",
+};
+
+
+static void
+addCount(CFMutableDictionaryRef dict, CFStringRef key, uint64_t count)
+{
+	CFNumberRef	num;
+
+	num = CFNumberCreate(NULL, kCFNumberSInt64Type, &count);
+	CFDictionarySetValue(dict, key, num);
+	CFRelease(num);
+	return;
+}
+
+
+static CF_RETURNS_RETAINED CFArrayRef
+copyHistogram(const uint64_t *buckets)
+{
+	int			i;
+	int			n;
+	CFMutableArrayRef	histogram;
+
+	/* trim the unused (upper) buckets */
+	for (n = SCD_STATS_BUCKETS; n > 0; n--) {
+		if (buckets[n - 1] != 0) {
+			break;
+		}
+	}
+
+	histogram = CFArrayCreateMutable(NULL, n, &kCFTypeArrayCallBacks);
+	for (i = 0; i < n; i++) {
+		CFNumberRef	num;
+
+		num = CFNumberCreate(NULL, kCFNumberSInt64Type, &buckets[i]);
+		CFArrayAppendValue(histogram, num);
+		CFRelease(num);
+	}
+
+	return histogram;
+}
+
+
+__private_extern__
+int
+__SCDynamicStoreCopyStatistics(SCDynamicStoreRef store, CFDictionaryRef *statistics)
+{
+#pragma unused(store)
+	CFArrayRef		array;
+	CFMutableDictionaryRef	dict;
+	int			i;
+	CFMutableDictionaryRef	requests;
+	CFMutableDictionaryRef	stats;
+
+	stats = CFDictionaryCreateMutable(NULL,
+					  0,
+					  &kCFTypeDictionaryKeyCallBacks,
+					  &kCFTypeDictionaryValueCallBacks);
+
+	/* requests */
+	dict = CFDictionaryCreateMutable(NULL,
+					 0,
+					 &kCFTypeDictionaryKeyCallBacks,
+					 &kCFTypeDictionaryValueCallBacks);
+	requests = CFDictionaryCreateMutable(NULL,
+					     0,
+					     &kCFTypeDictionaryKeyCallBacks,
+					     &kCFTypeDictionaryValueCallBacks);
+	for (i = 0; i <= SCD_STATS_REQUESTS; i++) {
+		CFStringRef	name;
+
+		if (storeStats.requests[i] == 0) {
+			continue;
+		}
+
+		if (i == SCD_STATS_REQUESTS) {
+			name = CFRetain(CFSTR("other"));
+		} else if (requestNames[i] != NULL) {
+			name = CFStringCreateWithCString(NULL, requestNames[i], kCFStringEncodingASCII);
+		} else {
+			name = CFStringCreateWithFormat(NULL, NULL, CFSTR("msgid %d"), 20000 + i);
+		}
+		addCount(requests, name, storeStats.requests[i]);
+		CFRelease(name);
+	}
+	CFDictionarySetValue(dict, CFSTR("count"), requests);
+	CFRelease(requests);
+	addCount(dict, CFSTR("bytesIn"), storeStats.requestBytesIn);
+	addCount(dict, CFSTR("bytesOut"), storeStats.requestBytesOut);
+	array = copyHistogram(storeStats.requestLatency);
+	CFDictionarySetValue(dict, CFSTR("latency"), array);
+	CFRelease(array);
+	CFDictionarySetValue(stats, CFSTR("requests"), dict);
+	CFRelease(dict);
+
+	/* notifications */
+	dict = CFDictionaryCreateMutable(NULL,
+					 0,
+					 &kCFTypeDictionaryKeyCallBacks,
+					 &kCFTypeDictionaryValueCallBacks);
+	addCount(dict, CFSTR("pushes"), storeStats.notifyPushes);
+	addCount(dict, CFSTR("sessions"), storeStats.notifySessions);
+	array = copyHistogram(storeStats.notifyFanout);
+	CFDictionarySetValue(dict, CFSTR("fanout"), array);
+	CFRelease(array);
+	CFDictionarySetValue(stats, CFSTR("notifications"), dict);
+	CFRelease(dict);
+
+	/* patterns */
+	dict = CFDictionaryCreateMutable(NULL,
+					 0,
+					 &kCFTypeDictionaryKeyCallBacks,
+					 &kCFTypeDictionaryValueCallBacks);
+	addCount(dict, CFSTR("patterns"), CFDictionaryGetCount(patternData));
+	addCount(dict, CFSTR("compiles"), storeStats.patternCompiles);
+	addCount(dict, CFSTR("evaluations"), storeStats.patternEvaluations);
+	addCount(dict, CFSTR("matches"), storeStats.patternMatches);
+	CFDictionarySetValue(stats, CFSTR("patterns"), dict);
+	CFRelease(dict);
+
+	/* store */
+	dict = CFDictionaryCreateMutable(NULL,
+					 0,
+					 &kCFTypeDictionaryKeyCallBacks,
+					 &kCFTypeDictionaryValueCallBacks);
+	addCount(dict, CFSTR("keys"), CFDictionaryGetCount(storeData));
+	addCount(dict, CFSTR("sessions"), CFDictionaryGetCount(sessionData));
+	CFDictionarySetValue(stats, CFSTR("store"), dict);
+	CFRelease(dict);
+
+	/* sessions */
+	array = copySessionStatistics();
+	CFDictionarySetValue(stats, CFSTR("sessions"), array);
+	CFRelease(array);
+
+	*statistics = stats;
+	return kSCStatusOK;
+}
+
+
+__private_extern__
+kern_return_t
+_statistics(mach_port_t			server,
+	    xmlDataOut_t		*dataRef,	/* raw XML bytes */
+	    mach_msg_type_number_t	*dataLen,
+	    int				*sc_status,
+	    audit_token_t		audit_token)
+{
+	CFIndex			len;
+	serverSessionRef	mySession;
+	Boolean			ok;
+	CFDictionaryRef		stats;
+
+	*dataRef = NULL;
+	*dataLen = 0;
+
+	mySession = getSession(server);
+	if (mySession == NULL) {
+		mySession = tempSession(server, CFSTR("SCDynamicStoreCopyStatistics"), audit_token);
+		if (mySession == NULL) {
+			/* you must have an open session to play */
+			*sc_status = kSCStatusNoStoreSession;
+			return KERN_SUCCESS;
+		}
+	}
+
+	/* the statistics include per-session (client) details */
+	if (!hasRootAccess(mySession)) {
+		*sc_status = kSCStatusAccessError;
+		return KERN_SUCCESS;
+	}
+
+	*sc_status = __SCDynamicStoreCopyStatistics(mySession->store, &stats);
+	if (*sc_status != kSCStatusOK) {
+		return KERN_SUCCESS;
+	}
+
+	/* serialize the statistics */
+	ok = _SCSerialize(stats, NULL, (void **)dataRef, &len);
+	*dataLen = (mach_msg_type_number_t)len;
+	CFRelease(stats);
+	if (!ok) {
+		*sc_status = kSCStatusFailed;
+	}
+
+	return KERN_SUCCESS;
+}
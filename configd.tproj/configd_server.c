@@ -38,6 +38,7 @@
 #include <sysexits.h>
 #include <unistd.h>
 #include <sys/types.h>
+#include <mach/mach_time.h>
 #include <servers/bootstrap.h>
 
 #include "configd.h"
@@ -94,19 +95,82 @@ config_demux(mach_msg_header_t *request, mach_msg_header_t *reply)
 #define	MACH_MSG_BUFFER_SIZE	128
 
 
+static uint64_t
+msgBytes(mach_msg_header_t *msg)
+{
+	uint64_t	bytes	= msg->msgh_size;
+
+	if ((msg->msgh_bits & MACH_MSGH_BITS_COMPLEX) != 0) {
+		mach_msg_body_t	*body	= (mach_msg_body_t *)(msg + 1);
+		uint8_t		*desc	= (uint8_t *)(body + 1);
+		mach_msg_size_t	i;
+
+		/* include any out-of-line data */
+		for (i = 0; i < body->msgh_descriptor_count; i++) {
+			switch (((mach_msg_type_descriptor_t *)(void *)desc)->type) {
+				case MACH_MSG_OOL_DESCRIPTOR :
+				case MACH_MSG_OOL_VOLATILE_DESCRIPTOR :
+					bytes += ((mach_msg_ool_descriptor_t *)(void *)desc)->size;
+					desc += sizeof(mach_msg_ool_descriptor_t);
+					break;
+				case MACH_MSG_OOL_PORTS_DESCRIPTOR :
+					desc += sizeof(mach_msg_ool_ports_descriptor_t);
+					break;
+				default :
+					desc += sizeof(mach_msg_port_descriptor_t);
+					break;
+			}
+		}
+	}
+
+	return bytes;
+}
+
+
+static uint64_t
+updateRequestStatistics(mach_msg_header_t *request, mach_msg_header_t *reply, uint64_t start)
+{
+	uint64_t			elapsed;
+	mach_msg_id_t			msgid;
+	static mach_timebase_info_data_t	timebase	= { 0, 0 };
+
+	if (timebase.denom == 0) {
+		(void) mach_timebase_info(&timebase);
+	}
+
+	msgid = request->msgh_id - _config_subsystem.start;
+	if ((msgid < 0) || (msgid >= SCD_STATS_REQUESTS)) {
+		// if not a config.defs request
+		msgid = SCD_STATS_REQUESTS;
+	}
+	storeStats.requests[msgid]++;
+
+	storeStats.requestBytesIn += msgBytes(request);
+	storeStats.requestBytesOut += msgBytes(reply);
+
+	elapsed = ((mach_absolute_time() - start) * timebase.numer / timebase.denom) / NSEC_PER_USEC;
+	storeStats.requestLatency[storeStatsBucket(elapsed)]++;
+
+	return elapsed;
+}
+
+
 __private_extern__
 void
 configdCallback(CFMachPortRef port, void *msg, CFIndex size, void *info)
 {
 #pragma unused(port)
 #pragma unused(size)
-#pragma unused(info)
 	mig_reply_error_t *	bufRequest	= msg;
 	uint32_t		bufReply_q[MACH_MSG_BUFFER_SIZE/sizeof(uint32_t)];
 	mig_reply_error_t *	bufReply	= (mig_reply_error_t *)bufReply_q;
 	static size_t		bufSize		= 0;
 	mach_msg_return_t	mr;
 	int			options;
+	serverSessionRef	session		= (serverSessionRef)info;
+	uint64_t		elapsed;
+	Boolean			isRequest;
+	uint64_t		start;
 
 	if (bufSize == 0) {
 		// get max size for MiG reply buffers
@@ -124,8 +188,20 @@ configdCallback(CFMachPortRef port, void *msg, CFIndex size, void *info)
 	}
 	bufReply->RetCode = 0;
 
+	/*
+	 * Note: a MACH_NOTIFY_NO_SENDERS notification will release the
+	 *       session so we only account for SCDynamicStore requests.
+	 */
+	isRequest = ((bufRequest->Head.msgh_id >= _config_subsystem.start) &&
+		     (bufRequest->Head.msgh_id <  _config_subsystem.end));
+
 	/* we have a request message */
+	start = mach_absolute_time();
 	(void) config_demux(&bufRequest->Head, &bufReply->Head);
+	elapsed = updateRequestStatistics(&bufRequest->Head, &bufReply->Head, start);
+	if (isRequest && (session != NULL)) {
+		sessionAccountRequest(session, elapsed);
+	}
 
 	if (!(bufReply->Head.msgh_bits & MACH_MSGH_BITS_COMPLEX)) {
 		if (bufReply->RetCode == MIG_NO_REPLY) {
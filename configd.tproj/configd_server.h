@@ -56,6 +56,12 @@ kern_return_t	_snapshot	(mach_port_t		server,
 				 int			*sc_status,
 				 audit_token_t		audit_token);
 
+kern_return_t	_statistics	(mach_port_t		server,
+				 xmlDataOut_t		*dataRef,
+				 mach_msg_type_number_t	*dataLen,
+				 int			*sc_status,
+				 audit_token_t		audit_token);
+
 kern_return_t	_configopen	(mach_port_t		server,
 				 xmlData_t		nameRef,
 				 mach_msg_type_number_t	nameLen,
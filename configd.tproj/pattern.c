@@ -90,9 +90,11 @@ keyMatchesPattern(CFStringRef key, CFDataRef pRegex)
 	preg = (regex_t *)(void *)CFDataGetBytePtr(pRegex);
 
 	/* compare key to regular expression pattern */
+	storeStats.patternEvaluations++;
 	reError = regexec(preg, str, 0, NULL, 0);
 	switch (reError) {
 		case 0 :
+			storeStats.patternMatches++;
 			match = TRUE;
 			break;
 		case REG_NOMATCH :
@@ -196,6 +198,7 @@ patternCompile(CFStringRef pattern, CFDataRef pRegex, CFStringRef *error)
 		/* ALIGN: CF aligns to >8 byte boundries */
 		preg = (regex_t *)(void *)CFDataGetBytePtr(pRegex);
 
+		storeStats.patternCompiles++;
 		reError = regcomp(preg, str, REG_EXTENDED);
 		if (reError != 0) {
 			char	reErrBuf[256];
@@ -482,12 +485,14 @@ addKeyForPattern(const void *key, void *val, void *context)
 	/* compare new store key to regular expression pattern */
 	/* ALIGN: CF aligns to >8 byte boundries */
 	preg = (regex_t *)(void *)CFDataGetBytePtr(CFArrayGetValueAtIndex(pInfo, 0));
+	storeStats.patternEvaluations++;
 	reError = regexec(preg, str, 0, NULL, 0);
 	switch (reError) {
 		case 0 : {
 			/*
 			 * we've got a match
 			 */
+			storeStats.patternMatches++;
 			CFIndex			i;
 			CFIndex			n;
 			CFMutableArrayRef	pInfo_new;
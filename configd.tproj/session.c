@@ -54,6 +54,82 @@ static int		lastSession	= -1;	/* # of last used session */
 /* CFMachPortInvalidation runloop */
 static CFRunLoopRef	sessionRunLoop	= NULL;
 
+/*
+ * per-session (soft) quotas
+ *
+ *   requests	: max # of requests serviced per accounting window
+ *   time	: max time (usec) spent servicing requests per accounting window
+ *   sessionKeys	: max # of session keys
+ *   keys	: max # of watched keys
+ *   patterns	: max # of watched patterns
+ *
+ * Exceeding any of the quotas is logged.  Only when the request or time
+ * quota has been explicitly set (SCD_QUOTA_REQUESTS, SCD_QUOTA_TIME) is
+ * it enforced, a session exceeding an enforced quota will not be serviced
+ * for the remainder of the accounting window.  A quota of zero is unlimited.
+ */
+#define	QUOTA_WINDOW		1.0	/* seconds */
+
+#define	QUOTA_REQUESTS		(1 << 0)
+#define	QUOTA_SESSION_KEYS	(1 << 1)
+#define	QUOTA_KEYS		(1 << 2)
+#define	QUOTA_PATTERNS		(1 << 3)
+
+static struct {
+	uint64_t	requests;
+	uint64_t	time;
+	CFIndex		sessionKeys;
+	CFIndex		keys;
+	CFIndex		patterns;
+	Boolean		enforceRequests;
+	Boolean		enforceTime;
+} quota	= {
+	.requests	= 2000,
+	.time		= 250000,	/* 250ms */
+	.sessionKeys	= 1000,
+	.keys		= 1000,
+	.patterns	= 250,
+	.enforceRequests	= FALSE,	/* log only */
+	.enforceTime		= FALSE,	/* log only */
+};
+
+
+static void
+quotaInit(void)
+{
+	const char	*str;
+
+	/* allow the default quotas to be overridden (e.g. by launchd) */
+	str = getenv("SCD_QUOTA_REQUESTS");
+	if (str != NULL) {
+		quota.requests = strtoull(str, NULL, 0);
+		quota.enforceRequests = TRUE;
+	}
+
+	str = getenv("SCD_QUOTA_TIME");		/* msec */
+	if (str != NULL) {
+		quota.time = strtoull(str, NULL, 0) * 1000;
+		quota.enforceTime = TRUE;
+	}
+
+	str = getenv("SCD_QUOTA_SESSION_KEYS");
+	if (str != NULL) {
+		quota.sessionKeys = strtol(str, NULL, 0);
+	}
+
+	str = getenv("SCD_QUOTA_KEYS");
+	if (str != NULL) {
+		quota.keys = strtol(str, NULL, 0);
+	}
+
+	str = getenv("SCD_QUOTA_PATTERNS");
+	if (str != NULL) {
+		quota.patterns = strtol(str, NULL, 0);
+	}
+
+	return;
+}
+
 
 __private_extern__
 serverSessionRef
@@ -155,6 +231,9 @@ addSession(mach_port_t server, CFStringRef (*copyDescription)(const void *info))
 
 		// allocate a new session for "the" server
 		newSession = calloc(1, sizeof(serverSession));
+
+		// establish the per-session quotas
+		quotaInit();
 	} else {
 		int			i;
 #ifdef	HAVE_MACHPORT_GUARDS
@@ -324,6 +403,14 @@ cleanupSession(mach_port_t server)
 			(void) mach_port_mod_refs(mach_task_self(), server, MACH_PORT_RIGHT_RECEIVE, -1);
 #endif	// HAVE_MACHPORT_GUARDS
 
+			/*
+			 * stop any throttling
+			 */
+			if (thisSession->throttleTimer != NULL) {
+				CFRunLoopTimerInvalidate(thisSession->throttleTimer);
+				CFRelease(thisSession->throttleTimer);
+			}
+
 			/*
 			 * release any entitlement info
 			 */
@@ -687,3 +774,267 @@ hasPathAccess(serverSessionRef session, const char *path)
 
 	return TRUE;
 }
+
+
+#pragma mark -
+#pragma mark Session accounting
+
+
+static void
+sessionResources(serverSessionRef session, CFIndex *sessionKeys, CFIndex *keys, CFIndex *patterns)
+{
+	SCDynamicStorePrivateRef	storePrivate	= (SCDynamicStorePrivateRef)session->store;
+
+	*sessionKeys = 0;
+	*keys        = 0;
+	*patterns    = 0;
+
+	if (storePrivate == NULL) {
+		return;
+	}
+
+	if (sessionData != NULL) {
+		CFDictionaryRef	info;
+		CFStringRef	key;
+
+		key = CFStringCreateWithFormat(NULL, NULL, CFSTR("%d"), session->key);
+		info = CFDictionaryGetValue(sessionData, key);
+		CFRelease(key);
+		if (info != NULL) {
+			CFArrayRef	sessionKeysList;
+
+			sessionKeysList = CFDictionaryGetValue(info, kSCDSessionKeys);
+			if (sessionKeysList != NULL) {
+				*sessionKeys = CFArrayGetCount(sessionKeysList);
+			}
+		}
+	}
+
+	if (storePrivate->keys != NULL) {
+		*keys = CFArrayGetCount(storePrivate->keys);
+	}
+
+	if (storePrivate->patterns != NULL) {
+		*patterns = CFArrayGetCount(storePrivate->patterns);
+	}
+
+	return;
+}
+
+
+static void
+sessionCheckQuota(serverSessionRef session, uint32_t which, const char *what, CFIndex n, CFIndex max)
+{
+	if ((max > 0) && (n > max)) {
+		if ((session->quotaExceeded & which) == 0) {
+			SC_log(LOG_NOTICE, "%@ : exceeded %s quota (%ld > %ld)",
+			       sessionName(session),
+			       what,
+			       n,
+			       max);
+			session->quotaExceeded |= which;
+		}
+	} else {
+		session->quotaExceeded &= ~which;
+	}
+
+	return;
+}
+
+
+static void
+sessionCheckResources(serverSessionRef session)
+{
+	CFIndex	keys;
+	CFIndex	patterns;
+	CFIndex	sessionKeys;
+
+	sessionResources(session, &sessionKeys, &keys, &patterns);
+	sessionCheckQuota(session, QUOTA_SESSION_KEYS, "session keys", sessionKeys, quota.sessionKeys);
+	sessionCheckQuota(session, QUOTA_KEYS, "watched keys", keys, quota.keys);
+	sessionCheckQuota(session, QUOTA_PATTERNS, "watched patterns", patterns, quota.patterns);
+	return;
+}
+
+
+static void
+sessionResume(CFRunLoopTimerRef timer, void *info)
+{
+	serverSessionRef	session	= (serverSessionRef)info;
+
+	assert(timer == session->throttleTimer);
+	CFRunLoopTimerInvalidate(session->throttleTimer);
+	CFRelease(session->throttleTimer);
+	session->throttleTimer = NULL;
+
+	if (session->serverRunLoopSource != NULL) {
+		/* resume servicing this session */
+		CFRunLoopAddSource(sessionRunLoop,
+				   session->serverRunLoopSource,
+				   kCFRunLoopDefaultMode);
+	}
+
+	return;
+}
+
+
+static void
+sessionThrottle(serverSessionRef session, Boolean enforce)
+{
+	CFRunLoopTimerContext	context	= { 0, NULL, NULL, NULL, NULL };
+
+	if ((session->quotaExceeded & QUOTA_REQUESTS) == 0) {
+		SC_log(LOG_NOTICE, "%@ : exceeded request quota (%llu requests, %llu usec)%s",
+		       sessionName(session),
+		       session->windowRequests,
+		       session->windowTime,
+		       enforce ? ", throttling" : "");
+		session->quotaExceeded |= QUOTA_REQUESTS;
+	}
+
+	if (!enforce) {
+		/* log only */
+		return;
+	}
+
+	session->throttled++;
+
+	if (session->serverRunLoopSource == NULL) {
+		return;
+	}
+
+	/* stop servicing this session until the end of the accounting window */
+	CFRunLoopRemoveSource(sessionRunLoop,
+			      session->serverRunLoopSource,
+			      kCFRunLoopDefaultMode);
+
+	context.info = session;
+	session->throttleTimer = CFRunLoopTimerCreate(NULL,
+						      session->window + QUOTA_WINDOW,
+						      0,
+						      0,
+						      0,
+						      sessionResume,
+						      &context);
+	CFRunLoopAddTimer(sessionRunLoop, session->throttleTimer, kCFRunLoopDefaultMode);
+	return;
+}
+
+
+__private_extern__
+void
+sessionAccountRequest(serverSessionRef session, uint64_t usec)
+{
+	CFAbsoluteTime	now;
+	Boolean		overRequests;
+	Boolean		overTime;
+
+	session->requests++;
+	session->requestTime += usec;
+
+	now = CFAbsoluteTimeGetCurrent();
+	if (now >= (session->window + QUOTA_WINDOW)) {
+		/* start a new accounting window */
+		if (((quota.requests == 0) || (session->windowRequests <= quota.requests)) &&
+		    ((quota.time     == 0) || (session->windowTime     <= quota.time    ))) {
+			session->quotaExceeded &= ~QUOTA_REQUESTS;
+		}
+		session->window         = now;
+		session->windowRequests = 0;
+		session->windowTime     = 0;
+	}
+	session->windowRequests++;
+	session->windowTime += usec;
+
+	/* check the resource quotas (which any request may have changed) */
+	sessionCheckResources(session);
+
+	if ((session == sessions[0]) || (session->throttleTimer != NULL)) {
+		/* never throttle the "server" port (or re-throttle a session) */
+		return;
+	}
+
+	overRequests = (quota.requests > 0) && (session->windowRequests > quota.requests);
+	overTime     = (quota.time     > 0) && (session->windowTime     > quota.time    );
+	if (overRequests || overTime) {
+		Boolean	enforce;
+
+		enforce = (overRequests && quota.enforceRequests) ||
+			  (overTime     && quota.enforceTime    );
+		if (enforce && (sessionPid(session) == getpid())) {
+			/* don't throttle our own plugins */
+			enforce = FALSE;
+		}
+
+		sessionThrottle(session, enforce);
+	}
+
+	return;
+}
+
+
+__private_extern__
+CFArrayRef
+copySessionStatistics(void)
+{
+	int			i;
+	CFMutableArrayRef	sessionStats;
+
+	sessionStats = CFArrayCreateMutable(NULL, 0, &kCFTypeArrayCallBacks);
+	for (i = 1; i <= lastSession; i++) {
+		CFMutableDictionaryRef	dict;
+		CFIndex			keys;
+		CFNumberRef		num;
+		CFIndex			patterns;
+		CFIndex			sessionKeys;
+		serverSessionRef	thisSession = sessions[i];
+
+		if ((thisSession == NULL) || (thisSession->requests == 0)) {
+			continue;
+		}
+
+		dict = CFDictionaryCreateMutable(NULL,
+						 0,
+						 &kCFTypeDictionaryKeyCallBacks,
+						 &kCFTypeDictionaryValueCallBacks);
+
+		num = CFNumberCreate(NULL, kCFNumberIntType, &thisSession->key);
+		CFDictionarySetValue(dict, CFSTR("port"), num);
+		CFRelease(num);
+
+		CFDictionarySetValue(dict, CFSTR("name"), sessionName(thisSession));
+
+		num = CFNumberCreate(NULL, kCFNumberSInt64Type, &thisSession->requests);
+		CFDictionarySetValue(dict, CFSTR("requests"), num);
+		CFRelease(num);
+
+		num = CFNumberCreate(NULL, kCFNumberSInt64Type, &thisSession->requestTime);
+		CFDictionarySetValue(dict, CFSTR("requestTime"), num);
+		CFRelease(num);
+
+		sessionResources(thisSession, &sessionKeys, &keys, &patterns);
+
+		num = CFNumberCreate(NULL, kCFNumberCFIndexType, &sessionKeys);
+		CFDictionarySetValue(dict, CFSTR("sessionKeys"), num);
+		CFRelease(num);
+
+		num = CFNumberCreate(NULL, kCFNumberCFIndexType, &keys);
+		CFDictionarySetValue(dict, CFSTR("keys"), num);
+		CFRelease(num);
+
+		num = CFNumberCreate(NULL, kCFNumberCFIndexType, &patterns);
+		CFDictionarySetValue(dict, CFSTR("patterns"), num);
+		CFRelease(num);
+
+		if (thisSession->throttled > 0) {
+			num = CFNumberCreate(NULL, kCFNumberSInt64Type, &thisSession->throttled);
+			CFDictionarySetValue(dict, CFSTR("throttled"), num);
+			CFRelease(num);
+		}
+
+		CFArrayAppendValue(sessionStats, dict);
+		CFRelease(dict);
+	}
+
+	return sessionStats;
+}
@@ -97,6 +97,16 @@ typedef struct {
 	 */
 	CFTypeRef		callerWriteEntitlement;
 
+	/* resource accounting */
+	uint64_t		requests;	/* # of requests serviced */
+	uint64_t		requestTime;	/* usec spent servicing requests */
+	CFAbsoluteTime		window;		/* start of the current accounting window */
+	uint64_t		windowRequests;	/* # of requests serviced (this window) */
+	uint64_t		windowTime;	/* usec spent servicing requests (this window) */
+	uint32_t		quotaExceeded;	/* soft quotas exceeded (and logged) */
+	uint64_t		throttled;	/* # of times the session was throttled */
+	CFRunLoopTimerRef	throttleTimer;	/* if throttled, timer to resume servicing */
+
 } serverSession, *serverSessionRef;
 
 __BEGIN_DECLS
@@ -114,6 +124,11 @@ void			cleanupSession	(mach_port_t	server);
 
 void			listSessions	(FILE		*f);
 
+CFArrayRef		copySessionStatistics	(void);
+
+void			sessionAccountRequest	(serverSessionRef	session,
+						 uint64_t		usec);
+
 Boolean			hasRootAccess	(serverSessionRef	session);
 
 Boolean			hasWriteAccess	(serverSessionRef	session,
@@ -39,9 +39,114 @@
 #import "dnsinfo_internal.h"
 #import <network_information.h>
 
-#define	my_log(__level, __format, ...)	[string appendFormat:@(__format "\n"), ## __VA_ARGS__]
-#define my_log_context_type	NSMutableString *
-#define	my_log_context_name	string
+#pragma mark -
+#pragma mark Formatting buffer
+
+/*
+ * The os_state formatters write into a single growable buffer (rather
+ * than appending each line to an NSMutableString).  The text is kept in
+ * the system encoding, the encoding used by "%s" with -appendFormat:,
+ * so that the resulting string is the same.
+ */
+
+typedef struct {
+	char	*buf;
+	size_t	len;
+	size_t	size;
+} SC_formatBuffer, *SC_formatBufferRef;
+
+static void
+_SC_formatBufferReserve(SC_formatBufferRef buffer, size_t needed)
+{
+	if (buffer->len + needed < buffer->size) {
+		return;
+	}
+
+	if (buffer->size == 0) {
+		buffer->size = 16 * 1024;
+	}
+	while (buffer->len + needed >= buffer->size) {
+		buffer->size *= 2;
+	}
+	buffer->buf = reallocf(buffer->buf, buffer->size);
+	return;
+}
+
+static void
+_SC_formatBufferAppendFormat(SC_formatBufferRef buffer, const char *format, ...)
+{
+	va_list	args;
+
+	if (strstr(format, "%@") != NULL) {
+		CFStringRef	formatString;
+		CFIndex		len;
+		CFIndex		n;
+		CFStringRef	str;
+
+		// object formatting requires CF
+		formatString = CFStringCreateWithCString(NULL, format, kCFStringEncodingUTF8);
+		va_start(args, format);
+		str = CFStringCreateWithFormatAndArguments(NULL, NULL, formatString, args);
+		va_end(args);
+		CFRelease(formatString);
+		if (str == NULL) {
+			return;
+		}
+
+		n = CFStringGetLength(str);
+		(void)CFStringGetBytes(str, CFRangeMake(0, n), CFStringGetSystemEncoding(), '?', FALSE, NULL, 0, &len);
+		_SC_formatBufferReserve(buffer, (size_t)len);
+		(void)CFStringGetBytes(str, CFRangeMake(0, n), CFStringGetSystemEncoding(), '?', FALSE,
+				       (UInt8 *)buffer->buf + buffer->len, len, &len);
+		buffer->len += (size_t)len;
+		CFRelease(str);
+		return;
+	}
+
+	_SC_formatBufferReserve(buffer, 256);
+	while (TRUE) {
+		int	n;
+
+		va_start(args, format);
+		n = vsnprintf(buffer->buf + buffer->len, buffer->size - buffer->len, format, args);
+		va_end(args);
+		if (n < 0) {
+			return;
+		}
+		if ((size_t)n < buffer->size - buffer->len) {
+			buffer->len += (size_t)n;
+			return;
+		}
+		_SC_formatBufferReserve(buffer, (size_t)n + 1);
+	}
+}
+
+static NS_RETURNS_RETAINED NSString *
+_SC_formatBufferCopyString(SC_formatBufferRef buffer)
+{
+	NSStringEncoding	encoding;
+	NSString		*string;
+
+	if (buffer->len == 0) {
+		free(buffer->buf);
+		return nil;
+	}
+
+	encoding = CFStringConvertEncodingToNSStringEncoding(CFStringGetSystemEncoding());
+	string = [[NSString alloc] initWithBytesNoCopy:buffer->buf
+						length:buffer->len
+					      encoding:encoding
+					  freeWhenDone:YES];
+	if (string == nil) {
+		free(buffer->buf);
+	}
+
+	return string;
+}
+
+#define	my_log(__level, __format, ...)	_SC_formatBufferAppendFormat(buffer, __format "\n", ## __VA_ARGS__)
+#define my_log_context_type	SC_formatBufferRef
+#define	my_log_context_name	buffer
 #import "dnsinfo_logging.h"
 #import "network_state_information_logging.h"
 #undef	my_log_context_name
@@ -93,9 +198,10 @@ OSLogCopyFormattedString(const char *type, id value, os_log_type_info_t info)
 static NS_RETURNS_RETAINED NSString *
 _SC_OSStateCopyFormattedString_dnsinfo(uint32_t data_size, void *data)
 {
+	SC_formatBuffer		buffer		= { NULL, 0, 0 };
 	dns_config_t		*dns_config	= NULL;
 	_dns_config_buf_t	*dns_config_buf;
-	NSMutableString		*string;
+	NSString		*string;
 
 	// os_state_add_handler w/
 	//	osd_type                 = OS_STATE_DATA_CUSTOM
@@ -122,21 +228,23 @@ _SC_OSStateCopyFormattedString_dnsinfo(uint32_t data_size, void *data)
 		return @"DNS configuration: expansion error";
 	}
 
-	string = [NSMutableString string];
-	_dns_configuration_log(dns_config, TRUE, string);
-	if (string.length == 0) {
-		[string appendString:@"DNS configuration: not available"];
-	}
+	_dns_configuration_log(dns_config, TRUE, &buffer);
 	free(dns_config);
 
+	string = _SC_formatBufferCopyString(&buffer);
+	if (string == nil) {
+		return @"DNS configuration: not available";
+	}
+
 	return string;
 }
 
 static NS_RETURNS_RETAINED NSString *
 _SC_OSStateCopyFormattedString_nwi(uint32_t data_size, void *data)
 {
+	SC_formatBuffer		buffer	= { NULL, 0, 0 };
 	nwi_state_t		state	= (nwi_state_t)data;
-	NSMutableString		*string;
+	NSString		*string;
 
 	// os_state_add_handler w/
 	//	osd_type                 = OS_STATE_DATA_CUSTOM
@@ -155,10 +263,11 @@ _SC_OSStateCopyFormattedString_nwi(uint32_t data_size, void *data)
 				      NWI_STATE_VERSION);
 	}
 
-	string = [NSMutableString string];
-	_nwi_state_log(state, TRUE, string);
-	if (string.length == 0) {
-		[string appendString:@"Network information: not available"];
+	_nwi_state_log(state, TRUE, &buffer);
+
+	string = _SC_formatBufferCopyString(&buffer);
+	if (string == nil) {
+		return @"Network information: not available";
 	}
 
 	return string;
@@ -451,6 +451,96 @@ do_set(int argc, char **argv)
 }
 
 
+#define	SHOW_PAGE_SIZE	256
+
+
+/*
+ * show_pattern_paged
+ *   Print the content of all keys matching the [regex] pattern.  The
+ *   output matches that of printing the SCDynamicStoreCopyMultiple()
+ *   dictionary but the values are fetched (and printed) a page at a
+ *   time so that a large store need not be copied all at once.
+ */
+static Boolean
+show_pattern_paged(CFStringRef pattern)
+{
+	CFIndex			i;
+	CFArrayRef		list;
+	CFIndex			listCnt;
+	CFMutableDictionaryRef	options;
+	CFMutableArrayRef	sortedList;
+
+	// let the server match the keys
+	list = SCDynamicStoreCopyKeyList(store, pattern);
+	if (list == NULL) {
+		return FALSE;
+	}
+
+	listCnt = CFArrayGetCount(list);
+	sortedList = CFArrayCreateMutableCopy(NULL, listCnt, list);
+	CFRelease(list);
+	CFArraySortValues(sortedList,
+			  CFRangeMake(0, listCnt),
+			  sort_keys,
+			  NULL);
+
+	options = CFDictionaryCreateMutable(NULL,
+					    0,
+					    &kCFTypeDictionaryKeyCallBacks,
+					    &kCFTypeDictionaryValueCallBacks);
+	CFDictionarySetValue(options, CFSTR("PREFIX2"), CFSTR("  "));
+
+	SCPrint(TRUE, stdout, CFSTR("<dictionary> {"));
+	for (i = 0; i < listCnt; i += SHOW_PAGE_SIZE) {
+		CFIndex			j;
+		CFMutableArrayRef	keys;
+		CFIndex			n;
+		CFDictionaryRef		values;
+
+		n = listCnt - i;
+		if (n > SHOW_PAGE_SIZE) {
+			n = SHOW_PAGE_SIZE;
+		}
+		keys = CFArrayCreateMutable(NULL, n, &kCFTypeArrayCallBacks);
+		CFArrayAppendArray(keys, sortedList, CFRangeMake(i, n));
+		values = SCDynamicStoreCopyMultiple(store, keys, NULL);
+		if (values != NULL) {
+			for (j = 0; j < n; j++) {
+				CFStringRef	key;
+				CFStringRef	prefix;
+				CFTypeRef	val;
+				CFStringRef	vStr;
+
+				key = CFArrayGetValueAtIndex(keys, j);
+				val = CFDictionaryGetValue(values, key);
+				if (val == NULL) {
+					// if the key was removed
+					continue;
+				}
+
+				prefix = CFStringCreateWithFormat(NULL, NULL, CFSTR("  %@ : "), key);
+				CFDictionarySetValue(options, CFSTR("PREFIX1"), prefix);
+				CFRelease(prefix);
+
+				vStr = _SCCopyDescription(val, options);
+				SCPrint(TRUE, stdout, CFSTR("\n%@"), vStr);
+				CFRelease(vStr);
+			}
+			CFRelease(values);
+		}
+		CFRelease(keys);
+
+		// get this page out before fetching the next
+		fflush(stdout);
+	}
+	SCPrint(TRUE, stdout, CFSTR("\n}\n"));
+
+	CFRelease(options);
+	CFRelease(sortedList);
+	return TRUE;
+}
+
+
 __private_extern__
 void
 do_show(int argc, char **argv)
@@ -467,46 +557,47 @@ do_show(int argc, char **argv)
 			newValue = cache_SCDynamicStoreCopyValue(store, key);
 		}
 	} else {
-		CFArrayRef	patterns;
+		CFArrayRef		keys;
+		CFMutableDictionaryRef	newDict;
 
-		patterns = CFArrayCreate(NULL, (const void **)&key, 1, &kCFTypeArrayCallBacks);
 		if (!use_cache) {
-			newValue = SCDynamicStoreCopyMultiple(store, NULL, patterns);
-		} else {
-			CFArrayRef		keys;
-			CFMutableDictionaryRef	newDict;
-
-			newDict = CFDictionaryCreateMutable(NULL,
-							    0,
-							    &kCFTypeDictionaryKeyCallBacks,
-							    &kCFTypeDictionaryValueCallBacks);
-			keys = SCDynamicStoreCopyKeyList(store, key);
-			if (keys != NULL) {
-				CFIndex		i;
-				CFIndex		n;
-
-				n = CFArrayGetCount(keys);
-				for (i = 0; i < n; i++) {
-					CFStringRef	storeKey;
-					CFTypeRef	storeVal;
-
-					storeKey = CFArrayGetValueAtIndex(keys, i);
-					storeVal = cache_SCDynamicStoreCopyValue(store, storeKey);
-					if (storeVal != NULL) {
-						CFDictionarySetValue(newDict, storeKey, storeVal);
-						CFRelease(storeVal);
-					}
-				}
-				CFRelease(keys);
+			// fetch (and print) the matching content a page at a time
+			if (!show_pattern_paged(key)) {
+				SCPrint(TRUE, stdout, CFSTR("  %s\n"), SCErrorString(SCError()));
 			}
+			CFRelease(key);
+			return;
+		}
 
-			if ((CFDictionaryGetCount(cached_set) > 0) || (CFArrayGetCount(cached_removals) > 0)) {
-				SCPrint(TRUE, stdout, CFSTR("  Note: SCDynamicStore locked, keys included (below) may be out of date.\n\n"));
+		newDict = CFDictionaryCreateMutable(NULL,
+						    0,
+						    &kCFTypeDictionaryKeyCallBacks,
+						    &kCFTypeDictionaryValueCallBacks);
+		keys = SCDynamicStoreCopyKeyList(store, key);
+		if (keys != NULL) {
+			CFIndex		i;
+			CFIndex		n;
+
+			n = CFArrayGetCount(keys);
+			for (i = 0; i < n; i++) {
+				CFStringRef	storeKey;
+				CFTypeRef	storeVal;
+
+				storeKey = CFArrayGetValueAtIndex(keys, i);
+				storeVal = cache_SCDynamicStoreCopyValue(store, storeKey);
+				if (storeVal != NULL) {
+					CFDictionarySetValue(newDict, storeKey, storeVal);
+					CFRelease(storeVal);
+				}
 			}
+			CFRelease(keys);
+		}
 
-			newValue = newDict;
+		if ((CFDictionaryGetCount(cached_set) > 0) || (CFArrayGetCount(cached_removals) > 0)) {
+			SCPrint(TRUE, stdout, CFSTR("  Note: SCDynamicStore locked, keys included (below) may be out of date.\n\n"));
 		}
-		CFRelease(patterns);
+
+		newValue = newDict;
 	}
 
 	CFRelease(key);
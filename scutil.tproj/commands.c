@@ -125,8 +125,8 @@ const cmdInfo commands_store[] = {
 	{ "n.changes",	0,	0,	do_notify_changes,	5,	0,
 		" n.changes                     : list changed keys"				},
 
-	{ "n.watch",	0,	0,	do_notify_watch,	5,	0,
-		" n.watch                       : watch for changes"				},
+	{ "n.watch",	0,	1,	do_notify_watch,	5,	0,
+		" n.watch [interval]            : watch for changes (batched, w/values)"	},
 
 	{ "n.wait",	0,	0,	do_notify_wait,		5,	2,
 		" n.wait                        : wait for changes"				},
@@ -141,7 +141,10 @@ const cmdInfo commands_store[] = {
 		" n.cancel                      : cancel notification requests"			},
 
 	{ "snapshot",	0,	1,	do_snapshot,		99,	2,
-		" snapshot [file]               : save snapshot of store and session data"	}
+		" snapshot [file]               : save snapshot of store and session data"	},
+
+	{ "statistics",	0,	0,	do_statistics,		99,	2,
+		" statistics                    : show store request/notification statistics"	}
 };
 __private_extern__
 const int nCommands_store = (sizeof(commands_store)/sizeof(cmdInfo));
@@ -46,6 +46,29 @@ static int			osig;
 static struct sigaction		*oact	= NULL;
 
 
+/*
+ * "n.watch <interval>" state
+ *
+ * When watching in batches, the notification callback only records the
+ * changed keys.  A timer (on the watcher thread) then fetches the values
+ * for all of the keys that changed during the interval with a single
+ * SCDynamicStoreCopyMultiple() request and reports them.
+ */
+#define WATCH_BATCH_MAX	256
+
+static pthread_mutex_t		watch_lock	= PTHREAD_MUTEX_INITIALIZER;
+static CFMutableSetRef		watch_pending	= NULL;		// keys changed since the last batch
+static CFRunLoopTimerRef	watch_timer	= NULL;
+static struct {
+	uint64_t	notifications;	// # of callbacks
+	uint64_t	keys;		// # of changed keys reported by the server
+	uint64_t	coalesced;	// # of changes merged with a pending change
+	uint64_t	dropped;	// # of changes not reported (batch full)
+	uint64_t	batches;	// # of batches reported
+	uint64_t	requests;	// # of store requests issued by the watcher
+} watch_stats;
+
+
 static char *
 elapsed()
 {
@@ -97,9 +120,32 @@ storeCallback(SCDynamicStoreRef store, CFArrayRef changedKeys, void *info)
 	int		i;
 	CFIndex		n;
 
+	n = CFArrayGetCount(changedKeys);
+
+	pthread_mutex_lock(&watch_lock);
+	if (watch_pending != NULL) {
+		// batched, just note the changed keys
+		watch_stats.notifications++;
+		for (i = 0; i < n; i++) {
+			CFStringRef	key;
+
+			key = CFArrayGetValueAtIndex(changedKeys, i);
+			watch_stats.keys++;
+			if (CFSetContainsValue(watch_pending, key)) {
+				watch_stats.coalesced++;
+			} else if (CFSetGetCount(watch_pending) < WATCH_BATCH_MAX) {
+				CFSetAddValue(watch_pending, key);
+			} else {
+				watch_stats.dropped++;
+			}
+		}
+		pthread_mutex_unlock(&watch_lock);
+		return;
+	}
+	pthread_mutex_unlock(&watch_lock);
+
 	SCPrint(TRUE, stdout, CFSTR("notification callback (store address = %p).\n"), store);
 
-	n = CFArrayGetCount(changedKeys);
 	if (n > 0) {
 		for (i = 0; i < n; i++) {
 			SCPrint(TRUE,
@@ -282,10 +328,115 @@ do_notify_changes(int argc, char **argv)
 }
 
 
+static void
+watchBatch(CFRunLoopTimerRef timer, void *info)
+{
+#pragma unused(timer)
+#pragma unused(info)
+	CFIndex			i;
+	CFIndex			n;
+	CFMutableDictionaryRef	options;
+	CFMutableSetRef		pending;
+	CFMutableArrayRef	sortedKeys;
+	__typeof__(watch_stats)	stats;
+	CFDictionaryRef		values;
+
+	pthread_mutex_lock(&watch_lock);
+	pending = watch_pending;
+	if ((pending == NULL) || (CFSetGetCount(pending) == 0)) {
+		// if nothing changed
+		pthread_mutex_unlock(&watch_lock);
+		return;
+	}
+	watch_pending = CFSetCreateMutable(NULL, 0, &kCFTypeSetCallBacks);
+	watch_stats.batches++;
+	watch_stats.requests++;
+	stats = watch_stats;
+	pthread_mutex_unlock(&watch_lock);
+
+	n = CFSetGetCount(pending);
+	sortedKeys = CFArrayCreateMutable(NULL, n, &kCFTypeArrayCallBacks);
+	CFSetApplyFunction(pending, (CFSetApplierFunction)CFArrayAppendValue, sortedKeys);
+	CFRelease(pending);
+	CFArraySortValues(sortedKeys, CFRangeMake(0, n), sort_keys, NULL);
+
+	// fetch all of the changed values with a single request
+	values = SCDynamicStoreCopyMultiple(store, sortedKeys, NULL);
+
+	SCPrint(TRUE, stdout,
+		CFSTR("notification batch #%llu (%ld keys) : %llu notifications, %llu changes, %llu coalesced, %llu dropped, %llu requests\n"),
+		stats.batches,
+		n,
+		stats.notifications,
+		stats.keys,
+		stats.coalesced,
+		stats.dropped,
+		stats.requests);
+
+	options = CFDictionaryCreateMutable(NULL,
+					    0,
+					    &kCFTypeDictionaryKeyCallBacks,
+					    &kCFTypeDictionaryValueCallBacks);
+	CFDictionarySetValue(options, CFSTR("PREFIX2"), CFSTR("    "));
+	for (i = 0; i < n; i++) {
+		CFStringRef	key;
+		CFStringRef	prefix;
+		CFTypeRef	val	= NULL;
+		CFStringRef	vStr;
+
+		key = CFArrayGetValueAtIndex(sortedKeys, i);
+		if (values != NULL) {
+			val = CFDictionaryGetValue(values, key);
+		}
+		if (val == NULL) {
+			// if the key was removed
+			SCPrint(TRUE, stdout, CFSTR("  %s changedKey [%ld] = %@ (removed)\n"), elapsed(), i, key);
+			continue;
+		}
+
+		prefix = CFStringCreateWithFormat(NULL, NULL, CFSTR("  %s changedKey [%ld] = %@ : "), elapsed(), i, key);
+		CFDictionarySetValue(options, CFSTR("PREFIX1"), prefix);
+		CFRelease(prefix);
+
+		vStr = _SCCopyDescription(val, options);
+		SCPrint(TRUE, stdout, CFSTR("%@\n"), vStr);
+		CFRelease(vStr);
+	}
+	CFRelease(options);
+	if (values != NULL) CFRelease(values);
+	CFRelease(sortedKeys);
+
+	fflush(stdout);
+	return;
+}
+
+
+static void
+watchBatchStop(void)
+{
+	pthread_mutex_lock(&watch_lock);
+	if (watch_timer != NULL) {
+		CFRunLoopTimerInvalidate(watch_timer);
+		CFRelease(watch_timer);
+		watch_timer = NULL;
+	}
+	if (watch_pending != NULL) {
+		CFRelease(watch_pending);
+		watch_pending = NULL;
+	}
+	pthread_mutex_unlock(&watch_lock);
+
+	return;
+}
+
+
 static void *
 _watcher(void *arg)
 {
-#pragma unused(arg)
+	CFTimeInterval	interval	= *(CFTimeInterval *)arg;
+
+	free(arg);
+
 	notifyRl = CFRunLoopGetCurrent();
 	if (notifyRl == NULL) {
 		SCPrint(TRUE, stdout, CFSTR("  CFRunLoopGetCurrent() failed\n"));
@@ -309,8 +460,24 @@ _watcher(void *arg)
 		CFRunLoopAddSource(notifyRl, notifyRls, kCFRunLoopDefaultMode);
 	}
 
+	if (interval > 0) {
+		pthread_mutex_lock(&watch_lock);
+		bzero(&watch_stats, sizeof(watch_stats));
+		watch_pending = CFSetCreateMutable(NULL, 0, &kCFTypeSetCallBacks);
+		watch_timer = CFRunLoopTimerCreate(NULL,
+						   CFAbsoluteTimeGetCurrent() + interval,
+						   interval,
+						   0,
+						   0,
+						   watchBatch,
+						   NULL);
+		CFRunLoopAddTimer(notifyRl, watch_timer, kCFRunLoopDefaultMode);
+		pthread_mutex_unlock(&watch_lock);
+	}
+
 	pthread_setname_np("n.watch");
 	CFRunLoopRun();
+	watchBatchStop();
 	notifyRl = NULL;
 	return NULL;
 }
@@ -319,8 +486,7 @@ __private_extern__
 void
 do_notify_watch(int argc, char **argv)
 {
-#pragma unused(argc)
-#pragma unused(argv)
+	CFTimeInterval	*interval;
 	pthread_attr_t	tattr;
 	pthread_t	tid;
 
@@ -329,11 +495,22 @@ do_notify_watch(int argc, char **argv)
 		return;
 	}
 
+	interval = malloc(sizeof(*interval));
+	*interval = 0;
+	if (argc == 1) {
+		// report changes (and values) in batches
+		if ((sscanf(argv[0], "%lf", interval) != 1) || (*interval <= 0)) {
+			SCPrint(TRUE, stdout, CFSTR("invalid interval.\n"));
+			free(interval);
+			return;
+		}
+	}
+
 	pthread_attr_init(&tattr);
 	pthread_attr_setscope(&tattr, PTHREAD_SCOPE_SYSTEM);
 	pthread_attr_setdetachstate(&tattr, PTHREAD_CREATE_DETACHED);
 //      pthread_attr_setstacksize(&tattr, 96 * 1024); // each thread gets a 96K stack
-	pthread_create(&tid, &tattr, _watcher, NULL);
+	pthread_create(&tid, &tattr, _watcher, interval);
 	pthread_attr_destroy(&tattr);
 
 	return;
@@ -938,6 +938,26 @@ do_snapshot(int argc, char **argv)
 }
 
 
+__private_extern__
+void
+do_statistics(int argc, char **argv)
+{
+#pragma unused(argc)
+#pragma unused(argv)
+	CFDictionaryRef		stats;
+
+	stats = SCDynamicStoreCopyStatistics(store);
+	if (stats == NULL) {
+		SCPrint(TRUE, stdout, CFSTR("%s\n"), SCErrorString(SCError()));
+		return;
+	}
+
+	SCPrint(TRUE, stdout, CFSTR("%@\n"), stats);
+	CFRelease(stats);
+	return;
+}
+
+
 __private_extern__
 void
 do_renew(char *if_name)